@@ -0,0 +1,299 @@
+// Benchmark driver. Runs each script in this directory under three tiers:
+//   interp  the bytecode interpreter only (--no-jit)
+//   mixed   only leaf functions compiled, so interpreted code calls into the JIT
+//   jit     every function compiled (main itself is always interpreted)
+// Each run builds a fresh VM. Warmup runs are discarded. Program output is
+// captured and hashed, and a tier whose output differs from the others fails
+// the run. Results go out as JSON so they can be compared across commits.
+//
+//   bench [--tiers=interp,mixed,jit] [--warmup=N] [--reps=N] [--filter=SUBSTR]
+//         [--gc=N] [--label=TEXT] [--out=FILE] [--dir=DIR]
+
+#include "lexer.h"
+#include "parser.h"
+#include "ast.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef SIGMA_BENCH_DIR
+#define SIGMA_BENCH_DIR "bench"
+#endif
+
+static const char* const kBenchmarks[] = {
+    "sieve", "qsort", "nbody", "dce", "factorial", "big_factorial",
+    "fib", "matmul", "spectral_norm", "binary_trees", "fannkuch",
+};
+
+namespace {
+    struct Options {
+        std::vector<std::string> tiers{"interp", "mixed", "jit"};
+        int warmup = 1;
+        int reps = 5;
+        size_t gc = 100;
+        std::string filter;
+        std::string label;
+        std::string out;
+        std::string dir = SIGMA_BENCH_DIR;
+    };
+
+    struct Result {
+        std::string name;
+        std::string tier;
+        std::vector<double> ms;
+        uint64_t outputHash = 0;
+        std::string error;
+        bool mismatch = false;
+    };
+}
+
+static bool startsWith(const std::string& s, const std::string& pref) {
+    return s.rfind(pref, 0) == 0;
+}
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> parts;
+    std::stringstream ss(s);
+    for (std::string part; std::getline(ss, part, sep);) {
+        if (!part.empty()) parts.emplace_back(part);
+    }
+    return parts;
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) throw std::runtime_error("cannot open: " + path);
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+static uint64_t fnv1a(const std::string& s) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    std::ostringstream esc;
+                    esc << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+                    out += esc.str();
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+static const char* compilerName() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+// Functions that make no calls; compiling only these keeps every compiled call
+// path out of runtime_call_function's "not compiled" case.
+static std::vector<bool> leafFunctions(const Program& prog) {
+    std::vector<bool> leaf(prog.funcs.size(), true);
+    for (auto& f : prog.funcs) {
+        for (size_t ip = f.entry; ip < f.end;) {
+            auto op = static_cast<Op>(prog.code.buf[ip]);
+            if (op == Op::CALL || op == Op::TAILCALL) leaf[f.id] = false;
+            ip += 1 + operandBytes(op);
+        }
+    }
+    return leaf;
+}
+
+static double runOnce(const Program& prog, const std::string& tier, const Options& opt, std::string& output) {
+    VM vm(&prog);
+    vm.gcThreshold = opt.gc;
+    if (tier == "interp") vm.jit.reset();
+    if (tier == "mixed") vm.compileOnly = leafFunctions(prog);
+
+    vm.output.toMemory();
+    auto t0 = std::chrono::steady_clock::now();
+    vm.run("main");
+    auto t1 = std::chrono::steady_clock::now();
+
+    output = vm.output.memory();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+static void writeStats(std::ostream& out, std::vector<double> ms) {
+    std::sort(ms.begin(), ms.end());
+    size_t n = ms.size();
+    double mean = 0.0;
+    for (double v : ms) mean += v;
+    mean /= static_cast<double>(n);
+    double var = 0.0;
+    for (double v : ms) var += (v - mean) * (v - mean);
+    double stddev = n > 1 ? std::sqrt(var / static_cast<double>(n - 1)) : 0.0;
+    double median = n % 2 ? ms[n / 2] : (ms[n / 2 - 1] + ms[n / 2]) / 2.0;
+
+    out << "\"min_ms\": " << ms.front() << ", \"median_ms\": " << median << ", \"mean_ms\": " << mean
+        << ", \"stddev_ms\": " << stddev << ", \"max_ms\": " << ms.back();
+}
+
+static void writeJson(std::ostream& out, const Options& opt, const std::vector<Result>& results) {
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"schema\": 1,\n";
+    out << "  \"label\": " << jsonString(opt.label) << ",\n";
+    out << "  \"compiler\": " << jsonString(compilerName()) << ",\n";
+    out << "  \"warmup\": " << opt.warmup << ",\n";
+    out << "  \"reps\": " << opt.reps << ",\n";
+    out << "  \"gc_threshold\": " << opt.gc << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": " << jsonString(r.name) << ", \"tier\": " << jsonString(r.tier);
+        if (!r.error.empty()) {
+            out << ", \"error\": " << jsonString(r.error) << "}";
+            continue;
+        }
+        out << ", \"runs_ms\": [";
+        for (size_t k = 0; k < r.ms.size(); ++k) out << (k ? ", " : "") << r.ms[k];
+        out << "], ";
+        writeStats(out, r.ms);
+        std::ostringstream hash;
+        hash << std::hex << std::setw(16) << std::setfill('0') << r.outputHash;
+        out << ", \"output_hash\": \"" << hash.str() << "\"";
+        if (r.mismatch) out << ", \"output_mismatch\": true";
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (startsWith(arg, "--tiers=")) {
+            opt.tiers = split(arg.substr(8), ',');
+        } else if (startsWith(arg, "--warmup=")) {
+            opt.warmup = std::stoi(arg.substr(9));
+        } else if (startsWith(arg, "--reps=")) {
+            opt.reps = std::max(1, std::stoi(arg.substr(7)));
+        } else if (startsWith(arg, "--gc=")) {
+            opt.gc = static_cast<size_t>(std::stoull(arg.substr(5)));
+        } else if (startsWith(arg, "--filter=")) {
+            opt.filter = arg.substr(9);
+        } else if (startsWith(arg, "--label=")) {
+            opt.label = arg.substr(8);
+        } else if (startsWith(arg, "--out=")) {
+            opt.out = arg.substr(6);
+        } else if (startsWith(arg, "--dir=")) {
+            opt.dir = arg.substr(6);
+        } else {
+            std::cerr << "Unknown arg: " << arg << "\n";
+            return 2;
+        }
+    }
+    for (auto& t : opt.tiers) {
+        if (t != "interp" && t != "mixed" && t != "jit") {
+            std::cerr << "Unknown tier: " << t << "\n";
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    bool failed = false;
+
+    for (const char* name : kBenchmarks) {
+        if (!opt.filter.empty() && std::string(name).find(opt.filter) == std::string::npos) continue;
+
+        Program prog;
+        std::string compileError;
+        try {
+            Lexer lx(readFile(opt.dir + "/" + name + ".l1"));
+            Parser ps(lx.lex());
+            auto mod = ps.parseModule();
+            prog.sourceName = std::string(name) + ".l1";
+            mod->gen(prog);
+        } catch (const std::exception& ex) {
+            compileError = ex.what();
+        }
+
+        size_t first = results.size();
+        for (auto& tier : opt.tiers) {
+            Result r;
+            r.name = name;
+            r.tier = tier;
+            r.error = compileError;
+
+            try {
+                std::string output;
+                for (int w = 0; w < opt.warmup && r.error.empty(); ++w) runOnce(prog, tier, opt, output);
+                for (int k = 0; k < opt.reps && r.error.empty(); ++k) {
+                    r.ms.emplace_back(runOnce(prog, tier, opt, output));
+                    r.outputHash = fnv1a(output);
+                }
+            } catch (const std::exception& ex) {
+                r.error = ex.what();
+            }
+
+            if (r.error.empty()) {
+                std::vector<double> sorted = r.ms;
+                std::sort(sorted.begin(), sorted.end());
+                std::cerr << std::left << std::setw(16) << name << std::setw(8) << tier << std::right
+                          << std::fixed << std::setprecision(1) << std::setw(10) << sorted[sorted.size() / 2] << " ms\n";
+            } else {
+                std::cerr << std::left << std::setw(16) << name << std::setw(8) << tier << "error: " << r.error << "\n";
+                failed = true;
+            }
+            results.emplace_back(std::move(r));
+        }
+
+        // Every tier must print the same thing.
+        for (size_t i = first; i < results.size(); ++i) {
+            for (size_t j = first; j < results.size(); ++j) {
+                if (results[i].error.empty() && results[j].error.empty() && results[i].outputHash != results[j].outputHash) {
+                    results[i].mismatch = true;
+                }
+            }
+            if (results[i].mismatch) {
+                std::cerr << results[i].name << ": " << results[i].tier << " output differs from other tiers\n";
+                failed = true;
+            }
+        }
+    }
+
+    if (opt.out.empty()) {
+        writeJson(std::cout, opt, results);
+    } else {
+        std::ofstream out(opt.out);
+        if (!out) {
+            std::cerr << "cannot open: " << opt.out << "\n";
+            return 1;
+        }
+        writeJson(out, opt, results);
+    }
+    return failed ? 1 : 0;
+}
@@ -1,14 +1,25 @@
 #include "ast.h"
+#include "peephole.h"
+#include <algorithm>
 #include <stdexcept>
+#include <unordered_set>
 
 static constexpr int kFloatFlag = (1 << 30);
+static constexpr int kScalarFlag = (1 << 29);
+static constexpr int64_t kMaxScalarArray = 8;
+static constexpr uint32_t kInlineHotCost = 48;
+static constexpr uint32_t kInlineColdCost = 12;
 
 static inline bool slotIsFloat(int slot) {
     return (slot & kFloatFlag) != 0;
 }
 
+static inline bool slotIsScalarArray(int slot) {
+    return (slot & kScalarFlag) != 0;
+}
+
 static inline uint32_t slotIndex(int slot) {
-    return static_cast<uint32_t>(slot & ~kFloatFlag);
+    return static_cast<uint32_t>(slot & ~(kFloatFlag | kScalarFlag));
 }
 
 static inline int slotWithFloat(int slot, bool isFloat) {
@@ -27,8 +38,18 @@ static bool exprIsFloat(const Expr* e, const std::unordered_map<std::string, int
     }
 
     if (auto c = dynamic_cast<const ECall*>(e)) {
-        if (c->callee == "sqrt") return true;
-        return false;
+        if (!c->builtin) return false;
+        switch (c->builtin->result) {
+            case BuiltinResult::Float:
+                return true;
+            case BuiltinResult::SameAsArgs:
+                for (auto& a : c->args) {
+                    if (exprIsFloat(a.get(), locals)) return true;
+                }
+                return false;
+            default:
+                return false;
+        }
     }
 
     if (auto b = dynamic_cast<const EBin*>(e)) {
@@ -60,6 +81,558 @@ static int ensureLocal(std::unordered_map<std::string, int>& locals,
     return id;
 }
 
+// Escape analysis for `let x = array(K)` with a small literal K. If every use of x
+// is x[c] with a literal in-bounds c, the array never leaves the frame and its
+// elements are given K plain local slots instead of a heap allocation.
+namespace {
+    struct ArrayUse {
+        SLet* decl = nullptr;
+        int lets = 0;
+        bool rejected = false;
+        int64_t maxIndex = -1;
+    };
+
+    using ArrayUses = std::unordered_map<std::string, ArrayUse>;
+}
+
+static void scanExpr(Expr* e, ArrayUses& uses);
+
+static void scanIndexed(Expr* array, Expr* index, ArrayUses& uses) {
+    auto v = dynamic_cast<EVar*>(array);
+    if (!v) {
+        scanExpr(array, uses);
+        scanExpr(index, uses);
+        return;
+    }
+
+    auto& u = uses[v->name];
+    auto k = dynamic_cast<EInt*>(index);
+    if (!k || k->v < 0) {
+        u.rejected = true;
+        scanExpr(index, uses);
+        return;
+    }
+    u.maxIndex = std::max(u.maxIndex, k->v);
+}
+
+static void scanExpr(Expr* e, ArrayUses& uses) {
+    if (auto v = dynamic_cast<EVar*>(e)) {
+        uses[v->name].rejected = true;
+    } else if (auto b = dynamic_cast<EBin*>(e)) {
+        scanExpr(b->a.get(), uses);
+        scanExpr(b->b.get(), uses);
+    } else if (auto c = dynamic_cast<ECall*>(e)) {
+        for (auto& a : c->args) scanExpr(a.get(), uses);
+    } else if (auto ai = dynamic_cast<EArrayIndex*>(e)) {
+        scanIndexed(ai->array.get(), ai->index.get(), uses);
+    }
+}
+
+static bool isSmallArrayAlloc(const Expr* e) {
+    auto c = dynamic_cast<const ECall*>(e);
+    if (!c || !c->builtin || c->builtin->op != Op::ARRAY_NEW) return false;
+
+    auto k = dynamic_cast<const EInt*>(c->args[0].get());
+    return k && k->v > 0 && k->v <= kMaxScalarArray;
+}
+
+static void scanStmt(Stmt* s, ArrayUses& uses) {
+    if (!s) return;
+
+    if (auto blk = dynamic_cast<SBlock*>(s)) {
+        for (auto& it : blk->items) scanStmt(it.get(), uses);
+    } else if (auto let = dynamic_cast<SLet*>(s)) {
+        auto& u = uses[let->name];
+        u.lets++;
+        if (let->init && isSmallArrayAlloc(let->init.get())) {
+            u.decl = let;
+        } else {
+            u.rejected = true;
+            if (let->init) scanExpr(let->init.get(), uses);
+        }
+    } else if (auto as = dynamic_cast<SAssign*>(s)) {
+        uses[as->name].rejected = true;
+        scanExpr(as->rhs.get(), uses);
+    } else if (auto aa = dynamic_cast<SArrayAssign*>(s)) {
+        scanIndexed(aa->array.get(), aa->index.get(), uses);
+        scanExpr(aa->value.get(), uses);
+    } else if (auto sif = dynamic_cast<SIf*>(s)) {
+        scanExpr(sif->cond.get(), uses);
+        scanStmt(sif->thenBlk.get(), uses);
+        scanStmt(sif->elseBlk.get(), uses);
+    } else if (auto sw = dynamic_cast<SWhile*>(s)) {
+        scanExpr(sw->cond.get(), uses);
+        scanStmt(sw->body.get(), uses);
+    } else if (auto sf = dynamic_cast<SFor*>(s)) {
+        scanStmt(sf->init.get(), uses);
+        if (sf->cond) scanExpr(sf->cond.get(), uses);
+        scanStmt(sf->step.get(), uses);
+        scanStmt(sf->body.get(), uses);
+    } else if (auto sr = dynamic_cast<SReturn*>(s)) {
+        scanExpr(sr->val.get(), uses);
+    } else if (auto se = dynamic_cast<SExpr*>(s)) {
+        scanExpr(se->e.get(), uses);
+    }
+}
+
+static void markScalarArrays(Func& f) {
+    ArrayUses uses;
+    for (auto& param : f.params) uses[param].rejected = true;
+
+    scanStmt(f.body.get(), uses);
+
+    for (auto& kv : uses) {
+        const ArrayUse& u = kv.second;
+        if (u.rejected || u.lets != 1 || !u.decl) continue;
+
+        auto len = dynamic_cast<const EInt*>(dynamic_cast<const ECall*>(u.decl->init.get())->args[0].get())->v;
+        if (u.maxIndex >= len) continue;
+
+        u.decl->scalarLen = static_cast<uint32_t>(len);
+    }
+}
+
+static int scalarArraySlot(const Expr* array, const std::unordered_map<std::string, int>& locals) {
+    auto v = dynamic_cast<const EVar*>(array);
+    if (!v) return -1;
+
+    auto it = locals.find(v->name);
+    if (it == locals.end() || !slotIsScalarArray(it->second)) return -1;
+    return static_cast<int>(slotIndex(it->second));
+}
+
+// Counted loops `while (i < n) { BODY; i = i + 1; }` (or the equivalent for-loop)
+// whose body only touches a[i] and carries nothing across iterations besides a
+// sum or a counter are emitted as a single bulk array op. The interpreter runs
+// those as tight native loops and the JIT as SIMD kernels.
+namespace {
+    struct ArrayLoop {
+        enum Kind { Sum, Count, Fill, Map } kind = Sum;
+        std::string index;
+        std::string acc;
+        EVar* array = nullptr;
+        Expr* bound = nullptr;
+        bool inclusive = false;
+        Expr* operand = nullptr;
+        EBin::Op2 op = EBin::Add;
+        bool operandFirst = false;
+    };
+}
+
+static bool isVar(const Expr* e, const std::string& name) {
+    auto v = dynamic_cast<const EVar*>(e);
+    return v && v->name == name;
+}
+
+static bool isIncrement(const Stmt* s, const std::string& name) {
+    auto as = dynamic_cast<const SAssign*>(s);
+    if (!as || as->name != name) return false;
+
+    auto b = dynamic_cast<const EBin*>(as->rhs.get());
+    if (!b || b->op != EBin::Add) return false;
+
+    auto isOne = [](const Expr* e) {
+        auto k = dynamic_cast<const EInt*>(e);
+        return k && k->v == 1;
+    };
+    return (isVar(b->a.get(), name) && isOne(b->b.get())) || (isOne(b->a.get()) && isVar(b->b.get(), name));
+}
+
+// The body writes only the index, the accumulator and array elements, so anything
+// built from other locals and pure builtins keeps its value across iterations.
+static bool isLoopInvariant(const Expr* e, const ArrayLoop& L) {
+    if (dynamic_cast<const EInt*>(e) || dynamic_cast<const EFloat*>(e)) return true;
+    if (auto v = dynamic_cast<const EVar*>(e)) return v->name != L.index && v->name != L.acc;
+
+    if (auto b = dynamic_cast<const EBin*>(e)) {
+        return isLoopInvariant(b->a.get(), L) && isLoopInvariant(b->b.get(), L);
+    }
+
+    if (auto c = dynamic_cast<const ECall*>(e)) {
+        if (!c->builtin || !(c->builtin->pure || c->builtin->op == Op::ARRAY_LEN)) return false;
+        for (auto& a : c->args) {
+            if (!isLoopInvariant(a.get(), L)) return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static EVar* indexedArray(Expr* e, const ArrayLoop& L) {
+    auto ai = dynamic_cast<EArrayIndex*>(e);
+    if (!ai || !isVar(ai->index.get(), L.index)) return nullptr;
+
+    auto v = dynamic_cast<EVar*>(ai->array.get());
+    if (!v || v->name == L.index || v->name == L.acc) return nullptr;
+    return v;
+}
+
+static bool matchLoopBody(Stmt* s, ArrayLoop& L) {
+    if (auto as = dynamic_cast<SAssign*>(s)) {
+        auto b = dynamic_cast<EBin*>(as->rhs.get());
+        if (!b || b->op != EBin::Add || as->name == L.index) return false;
+
+        L.kind = ArrayLoop::Sum;
+        L.acc = as->name;
+        if (isVar(b->a.get(), L.acc)) L.array = indexedArray(b->b.get(), L);
+        else if (isVar(b->b.get(), L.acc)) L.array = indexedArray(b->a.get(), L);
+        return L.array != nullptr;
+    }
+
+    if (auto sif = dynamic_cast<SIf*>(s)) {
+        if (sif->elseBlk || sif->thenBlk->items.size() != 1) return false;
+
+        auto inc = dynamic_cast<SAssign*>(sif->thenBlk->items[0].get());
+        if (!inc || inc->name == L.index || !isIncrement(inc, inc->name)) return false;
+
+        auto c = dynamic_cast<EBin*>(sif->cond.get());
+        if (!c || c->op < EBin::Le) return false;
+
+        L.kind = ArrayLoop::Count;
+        L.acc = inc->name;
+        L.op = c->op;
+        if ((L.array = indexedArray(c->a.get(), L))) {
+            L.operand = c->b.get();
+        } else if ((L.array = indexedArray(c->b.get(), L))) {
+            L.operand = c->a.get();
+            switch (c->op) {
+                case EBin::Le: L.op = EBin::Ge; break;
+                case EBin::Lt: L.op = EBin::Gt; break;
+                case EBin::Ge: L.op = EBin::Le; break;
+                case EBin::Gt: L.op = EBin::Lt; break;
+                default: break;
+            }
+        }
+        return L.array && isLoopInvariant(L.operand, L);
+    }
+
+    if (auto aa = dynamic_cast<SArrayAssign*>(s)) {
+        auto target = dynamic_cast<EVar*>(aa->array.get());
+        if (!target || target->name == L.index || !isVar(aa->index.get(), L.index)) return false;
+        L.array = target;
+
+        auto sameElement = [&](Expr* e) {
+            EVar* v = indexedArray(e, L);
+            return v && v->name == target->name;
+        };
+
+        auto b = dynamic_cast<EBin*>(aa->value.get());
+        if (b && b->op <= EBin::Div) {
+            L.kind = ArrayLoop::Map;
+            L.op = b->op;
+            if (sameElement(b->a.get())) {
+                L.operand = b->b.get();
+            } else if (sameElement(b->b.get())) {
+                L.operand = b->a.get();
+                L.operandFirst = true;
+            }
+            if (L.operand) return isLoopInvariant(L.operand, L);
+        }
+
+        L.kind = ArrayLoop::Fill;
+        L.operand = aa->value.get();
+        return isLoopInvariant(L.operand, L);
+    }
+
+    return false;
+}
+
+static bool isIntLocal(const std::string& name, const std::unordered_map<std::string, int>& locals) {
+    auto it = locals.find(name);
+    return it != locals.end() && !slotIsFloat(it->second) && !slotIsScalarArray(it->second);
+}
+
+static Op mapOp(const ArrayLoop& L, bool isFloat) {
+    switch (L.op) {
+        case EBin::Add: return isFloat ? Op::FADD : Op::IADD;
+        case EBin::Mul: return isFloat ? Op::FMUL : Op::IMUL;
+        case EBin::Sub: return isFloat ? Op::FSUB : Op::ISUB;
+        case EBin::Div: return isFloat ? Op::FDIV : Op::NOP;
+        default: return Op::NOP;
+    }
+}
+
+static Op countOp(EBin::Op2 op) {
+    switch (op) {
+        case EBin::Le: return Op::CMPLE;
+        case EBin::Lt: return Op::CMPLT;
+        case EBin::Ge: return Op::CMPGE;
+        case EBin::Gt: return Op::CMPGT;
+        case EBin::Eq: return Op::CMPEQ;
+        default:       return Op::CMPNE;
+    }
+}
+
+static bool genArrayLoop(Program& p, Expr* cond, Stmt* body, Stmt* step,
+                         std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    auto c = dynamic_cast<EBin*>(cond);
+    if (!c || (c->op != EBin::Lt && c->op != EBin::Le)) return false;
+
+    auto iv = dynamic_cast<EVar*>(c->a.get());
+    if (!iv || !isIncrement(step, iv->name)) return false;
+
+    ArrayLoop L;
+    L.index = iv->name;
+    L.bound = c->b.get();
+    L.inclusive = c->op == EBin::Le;
+
+    if (!matchLoopBody(body, L) || !isLoopInvariant(L.bound, L)) return false;
+    if (!isIntLocal(L.index, locals) || exprIsFloat(L.bound, locals)) return false;
+    if (!L.acc.empty() && !isIntLocal(L.acc, locals)) return false;
+
+    auto at = locals.find(L.array->name);
+    if (at == locals.end() || slotIsScalarArray(at->second)) return false;
+
+    Op op = Op::NOP;
+    switch (L.kind) {
+        case ArrayLoop::Count:
+            if (exprIsFloat(L.operand, locals)) return false;
+            op = countOp(L.op);
+            break;
+        case ArrayLoop::Map: {
+            // Only integer add and multiply commute bit-for-bit.
+            bool isFloat = exprIsFloat(L.operand, locals);
+            if (L.operandFirst && (isFloat || (L.op != EBin::Add && L.op != EBin::Mul))) return false;
+            op = mapOp(L, isFloat);
+            if (op == Op::NOP) return false;
+            break;
+        }
+        default:
+            break;
+    }
+
+    auto genLocal = [&](Op o, const std::string& name) {
+        p.code.op(o);
+        p.code.u32(slotIndex(locals[name]));
+    };
+
+    auto genBound = [&] {
+        L.bound->gen(p, 0, locals, nextLocal);
+        if (L.inclusive) {
+            p.code.op(Op::ICONST);
+            p.code.i64(1);
+            p.code.op(Op::IADD);
+        }
+    };
+
+    genLocal(Op::LOAD, L.index);
+    genBound();
+    p.code.op(Op::CMPLT);
+    p.code.op(Op::JMP_IF_FALSE);
+    size_t jz = p.code.pc();
+    p.code.u32(0);
+
+    L.array->gen(p, 0, locals, nextLocal);
+    genLocal(Op::LOAD, L.index);
+    genBound();
+
+    switch (L.kind) {
+        case ArrayLoop::Sum:
+            p.code.op(Op::ARRAY_SUM);
+            genLocal(Op::LOAD, L.acc);
+            p.code.op(Op::IADD);
+            genLocal(Op::STORE, L.acc);
+            break;
+        case ArrayLoop::Count:
+            L.operand->gen(p, 0, locals, nextLocal);
+            p.code.op(Op::ARRAY_COUNT);
+            p.code.u8(static_cast<uint8_t>(op));
+            genLocal(Op::LOAD, L.acc);
+            p.code.op(Op::IADD);
+            genLocal(Op::STORE, L.acc);
+            break;
+        case ArrayLoop::Fill:
+            L.operand->gen(p, 0, locals, nextLocal);
+            p.code.op(Op::ARRAY_FILL);
+            break;
+        case ArrayLoop::Map:
+            L.operand->gen(p, 0, locals, nextLocal);
+            p.code.op(Op::ARRAY_MAP);
+            p.code.u8(static_cast<uint8_t>(op));
+            break;
+    }
+
+    genBound();
+    genLocal(Op::STORE, L.index);
+
+    p.code.patch32(jz, static_cast<uint32_t>(p.code.pc()));
+    return true;
+}
+
+// Small non-recursive functions are spliced into their callers. The arguments
+// are stored to fresh local slots and `return` becomes a jump past the spliced
+// body. Call sites inside loops accept larger bodies than straight-line ones.
+// Functions with loops of their own stay calls: the call cost is amortized, and
+// under the JIT inlining them into the interpreted main would de-optimize them.
+namespace {
+    struct FuncScan {
+        uint32_t cost = 0;
+        bool loops = false;
+        std::vector<std::string> calls;
+        std::vector<std::string> lets;
+    };
+}
+
+static void scanFuncExpr(const Expr* e, FuncScan& fs) {
+    fs.cost++;
+
+    if (auto b = dynamic_cast<const EBin*>(e)) {
+        scanFuncExpr(b->a.get(), fs);
+        scanFuncExpr(b->b.get(), fs);
+    } else if (auto c = dynamic_cast<const ECall*>(e)) {
+        if (!c->builtin) fs.calls.emplace_back(c->callee);
+        for (auto& a : c->args) scanFuncExpr(a.get(), fs);
+    } else if (auto ai = dynamic_cast<const EArrayIndex*>(e)) {
+        scanFuncExpr(ai->array.get(), fs);
+        scanFuncExpr(ai->index.get(), fs);
+    }
+}
+
+static void scanFuncStmt(const Stmt* s, FuncScan& fs) {
+    if (!s) return;
+
+    if (auto blk = dynamic_cast<const SBlock*>(s)) {
+        for (auto& it : blk->items) scanFuncStmt(it.get(), fs);
+        return;
+    }
+
+    fs.cost++;
+
+    if (auto let = dynamic_cast<const SLet*>(s)) {
+        if (let->scalarLen == 0) fs.lets.emplace_back(let->name);
+        if (let->init) scanFuncExpr(let->init.get(), fs);
+    } else if (auto as = dynamic_cast<const SAssign*>(s)) {
+        scanFuncExpr(as->rhs.get(), fs);
+    } else if (auto aa = dynamic_cast<const SArrayAssign*>(s)) {
+        scanFuncExpr(aa->array.get(), fs);
+        scanFuncExpr(aa->index.get(), fs);
+        scanFuncExpr(aa->value.get(), fs);
+    } else if (auto sif = dynamic_cast<const SIf*>(s)) {
+        scanFuncExpr(sif->cond.get(), fs);
+        scanFuncStmt(sif->thenBlk.get(), fs);
+        scanFuncStmt(sif->elseBlk.get(), fs);
+    } else if (auto sw = dynamic_cast<const SWhile*>(s)) {
+        fs.loops = true;
+        scanFuncExpr(sw->cond.get(), fs);
+        scanFuncStmt(sw->body.get(), fs);
+    } else if (auto sf = dynamic_cast<const SFor*>(s)) {
+        fs.loops = true;
+        scanFuncStmt(sf->init.get(), fs);
+        if (sf->cond) scanFuncExpr(sf->cond.get(), fs);
+        scanFuncStmt(sf->step.get(), fs);
+        scanFuncStmt(sf->body.get(), fs);
+    } else if (auto sr = dynamic_cast<const SReturn*>(s)) {
+        scanFuncExpr(sr->val.get(), fs);
+    } else if (auto se = dynamic_cast<const SExpr*>(s)) {
+        scanFuncExpr(se->e.get(), fs);
+    }
+}
+
+static void markInlineCandidates(Program& p, const std::vector<std::unique_ptr<Func>>& funcs) {
+    std::unordered_map<std::string, FuncScan> scans;
+    for (auto& f : funcs) scanFuncStmt(f->body.get(), scans[f->name]);
+
+    auto reaches = [&](const std::string& from, const std::string& target) {
+        std::vector<std::string> work{from};
+        std::unordered_set<std::string> seen;
+        while (!work.empty()) {
+            auto it = scans.find(work.back());
+            work.pop_back();
+            if (it == scans.end()) continue;
+
+            for (auto& callee : it->second.calls) {
+                if (callee == target) return true;
+                if (seen.insert(callee).second) work.emplace_back(callee);
+            }
+        }
+        return false;
+    };
+
+    p.inlineCandidates.assign(p.funcs.size(), {});
+    for (auto& f : funcs) {
+        const FuncScan& fs = scans[f->name];
+        if (f->name == "main" || fs.loops || fs.cost > kInlineHotCost || reaches(f->name, f->name)) continue;
+
+        auto& c = p.inlineCandidates[static_cast<uint32_t>(p.findFuncId(f->name))];
+        c.func = f.get();
+        c.cost = fs.cost;
+    }
+}
+
+static bool inlineSiteInLoop(const Program& p) {
+    return !p.loopStack.empty() || (!p.inlineStack.empty() && p.inlineStack.back().inLoop);
+}
+
+static bool shouldInline(const Program& p, uint32_t fid) {
+    if (fid >= p.inlineCandidates.size() || !p.inlineCandidates[fid].func) return false;
+    return p.inlineCandidates[fid].cost <= (inlineSiteInLoop(p) ? kInlineHotCost : kInlineColdCost);
+}
+
+static bool genInlineCall(ECall& call, uint32_t fid, Program& p,
+                          std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    if (!shouldInline(p, fid)) return false;
+    bool inLoop = inlineSiteInLoop(p);
+
+    Func& f = *p.inlineCandidates[fid].func;
+    for (auto& a : call.args) a->gen(p, 0, locals, nextLocal);
+
+    std::unordered_map<std::string, int> inner;
+    uint32_t base = nextLocal;
+    for (size_t i = 0; i < f.params.size(); ++i) {
+        inner[f.params[i]] = static_cast<int>(base + i);
+    }
+    nextLocal += static_cast<uint32_t>(f.params.size());
+
+    for (size_t i = f.params.size(); i-- > 0;) {
+        p.code.op(Op::STORE);
+        p.code.u32(base + static_cast<uint32_t>(i));
+    }
+
+    // A real call starts from zeroed locals. Inside a loop the spliced slots keep
+    // the previous iteration's values, so clear them explicitly.
+    FuncScan fs;
+    scanFuncStmt(f.body.get(), fs);
+    for (auto& name : fs.lets) {
+        if (inner.count(name)) continue;
+        int slot = ensureLocal(inner, nextLocal, name);
+        if (!inLoop) continue;
+
+        p.code.op(Op::ICONST);
+        p.code.i64(0);
+        p.code.op(Op::STORE);
+        p.code.u32(slotIndex(slot));
+    }
+
+    std::vector<Program::LoopContext> outerLoops;
+    outerLoops.swap(p.loopStack);
+    p.inlineStack.emplace_back();
+    p.inlineStack.back().inLoop = inLoop;
+
+    auto& items = f.body->items;
+    auto tailReturn = items.empty() ? nullptr : dynamic_cast<SReturn*>(items.back().get());
+    size_t n = tailReturn ? items.size() - 1 : items.size();
+    for (size_t i = 0; i < n; ++i) {
+        items[i]->gen(p, fid, inner, nextLocal);
+    }
+
+    if (tailReturn) {
+        tailReturn->val->gen(p, 0, inner, nextLocal);
+    } else {
+        p.code.op(Op::ICONST);
+        p.code.i64(0);
+    }
+
+    size_t end = p.code.pc();
+    for (size_t pos : p.inlineStack.back().returnPatches) {
+        p.code.patch32(pos, static_cast<uint32_t>(end));
+    }
+
+    p.inlineStack.pop_back();
+    p.loopStack.swap(outerLoops);
+    return true;
+}
+
 void EInt::gen(Program& p, uint32_t, std::unordered_map<std::string, int>&, uint32_t&) {
     p.code.op(Op::ICONST);
     p.code.i64(v);
@@ -70,6 +643,10 @@ void EFloat::gen(Program& p, uint32_t, std::unordered_map<std::string, int>&, ui
     p.code.i64(bits);
 }
 
+void EStr::gen(Program&, uint32_t, std::unordered_map<std::string, int>&, uint32_t&) {
+    throw std::runtime_error("string literals are only allowed as file paths");
+}
+
 void EVar::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t&) {
     auto it = locals.find(name);
     if (it == locals.end()) throw std::runtime_error("unknown variable: " + name);
@@ -102,58 +679,67 @@ void EBin::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& local
 }
 
 void ECall::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
-    if (callee == "print") {
-        if (args.size() != 1) throw std::runtime_error("print expects 1 arg");
-        bool isF = exprIsFloat(args[0].get(), locals);
-        args[0]->gen(p, 0, locals, nextLocal);
-        p.code.op(isF ? Op::PRINT_F : Op::PRINT);
-        p.code.op(Op::ICONST);
-        p.code.i64(0);
-        return;
-    }
-    if (callee == "print_big") {
-        if (args.size() != 2) throw std::runtime_error("print_big expects 2 args");
-        args[0]->gen(p, 0, locals, nextLocal);
-        args[1]->gen(p, 0, locals, nextLocal);
-        p.code.op(Op::PRINT_BIG);
-        p.code.op(Op::ICONST);
-        p.code.i64(0);
-        return;
-    }
+    if (builtin) {
+        if (args.size() != builtin->arity) {
+            throw std::runtime_error(
+                    callee + " expects " + std::to_string(builtin->arity) +
+                    (builtin->arity == 1 ? " arg" : " args")
+            );
+        }
 
-    if (callee == "len") {
-        if (args.size() != 1) throw std::runtime_error("len expects 1 arg");
-        args[0]->gen(p, 0, locals, nextLocal);
-        p.code.op(Op::ARRAY_LEN);
-        return;
-    }
+        bool takesPath = builtin->op == Op::MAP_ARRAY || builtin->op == Op::SAVE_ARRAY;
+        if (takesPath && !dynamic_cast<const EStr*>(args[0].get())) {
+            throw std::runtime_error(callee + " expects a string literal path");
+        }
 
-    if (callee == "array") {
-        if (args.size() != 1) throw std::runtime_error("array expects 1 arg");
-        args[0]->gen(p, 0, locals, nextLocal);
-        p.code.op(Op::ARRAY_NEW);
-        return;
-    }
+        // parallel_for(lo, hi, fn, ctx) calls fn(from, to, ctx) on chunks of [lo, hi).
+        bool takesFunc = builtin->op == Op::PARALLEL_FOR;
+        uint32_t funcArg = 0;
+        if (takesFunc) {
+            auto fn = dynamic_cast<const EVar*>(args[2].get());
+            int fid = fn && !locals.count(fn->name) ? p.findFuncId(fn->name) : -1;
+            if (fid < 0) throw std::runtime_error(callee + " expects a function name");
+            if (p.funcs[static_cast<uint32_t>(fid)].arity != 3) {
+                throw std::runtime_error(callee + ": '" + fn->name + "' must take (from, to, ctx)");
+            }
+            funcArg = static_cast<uint32_t>(fid);
+        }
 
-    if (callee == "time_ms" || callee == "now") {
-        if (!args.empty()) throw std::runtime_error("time_ms expects 0 args");
-        p.code.op(Op::TIME_MS);
-        return;
-    }
+        bool anyFloat = false;
+        for (auto& a : args) anyFloat = anyFloat || exprIsFloat(a.get(), locals);
+        for (size_t k = 0; k < args.size(); ++k) {
+            if (takesPath && k == 0) {
+                p.code.op(Op::ICONST);
+                p.code.i64(p.internString(static_cast<const EStr*>(args[0].get())->text));
+            } else if (takesFunc && k == 2) {
+                p.code.op(Op::ICONST);
+                p.code.i64(funcArg);
+            } else {
+                args[k]->gen(p, 0, locals, nextLocal);
+            }
+        }
 
-    if (callee == "rand") {
-        if (!args.empty()) throw std::runtime_error("rand expects 0 args");
-        p.code.op(Op::RAND);
-        return;
-    }
+        Op op = builtin->opFor(anyFloat);
+        if (op != Op::NOP) p.code.op(op);
 
-    if (callee == "sqrt") {
-        if (args.size() != 1) throw std::runtime_error("sqrt expects 1 arg");
-        args[0]->gen(p, 0, locals, nextLocal);
-        p.code.op(Op::FSQRT);
+        if (!builtin->producesValue()) {
+            p.code.op(Op::ICONST);
+            p.code.i64(0);
+        }
         return;
     }
 
+    uint32_t fid = calleeId(p);
+    if (genInlineCall(*this, fid, p, locals, nextLocal)) return;
+
+    for (auto& a : args) a->gen(p, 0, locals, nextLocal);
+
+    p.code.op(Op::CALL);
+    p.code.u32(fid);
+    p.code.u32(static_cast<uint32_t>(args.size()));
+}
+
+uint32_t ECall::calleeId(const Program& p) const {
     int fid = p.findFuncId(callee);
     if (fid < 0) throw std::runtime_error("unknown function: " + callee);
 
@@ -165,24 +751,72 @@ void ECall::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& loca
         );
     }
 
+    return static_cast<uint32_t>(fid);
+}
+
+void ESpawn::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    if (builtin) throw std::runtime_error("spawn: '" + callee + "' is a builtin, not a function");
+
+    uint32_t fid = calleeId(p);
     for (auto& a : args) a->gen(p, 0, locals, nextLocal);
 
-    p.code.op(Op::CALL);
-    p.code.u32(static_cast<uint32_t>(fid));
+    p.code.op(Op::SPAWN);
+    p.code.u32(fid);
+    p.code.u32(static_cast<uint32_t>(args.size()));
+}
+
+// `return f(...)` replaces the current frame instead of stacking a new one.
+// Calls that will be inlined are left to the normal path.
+bool ECall::genTailCall(Program& p, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    if (builtin || !p.inlineStack.empty() || dynamic_cast<const ESpawn*>(this)) return false;
+
+    uint32_t fid = calleeId(p);
+    if (shouldInline(p, fid)) return false;
+
+    for (auto& a : args) a->gen(p, 0, locals, nextLocal);
+
+    p.code.op(Op::TAILCALL);
+    p.code.u32(fid);
     p.code.u32(static_cast<uint32_t>(args.size()));
+    return true;
 }
 
 void EArrayIndex::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    int base = scalarArraySlot(array.get(), locals);
+    if (base >= 0) {
+        auto k = static_cast<const EInt*>(index.get());
+        p.code.op(Op::LOAD);
+        p.code.u32(static_cast<uint32_t>(base + k->v));
+        return;
+    }
+
     array->gen(p, 0, locals, nextLocal);
     index->gen(p, 0, locals, nextLocal);
     p.code.op(Op::ARRAY_GET);
 }
 
 void SBlock::gen(Program& p, uint32_t currentFuncId, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
-    for (auto& s : items) s->gen(p, currentFuncId, locals, nextLocal);
+    for (auto& s : items) {
+        p.markLine(s->line);
+        s->gen(p, currentFuncId, locals, nextLocal);
+    }
 }
 
 void SLet::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    if (scalarLen > 0) {
+        uint32_t base = nextLocal;
+        nextLocal += scalarLen;
+        locals[name] = static_cast<int>(base) | kScalarFlag;
+
+        for (uint32_t k = 0; k < scalarLen; ++k) {
+            p.code.op(Op::ICONST);
+            p.code.i64(0);
+            p.code.op(Op::STORE);
+            p.code.u32(base + k);
+        }
+        return;
+    }
+
     int slot = ensureLocal(locals, nextLocal, name);
 
     if (init) {
@@ -217,6 +851,15 @@ void SAssign::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& lo
 }
 
 void SArrayAssign::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    int base = scalarArraySlot(array.get(), locals);
+    if (base >= 0) {
+        auto k = static_cast<const EInt*>(index.get());
+        value->gen(p, 0, locals, nextLocal);
+        p.code.op(Op::STORE);
+        p.code.u32(static_cast<uint32_t>(base + k->v));
+        return;
+    }
+
     array->gen(p, 0, locals, nextLocal);
     index->gen(p, 0, locals, nextLocal);
     value->gen(p, 0, locals, nextLocal);
@@ -251,6 +894,11 @@ void SIf::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals
 }
 
 void SWhile::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    if (body->items.size() == 2 &&
+        genArrayLoop(p, cond.get(), body->items[0].get(), body->items[1].get(), locals, nextLocal)) {
+        return;
+    }
+
     p.loopStack.emplace_back();
 
     size_t loop_start = p.code.pc();
@@ -267,6 +915,7 @@ void SWhile::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& loc
         p.code.patch32(pos, static_cast<uint32_t>(continue_target));
     }
 
+    p.markLine(line);
     p.code.op(Op::JMP);
     p.code.u32(static_cast<uint32_t>(loop_start));
 
@@ -281,10 +930,15 @@ void SWhile::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& loc
 }
 
 void SFor::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
-    p.loopStack.emplace_back();
-
     if (init) init->gen(p, 0, locals, nextLocal);
 
+    if (cond && step && body->items.size() == 1 &&
+        genArrayLoop(p, cond.get(), body->items[0].get(), step.get(), locals, nextLocal)) {
+        return;
+    }
+
+    p.loopStack.emplace_back();
+
     size_t loop_start = p.code.pc();
 
     if (cond) {
@@ -305,6 +959,7 @@ void SFor::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& local
         p.code.patch32(pos, static_cast<uint32_t>(continue_target));
     }
 
+    p.markLine(line);
     if (step) step->gen(p, 0, locals, nextLocal);
 
     p.code.op(Op::JMP);
@@ -321,7 +976,18 @@ void SFor::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& local
 }
 
 void SReturn::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) {
+    auto call = dynamic_cast<ECall*>(val.get());
+    if (call && call->genTailCall(p, locals, nextLocal)) return;
+
     val->gen(p, 0, locals, nextLocal);
+
+    if (!p.inlineStack.empty()) {
+        p.code.op(Op::JMP);
+        p.inlineStack.back().returnPatches.emplace_back(p.code.pc());
+        p.code.u32(0);
+        return;
+    }
+
     p.code.op(Op::RET);
 }
 
@@ -354,10 +1020,17 @@ void SExpr::gen(Program& p, uint32_t, std::unordered_map<std::string, int>& loca
 
 void Module::gen(Program& p) {
     for (auto& f : funcs) {
+        if (findBuiltin(f->name)) {
+            throw std::runtime_error("function '" + f->name + "' shadows a builtin");
+        }
+
         uint32_t arity = static_cast<uint32_t>(f->params.size());
         p.addFunc(f->name, arity, arity, 0);
+        markScalarArrays(*f);
     }
 
+    markInlineCandidates(p, funcs);
+
     for (auto& f : funcs) {
         auto fid = static_cast<uint32_t>(p.findFuncId(f->name));
         auto& F = p.funcs[fid];
@@ -377,6 +1050,9 @@ void Module::gen(Program& p) {
 
         F.nlocals = nextLocal;
         F.end = p.code.pc();
+        optimizeFunction(p, F);
         F.maxStack = computeMaxStack(p, F);
+        packLineTable(F, p.lines);
+        p.lines.clear();
     }
 }
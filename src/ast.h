@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "builtins.h"
 #include "bytecode.h"
 
 struct Expr;
@@ -32,6 +33,14 @@ struct EFloat : Expr {
     void gen(Program& p, uint32_t, std::unordered_map<std::string, int>&, uint32_t&) override;
 };
 
+// Only valid as the path argument of a file builtin, which gets its index in
+// Program::strings.
+struct EStr : Expr {
+    std::string text;
+    explicit EStr(std::string t) : text(std::move(t)) {}
+    void gen(Program& p, uint32_t, std::unordered_map<std::string, int>&, uint32_t&) override;
+};
+
 struct EVar : Expr {
     std::string name;
     explicit EVar(std::string n) : name(std::move(n)) {}
@@ -48,7 +57,17 @@ struct EBin : Expr {
 struct ECall : Expr {
     std::string callee;
     std::vector<ExprPtr> args;
-    ECall(std::string c, std::vector<ExprPtr> a) : callee(std::move(c)), args(std::move(a)) {}
+    const Builtin* builtin;
+    ECall(std::string c, std::vector<ExprPtr> a) : callee(std::move(c)), args(std::move(a)), builtin(findBuiltin(callee)) {}
+    void gen(Program& p, uint32_t currentFuncId, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) override;
+    bool genTailCall(Program& p, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal);
+    uint32_t calleeId(const Program& p) const;
+};
+
+// `spawn f(args)`: starts f(args) as a task and yields its handle for join().
+// The analyses that look for calls see it as one.
+struct ESpawn : ECall {
+    using ECall::ECall;
     void gen(Program& p, uint32_t currentFuncId, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) override;
 };
 
@@ -60,6 +79,8 @@ struct EArrayIndex : Expr {
 };
 
 struct Stmt {
+    int line = 0;
+
     virtual ~Stmt() = default;
     virtual void gen(Program& p, uint32_t currentFuncId, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) = 0;
 };
@@ -72,6 +93,7 @@ struct SBlock : Stmt {
 struct SLet : Stmt {
     std::string name;
     ExprPtr init;
+    uint32_t scalarLen = 0;
     explicit SLet(std::string n, ExprPtr i) : name(std::move(n)), init(std::move(i)) {}
     void gen(Program& p, uint32_t, std::unordered_map<std::string, int>& locals, uint32_t& nextLocal) override;
 };
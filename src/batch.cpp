@@ -0,0 +1,67 @@
+#include "batch.h"
+#include "vm.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+static void runJob(BatchJob& job, size_t gcThreshold) {
+    auto t0 = std::chrono::steady_clock::now();
+    try {
+        VM vm(job.prog, job.jit);
+        vm.gcThreshold = gcThreshold;
+        vm.output.toMemory();
+        if (job.inputPath.empty()) {
+            vm.input.fromMemory("");
+        } else {
+            vm.input.fromFile(job.inputPath);
+        }
+
+        try {
+            vm.run("main");
+        } catch (...) {
+            job.output = vm.output.memory();
+            throw;
+        }
+        job.output = vm.output.memory();
+    } catch (const std::exception& ex) {
+        job.error = ex.what();
+    }
+    job.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void runBatch(std::vector<BatchJob>& jobs, unsigned threads, size_t gcThreshold,
+              const std::function<void(BatchJob&)>& finished) {
+    std::atomic<size_t> next{0};
+    std::vector<char> done(jobs.size(), 0);
+    std::mutex m;
+    std::condition_variable cv;
+
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < jobs.size();) {
+            runJob(jobs[i], gcThreshold);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                done[i] = 1;
+            }
+            cv.notify_all();
+        }
+    };
+
+    size_t n = std::max<size_t>(1, std::min<size_t>(threads, jobs.size()));
+    std::vector<std::thread> pool;
+    pool.reserve(n);
+    for (size_t t = 0; t < n; ++t) pool.emplace_back(worker);
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return done[i] != 0; });
+        }
+        finished(jobs[i]);
+    }
+
+    for (auto& t : pool) t.join();
+}
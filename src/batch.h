@@ -0,0 +1,27 @@
+#pragma once
+
+#include "bytecode.h"
+#include "jit.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One run of a script in its own VM. Jobs of the same script share its Program
+// and, when compiled, its JITCompiler.
+struct BatchJob {
+    const Program* prog = nullptr;
+    std::shared_ptr<JITCompiler> jit;   // null runs the interpreter only
+    std::string inputPath;              // empty gives the job no input
+    std::string label;
+
+    std::string output;
+    std::string error;
+    double ms = 0.0;
+};
+
+// Runs the jobs on `threads` worker threads. `finished` is called on the calling
+// thread in job order, as soon as a job and every job before it are done.
+void runBatch(std::vector<BatchJob>& jobs, unsigned threads, size_t gcThreshold,
+              const std::function<void(BatchJob&)>& finished);
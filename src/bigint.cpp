@@ -0,0 +1,390 @@
+#include "bigint.h"
+#include <algorithm>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace BigInt {
+
+#if !(defined(_MSC_VER) && !defined(__clang__))
+    __extension__ typedef unsigned __int128 Wide;
+#endif
+
+    // lo of a * b, high half in hi.
+    static inline Limb mulWide(Limb a, Limb b, Limb& hi) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _umul128(a, b, &hi);
+#else
+        Wide p = static_cast<Wide>(a) * b;
+        hi = static_cast<Limb>(p >> 64);
+        return static_cast<Limb>(p);
+#endif
+    }
+
+    // (hi:lo) / d for hi < d, remainder in rem.
+    static inline Limb divWide(Limb hi, Limb lo, Limb d, Limb& rem) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        return _udiv128(hi, lo, d, &rem);
+#else
+        Wide n = (static_cast<Wide>(hi) << 64) | lo;
+        rem = static_cast<Limb>(n % d);
+        return static_cast<Limb>(n / d);
+#endif
+    }
+
+    static inline int leadingZeros(Limb v) {
+        int n = 0;
+        for (Limb bit = Limb(1) << 63; !(v & bit); bit >>= 1) ++n;
+        return n;
+    }
+
+    static void trim(Mag& a) {
+        while (!a.empty() && a.back() == 0) a.pop_back();
+    }
+
+    static Mag slice(const Mag& a, size_t from, size_t to) {
+        from = std::min(from, a.size());
+        to = std::min(to, a.size());
+        Mag out(a.begin() + static_cast<std::ptrdiff_t>(from), a.begin() + static_cast<std::ptrdiff_t>(to));
+        trim(out);
+        return out;
+    }
+
+    // acc += x * 2^(64 * shift)
+    static void addShifted(Mag& acc, const Mag& x, size_t shift) {
+        if (x.empty()) return;
+        if (acc.size() < shift + x.size()) acc.resize(shift + x.size(), 0);
+
+        Limb carry = 0;
+        size_t i = 0;
+        for (; i < x.size(); ++i) {
+            Limb s = acc[shift + i] + x[i];
+            Limb c = s < x[i];
+            s += carry;
+            c += s < carry;
+            acc[shift + i] = s;
+            carry = c;
+        }
+        for (size_t k = shift + i; carry; ++k) {
+            if (k == acc.size()) acc.emplace_back(0);
+            acc[k] += 1;
+            carry = acc[k] == 0;
+        }
+    }
+
+    // acc -= x, acc >= x
+    static void subInPlace(Mag& acc, const Mag& x) {
+        Limb borrow = 0;
+        size_t i = 0;
+        for (; i < x.size(); ++i) {
+            Limb d = acc[i] - x[i];
+            Limb b = acc[i] < x[i];
+            b += d < borrow;
+            acc[i] = d - borrow;
+            borrow = b;
+        }
+        for (; borrow; ++i) {
+            borrow = acc[i] == 0;
+            acc[i] -= 1;
+        }
+        trim(acc);
+    }
+
+    // a /= d in place, returning the remainder.
+    static Limb divSmall(Mag& a, Limb d) {
+        Limb rem = 0;
+        for (size_t i = a.size(); i-- > 0;) a[i] = divWide(rem, a[i], d, rem);
+        trim(a);
+        return rem;
+    }
+
+    Mag fromU64(uint64_t v) {
+        return v ? Mag{v} : Mag{};
+    }
+
+    int compare(const Mag& a, const Mag& b) {
+        if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+        for (size_t i = a.size(); i-- > 0;) {
+            if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    Mag add(const Mag& a, const Mag& b) {
+        Mag out = a;
+        addShifted(out, b, 0);
+        return out;
+    }
+
+    Mag sub(const Mag& a, const Mag& b) {
+        Mag out = a;
+        subInPlace(out, b);
+        return out;
+    }
+
+    static Mag schoolbook(const Mag& a, const Mag& b) {
+        Mag r(a.size() + b.size(), 0);
+        for (size_t i = 0; i < a.size(); ++i) {
+            Limb carry = 0;
+            for (size_t j = 0; j < b.size(); ++j) {
+                Limb hi;
+                Limb lo = mulWide(a[i], b[j], hi);
+                lo += r[i + j];
+                hi += lo < r[i + j];
+                lo += carry;
+                hi += lo < carry;
+                r[i + j] = lo;
+                carry = hi;
+            }
+            r[i + b.size()] = carry;
+        }
+        trim(r);
+        return r;
+    }
+
+    // a much longer than b: multiply b by each b-sized piece of a.
+    static Mag unbalanced(const Mag& a, const Mag& b) {
+        Mag r;
+        for (size_t from = 0; from < a.size(); from += b.size()) {
+            addShifted(r, mul(slice(a, from, from + b.size()), b), from);
+        }
+        return r;
+    }
+
+    static Mag karatsuba(const Mag& a, const Mag& b) {
+        size_t m = (a.size() + 1) / 2;
+        Mag a0 = slice(a, 0, m), a1 = slice(a, m, a.size());
+        Mag b0 = slice(b, 0, m), b1 = slice(b, m, b.size());
+
+        Mag z0 = mul(a0, b0);
+        Mag z2 = mul(a1, b1);
+        Mag z1 = mul(add(a0, a1), add(b0, b1));
+        subInPlace(z1, z0);
+        subInPlace(z1, z2);
+
+        Mag r = std::move(z0);
+        addShifted(r, z1, m);
+        addShifted(r, z2, 2 * m);
+        return r;
+    }
+
+    namespace {
+        struct Signed {
+            Mag mag;
+            bool neg = false;
+        };
+    }
+
+    static Signed sadd(const Signed& x, const Signed& y) {
+        if (x.neg == y.neg) return {add(x.mag, y.mag), x.neg};
+        int c = compare(x.mag, y.mag);
+        if (c == 0) return {};
+        return c > 0 ? Signed{sub(x.mag, y.mag), x.neg} : Signed{sub(y.mag, x.mag), y.neg};
+    }
+
+    static Signed ssub(const Signed& x, const Signed& y) {
+        return sadd(x, {y.mag, !y.neg && !y.mag.empty()});
+    }
+
+    static Signed smul(const Signed& x, const Signed& y) {
+        Mag m = mul(x.mag, y.mag);
+        bool neg = x.neg != y.neg && !m.empty();
+        return {std::move(m), neg};
+    }
+
+    // Exact division by a small constant; the sign is unchanged.
+    static Signed sdiv(Signed x, Limb d) {
+        divSmall(x.mag, d);
+        return x;
+    }
+
+    // Evaluates both operands at 0, 1, -1, -2 and infinity and interpolates with
+    // Bodrato's sequence, so five products of a third of the size replace nine.
+    static Mag toom3(const Mag& a, const Mag& b) {
+        size_t k = (a.size() + 2) / 3;
+
+        auto evaluate = [k](const Mag& x, Signed (&at)[5]) {
+            Signed x0{slice(x, 0, k)}, x1{slice(x, k, 2 * k)}, x2{slice(x, 2 * k, x.size())};
+            Signed even = sadd(x0, x2);
+            at[0] = x0;
+            at[1] = sadd(even, x1);
+            at[2] = ssub(even, x1);
+            Signed t = sadd(at[2], x2);
+            at[3] = ssub(sadd(t, t), x0);
+            at[4] = x2;
+        };
+
+        Signed pa[5], pb[5];
+        evaluate(a, pa);
+        evaluate(b, pb);
+
+        Signed r0 = smul(pa[0], pb[0]);
+        Signed r1 = smul(pa[1], pb[1]);
+        Signed rm1 = smul(pa[2], pb[2]);
+        Signed rm2 = smul(pa[3], pb[3]);
+        Signed r4 = smul(pa[4], pb[4]);
+
+        Signed c3 = sdiv(ssub(rm2, r1), 3);
+        Signed c1 = sdiv(ssub(r1, rm1), 2);
+        Signed c2 = ssub(rm1, r0);
+        c3 = sadd(sdiv(ssub(c2, c3), 2), sadd(r4, r4));
+        c2 = ssub(sadd(c2, c1), r4);
+        c1 = ssub(c1, c3);
+
+        Mag r = std::move(r0.mag);
+        addShifted(r, c1.mag, k);
+        addShifted(r, c2.mag, 2 * k);
+        addShifted(r, c3.mag, 3 * k);
+        addShifted(r, r4.mag, 4 * k);
+        return r;
+    }
+
+    Mag mul(const Mag& a, const Mag& b) {
+        if (a.empty() || b.empty()) return {};
+        if (a.size() < b.size()) return mul(b, a);
+
+        if (b.size() < kKaratsubaThreshold) return schoolbook(a, b);
+        if (2 * b.size() <= a.size()) return unbalanced(a, b);
+        if (b.size() < kToom3Threshold) return karatsuba(a, b);
+        return toom3(a, b);
+    }
+
+    // Knuth's algorithm D on operands normalized so the divisor's top bit is set.
+    void divmod(const Mag& a, const Mag& b, Mag& q, Mag& r) {
+        if (compare(a, b) < 0) {
+            q.clear();
+            r = a;
+            return;
+        }
+        if (b.size() == 1) {
+            q = a;
+            r = fromU64(divSmall(q, b[0]));
+            return;
+        }
+
+        int s = leadingZeros(b.back());
+        size_t n = b.size();
+        size_t m = a.size() - n;
+
+        Mag v(n), u(a.size() + 1);
+        for (size_t i = n; i-- > 0;) {
+            v[i] = (b[i] << s) | (s && i ? b[i - 1] >> (64 - s) : 0);
+        }
+        u[a.size()] = s ? a.back() >> (64 - s) : 0;
+        for (size_t i = a.size(); i-- > 0;) {
+            u[i] = (a[i] << s) | (s && i ? a[i - 1] >> (64 - s) : 0);
+        }
+
+        q.assign(m + 1, 0);
+        Limb vTop = v[n - 1], vNext = v[n - 2];
+
+        for (size_t j = m + 1; j-- > 0;) {
+            Limb qhat, rhat;
+            bool rhatOverflow = false;
+            if (u[j + n] >= vTop) {
+                qhat = ~Limb(0);
+                rhat = u[j + n - 1] + vTop;
+                rhatOverflow = rhat < vTop;
+            } else {
+                qhat = divWide(u[j + n], u[j + n - 1], vTop, rhat);
+            }
+
+            while (!rhatOverflow) {
+                Limb hi;
+                Limb lo = mulWide(qhat, vNext, hi);
+                if (hi < rhat || (hi == rhat && lo <= u[j + n - 2])) break;
+                --qhat;
+                rhat += vTop;
+                rhatOverflow = rhat < vTop;
+            }
+
+            Limb carry = 0, borrow = 0;
+            for (size_t i = 0; i < n; ++i) {
+                Limb hi;
+                Limb lo = mulWide(qhat, v[i], hi);
+                lo += carry;
+                hi += lo < carry;
+                Limb d = u[i + j] - lo;
+                Limb nb = u[i + j] < lo;
+                nb += d < borrow;
+                u[i + j] = d - borrow;
+                borrow = nb;
+                carry = hi;
+            }
+            Limb top = u[j + n];
+            bool negative = top < carry || top - carry < borrow;
+            u[j + n] = top - carry - borrow;
+
+            if (negative) {
+                --qhat;
+                Limb c = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    Limb sum = u[i + j] + v[i];
+                    Limb nc = sum < v[i];
+                    sum += c;
+                    nc += sum < c;
+                    u[i + j] = sum;
+                    c = nc;
+                }
+                u[j + n] += c;
+            }
+            q[j] = qhat;
+        }
+
+        r.assign(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            r[i] = (u[i] >> s) | (s ? u[i + 1] << (64 - s) : 0);
+        }
+        trim(q);
+        trim(r);
+    }
+
+    static constexpr Limb kChunk = 10000000000000000000ull;     // 10^19
+    static constexpr size_t kChunkDigits = 19;
+    static constexpr size_t kBaseCaseLimbs = 24;
+
+    // Appends x in decimal, left-padded with zeros to `width` (0 = no padding).
+    static void appendDecimal(Mag x, size_t width, std::string& out) {
+        std::string digits;
+        while (!x.empty()) {
+            Limb chunk = divSmall(x, kChunk);
+            for (size_t i = 0; i < kChunkDigits && (chunk || !x.empty()); ++i) {
+                digits.push_back(static_cast<char>('0' + chunk % 10));
+                chunk /= 10;
+            }
+        }
+        if (digits.size() < width) digits.append(width - digits.size(), '0');
+        out.append(digits.rbegin(), digits.rend());
+    }
+
+    // powers[k] = 10^(19 * 2^k)
+    static void convert(const Mag& x, const std::vector<Mag>& powers, size_t level, size_t width, std::string& out) {
+        if (level == 0 || x.size() < kBaseCaseLimbs) {
+            appendDecimal(x, width, out);
+            return;
+        }
+
+        --level;
+        Mag q, r;
+        divmod(x, powers[level], q, r);
+        size_t low = kChunkDigits << level;
+        if (q.empty() && width == 0) {
+            convert(r, powers, level, 0, out);
+            return;
+        }
+        convert(q, powers, level, width > low ? width - low : 0, out);
+        convert(r, powers, level, low, out);
+    }
+
+    std::string toString(const Mag& a) {
+        if (a.empty()) return "0";
+
+        std::vector<Mag> powers{fromU64(kChunk)};
+        while (2 * powers.back().size() <= a.size()) powers.emplace_back(mul(powers.back(), powers.back()));
+
+        std::string out;
+        convert(a, powers, powers.size(), 0, out);
+        return out;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Unsigned arbitrary-precision arithmetic on little-endian 64-bit limbs. A
+// magnitude never has high zero limbs, so zero is the empty vector.
+namespace BigInt {
+
+    using Limb = uint64_t;
+    using Mag = std::vector<Limb>;
+
+    Mag fromU64(uint64_t v);
+
+    int compare(const Mag& a, const Mag& b);
+
+    Mag add(const Mag& a, const Mag& b);
+    Mag sub(const Mag& a, const Mag& b);     // a >= b
+
+    // Schoolbook below kKaratsubaThreshold limbs, Toom-3 from kToom3Threshold,
+    // Karatsuba in between. Lopsided operands are cut into balanced pieces.
+    Mag mul(const Mag& a, const Mag& b);
+
+    // Truncating division; b must be non-zero.
+    void divmod(const Mag& a, const Mag& b, Mag& q, Mag& r);
+
+    // Decimal digits, split recursively by powers 10^(19 * 2^k).
+    std::string toString(const Mag& a);
+
+    constexpr size_t kKaratsubaThreshold = 48;
+    constexpr size_t kToom3Threshold = 240;
+}
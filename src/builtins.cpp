@@ -0,0 +1,71 @@
+#include "builtins.h"
+#include <unordered_map>
+
+static const Builtin kBuiltins[] = {
+    // name        op                floatOp       arity  result                       pure   jitInline
+    {"print",      Op::PRINT,        Op::PRINT_F,  1,     BuiltinResult::Unit,         false, false},
+    {"print_big",  Op::PRINT_BIG,    Op::NOP,      2,     BuiltinResult::Unit,         false, false},
+    {"print_array", Op::PRINT_ARRAY, Op::NOP,      1,     BuiltinResult::Unit,         false, false},
+    {"flush",      Op::FLUSH,        Op::NOP,      0,     BuiltinResult::Unit,         false, false},
+    {"read_int",   Op::READ_INT,     Op::NOP,      0,     BuiltinResult::Int,          false, false},
+    {"read_float", Op::READ_FLOAT,   Op::NOP,      0,     BuiltinResult::Float,        false, false},
+    {"read_ints",  Op::READ_INTS,    Op::NOP,      1,     BuiltinResult::Int,          false, false},
+    {"read_floats", Op::READ_FLOATS, Op::NOP,      1,     BuiltinResult::Int,          false, false},
+    {"eof",        Op::READ_EOF,     Op::NOP,      0,     BuiltinResult::Int,          false, false},
+    {"len",        Op::ARRAY_LEN,    Op::NOP,      1,     BuiltinResult::Int,          false, false},
+    {"array",      Op::ARRAY_NEW,    Op::NOP,      1,     BuiltinResult::Int,          false, false},
+    {"map_array",  Op::MAP_ARRAY,    Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"save_array", Op::SAVE_ARRAY,   Op::NOP,      2,     BuiltinResult::Unit,         false, false},
+    {"parallel_for", Op::PARALLEL_FOR, Op::NOP,    4,     BuiltinResult::Int,          false, false},
+    {"join",       Op::JOIN,         Op::NOP,      1,     BuiltinResult::Int,          false, false},
+    {"fill",       Op::ARRAY_FILL,   Op::NOP,      4,     BuiltinResult::Unit,         false, false},
+    {"copy",       Op::ARRAY_COPY,   Op::NOP,      5,     BuiltinResult::Unit,         false, false},
+    {"slice",      Op::ARRAY_SLICE,  Op::NOP,      3,     BuiltinResult::Int,          false, false},
+    {"equal",      Op::ARRAY_EQUAL,  Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"bigint",     Op::BIGINT,       Op::NOP,      1,     BuiltinResult::Int,          false, false},
+    {"big_add",    Op::BIG_ADD,      Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"big_sub",    Op::BIG_SUB,      Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"big_mul",    Op::BIG_MUL,      Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"big_div",    Op::BIG_DIV,      Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"big_mod",    Op::BIG_MOD,      Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"big_cmp",    Op::BIG_CMP,      Op::NOP,      2,     BuiltinResult::Int,          false, false},
+    {"print_bigint", Op::PRINT_BIGINT, Op::NOP,    1,     BuiltinResult::Unit,         false, false},
+    {"time_ms",    Op::TIME_MS,      Op::NOP,      0,     BuiltinResult::Int,          false, false},
+    {"now",        Op::TIME_MS,      Op::NOP,      0,     BuiltinResult::Int,          false, false},
+    {"rand",       Op::RAND,         Op::NOP,      0,     BuiltinResult::Int,          false, false},
+    {"sqrt",       Op::FSQRT,        Op::FSQRT,    1,     BuiltinResult::Float,        true,  true},
+    {"min",        Op::IMIN,         Op::FMIN,     2,     BuiltinResult::SameAsArgs,   true,  true},
+    {"max",        Op::IMAX,         Op::FMAX,     2,     BuiltinResult::SameAsArgs,   true,  true},
+    {"abs",        Op::IABS,         Op::FABS,     1,     BuiltinResult::SameAsArgs,   true,  true},
+    {"floor",      Op::NOP,          Op::FFLOOR,   1,     BuiltinResult::SameAsArgs,   true,  true},
+    {"band",       Op::IAND,         Op::NOP,      2,     BuiltinResult::Int,          true,  true},
+    {"bor",        Op::IOR,          Op::NOP,      2,     BuiltinResult::Int,          true,  true},
+    {"bxor",       Op::IXOR,         Op::NOP,      2,     BuiltinResult::Int,          true,  true},
+    {"shl",        Op::ISHL,         Op::NOP,      2,     BuiltinResult::Int,          true,  true},
+    {"shr",        Op::ISHR,         Op::NOP,      2,     BuiltinResult::Int,          true,  true},
+};
+
+const Builtin* findBuiltin(const std::string& name) {
+    static const std::unordered_map<std::string, const Builtin*> byName = [] {
+        std::unordered_map<std::string, const Builtin*> m;
+        for (const auto& b : kBuiltins) m.emplace(b.name, &b);
+        return m;
+    }();
+
+    auto it = byName.find(name);
+    return it == byName.end() ? nullptr : it->second;
+}
+
+const Builtin* builtinForOp(Op op) {
+    static const std::unordered_map<uint8_t, const Builtin*> byOp = [] {
+        std::unordered_map<uint8_t, const Builtin*> m;
+        for (const auto& b : kBuiltins) {
+            if (b.op != Op::NOP) m.emplace(static_cast<uint8_t>(b.op), &b);
+            if (b.floatOp != Op::NOP) m.emplace(static_cast<uint8_t>(b.floatOp), &b);
+        }
+        return m;
+    }();
+
+    auto it = byOp.find(static_cast<uint8_t>(op));
+    return it == byOp.end() ? nullptr : it->second;
+}
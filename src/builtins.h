@@ -0,0 +1,31 @@
+#pragma once
+
+#include "bytecode.h"
+#include <cstdint>
+#include <string>
+
+enum class BuiltinResult : uint8_t {
+    Int,
+    Float,
+    SameAsArgs,
+    Unit
+};
+
+struct Builtin {
+    const char* name;
+    Op op;
+    Op floatOp;
+    uint32_t arity;
+    BuiltinResult result;
+    bool pure;
+    bool jitInline;
+
+    Op opFor(bool anyFloatArg) const {
+        return (anyFloatArg && floatOp != Op::NOP) ? floatOp : op;
+    }
+
+    bool producesValue() const { return result != BuiltinResult::Unit; }
+};
+
+const Builtin* findBuiltin(const std::string& name);
+const Builtin* builtinForOp(Op op);
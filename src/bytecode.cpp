@@ -9,7 +9,7 @@ static inline uint32_t loadU32p(const uint8_t* p) {
     return v;
 }
 
-static int stackEffect(Op op, uint32_t immArgc = 0) {
+int stackEffect(Op op, uint32_t immArgc) {
     switch (op) {
         case Op::NOP: return 0;
 
@@ -48,7 +48,21 @@ static int stackEffect(Op op, uint32_t immArgc = 0) {
         case Op::FCMPNE:
             return -1;
 
+        case Op::IMIN:
+        case Op::IMAX:
+        case Op::FMIN:
+        case Op::FMAX:
+        case Op::IAND:
+        case Op::IOR:
+        case Op::IXOR:
+        case Op::ISHL:
+        case Op::ISHR:
+            return -1;
+
         case Op::FSQRT:
+        case Op::IABS:
+        case Op::FABS:
+        case Op::FFLOOR:
             return 0;
 
         case Op::POP:     return -1;
@@ -59,14 +73,76 @@ static int stackEffect(Op op, uint32_t immArgc = 0) {
         case Op::ARRAY_GET: return -1;
         case Op::ARRAY_SET: return -3;
         case Op::ARRAY_LEN: return 0;
+        case Op::ARRAY_FILL:  return -4;
+        case Op::ARRAY_COPY:  return -5;
+        case Op::ARRAY_SLICE: return -2;
+        case Op::ARRAY_EQUAL: return -1;
+        case Op::ARRAY_SUM:   return -2;
+        case Op::ARRAY_COUNT: return -3;
+        case Op::ARRAY_MAP:   return -4;
+
+        case Op::BIGINT:       return 0;
+        case Op::BIG_ADD:
+        case Op::BIG_SUB:
+        case Op::BIG_MUL:
+        case Op::BIG_DIV:
+        case Op::BIG_MOD:
+        case Op::BIG_CMP:      return -1;
+        case Op::PRINT_BIGINT: return -1;
+
+        case Op::PRINT_ARRAY: return -1;
+        case Op::FLUSH:       return 0;
+
+        case Op::READ_INT:    return +1;
+        case Op::READ_FLOAT:  return +1;
+        case Op::READ_INTS:   return 0;
+        case Op::READ_FLOATS: return 0;
+        case Op::READ_EOF:    return +1;
+
+        case Op::MAP_ARRAY:   return -1;
+        case Op::SAVE_ARRAY:  return -2;
+
+        case Op::PARALLEL_FOR: return -3;
+        case Op::JOIN:         return 0;
+
+        case Op::INC_LOCAL: return 0;
 
         case Op::TIME_MS: return +1;
         case Op::RAND:    return +1;
 
         case Op::JMP:          return 0;
         case Op::JMP_IF_FALSE: return -1;
+        case Op::JNE_ZERO:     return -1;
+
+        case Op::JLT_LOCALS:
+        case Op::JLE_LOCALS:
+        case Op::JGT_LOCALS:
+        case Op::JGE_LOCALS:
+        case Op::JEQ_LOCALS:
+        case Op::JNE_LOCALS:
+        case Op::FJNLT_LOCALS:
+        case Op::FJNLE_LOCALS:
+        case Op::FJNGT_LOCALS:
+        case Op::FJNGE_LOCALS:
+        case Op::FJNEQ_LOCALS:
+        case Op::FJNNE_LOCALS:
+        case Op::JLT_LOCAL_CONST:
+        case Op::JLE_LOCAL_CONST:
+        case Op::JGT_LOCAL_CONST:
+        case Op::JGE_LOCAL_CONST:
+        case Op::JEQ_LOCAL_CONST:
+        case Op::JNE_LOCAL_CONST:
+        case Op::FJNLT_LOCAL_CONST:
+        case Op::FJNLE_LOCAL_CONST:
+        case Op::FJNGT_LOCAL_CONST:
+        case Op::FJNGE_LOCAL_CONST:
+        case Op::FJNEQ_LOCAL_CONST:
+        case Op::FJNNE_LOCAL_CONST:
+            return 0;
 
         case Op::CALL: return -static_cast<int>(immArgc) + 1;
+        case Op::TAILCALL: return -static_cast<int>(immArgc);
+        case Op::SPAWN: return -static_cast<int>(immArgc) + 1;
         case Op::RET:  return -1;
         case Op::HALT: return 0;
 
@@ -75,6 +151,307 @@ static int stackEffect(Op op, uint32_t immArgc = 0) {
     return 0;
 }
 
+static void putUleb(std::vector<uint8_t>& out, uint64_t v) {
+    do {
+        uint8_t b = v & 0x7F;
+        v >>= 7;
+        out.emplace_back(v ? (b | 0x80) : b);
+    } while (v);
+}
+
+static uint64_t getUleb(const std::vector<uint8_t>& in, size_t& at) {
+    uint64_t v = 0;
+    for (int shift = 0; at < in.size(); shift += 7) {
+        uint8_t b = in[at++];
+        v |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+    }
+    return v;
+}
+
+void packLineTable(Function& fn, const std::vector<LineEntry>& lines) {
+    fn.lineTable.clear();
+    uint64_t pc = fn.entry;
+    int64_t line = 0;
+    for (auto& e : lines) {
+        if (e.pc < fn.entry || e.pc >= fn.end) continue;
+        int64_t delta = e.line - line;
+        putUleb(fn.lineTable, e.pc - pc);
+        putUleb(fn.lineTable, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        pc = e.pc;
+        line = e.line;
+    }
+}
+
+int Function::lineAt(size_t pc) const {
+    size_t at = 0;
+    uint64_t cur = entry;
+    int64_t line = 0;
+    int found = 0;
+    while (at < lineTable.size()) {
+        cur += getUleb(lineTable, at);
+        uint64_t z = getUleb(lineTable, at);
+        line += static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+        if (cur > pc) break;
+        found = static_cast<int>(line);
+    }
+    return found;
+}
+
+const char* opName(Op op) {
+    switch (op) {
+        case Op::NOP: return "NOP";
+        case Op::ICONST: return "ICONST";
+        case Op::LOAD: return "LOAD";
+        case Op::STORE: return "STORE";
+        case Op::IADD: return "IADD";
+        case Op::ISUB: return "ISUB";
+        case Op::IMUL: return "IMUL";
+        case Op::IDIV: return "IDIV";
+        case Op::IMOD: return "IMOD";
+        case Op::CMPLE: return "CMPLE";
+        case Op::CMPLT: return "CMPLT";
+        case Op::CMPGE: return "CMPGE";
+        case Op::CMPGT: return "CMPGT";
+        case Op::CMPEQ: return "CMPEQ";
+        case Op::CMPNE: return "CMPNE";
+        case Op::JMP: return "JMP";
+        case Op::JMP_IF_FALSE: return "JMP_IF_FALSE";
+        case Op::CALL: return "CALL";
+        case Op::RET: return "RET";
+        case Op::POP: return "POP";
+        case Op::PRINT: return "PRINT";
+        case Op::HALT: return "HALT";
+        case Op::ARRAY_NEW: return "ARRAY_NEW";
+        case Op::ARRAY_GET: return "ARRAY_GET";
+        case Op::ARRAY_SET: return "ARRAY_SET";
+        case Op::ARRAY_LEN: return "ARRAY_LEN";
+        case Op::TIME_MS: return "TIME_MS";
+        case Op::RAND: return "RAND";
+        case Op::FCONST: return "FCONST";
+        case Op::I2F: return "I2F";
+        case Op::F2I: return "F2I";
+        case Op::FADD: return "FADD";
+        case Op::FSUB: return "FSUB";
+        case Op::FMUL: return "FMUL";
+        case Op::FDIV: return "FDIV";
+        case Op::FCMPLE: return "FCMPLE";
+        case Op::FCMPLT: return "FCMPLT";
+        case Op::FCMPGE: return "FCMPGE";
+        case Op::FCMPGT: return "FCMPGT";
+        case Op::FCMPEQ: return "FCMPEQ";
+        case Op::FCMPNE: return "FCMPNE";
+        case Op::FSQRT: return "FSQRT";
+        case Op::PRINT_BIG: return "PRINT_BIG";
+        case Op::PRINT_F: return "PRINT_F";
+        case Op::IMIN: return "IMIN";
+        case Op::IMAX: return "IMAX";
+        case Op::IABS: return "IABS";
+        case Op::FMIN: return "FMIN";
+        case Op::FMAX: return "FMAX";
+        case Op::FABS: return "FABS";
+        case Op::FFLOOR: return "FFLOOR";
+        case Op::IAND: return "IAND";
+        case Op::IOR: return "IOR";
+        case Op::IXOR: return "IXOR";
+        case Op::ISHL: return "ISHL";
+        case Op::ISHR: return "ISHR";
+        case Op::ARRAY_FILL: return "ARRAY_FILL";
+        case Op::ARRAY_COPY: return "ARRAY_COPY";
+        case Op::ARRAY_SLICE: return "ARRAY_SLICE";
+        case Op::ARRAY_EQUAL: return "ARRAY_EQUAL";
+        case Op::ARRAY_SUM: return "ARRAY_SUM";
+        case Op::ARRAY_COUNT: return "ARRAY_COUNT";
+        case Op::ARRAY_MAP: return "ARRAY_MAP";
+        case Op::BIGINT: return "BIGINT";
+        case Op::BIG_ADD: return "BIG_ADD";
+        case Op::BIG_SUB: return "BIG_SUB";
+        case Op::BIG_MUL: return "BIG_MUL";
+        case Op::BIG_DIV: return "BIG_DIV";
+        case Op::BIG_MOD: return "BIG_MOD";
+        case Op::BIG_CMP: return "BIG_CMP";
+        case Op::PRINT_BIGINT: return "PRINT_BIGINT";
+        case Op::PRINT_ARRAY: return "PRINT_ARRAY";
+        case Op::FLUSH: return "FLUSH";
+        case Op::READ_INT: return "READ_INT";
+        case Op::READ_FLOAT: return "READ_FLOAT";
+        case Op::READ_INTS: return "READ_INTS";
+        case Op::READ_FLOATS: return "READ_FLOATS";
+        case Op::READ_EOF: return "READ_EOF";
+        case Op::MAP_ARRAY: return "MAP_ARRAY";
+        case Op::SAVE_ARRAY: return "SAVE_ARRAY";
+        case Op::PARALLEL_FOR: return "PARALLEL_FOR";
+        case Op::SPAWN: return "SPAWN";
+        case Op::JOIN: return "JOIN";
+        case Op::TAILCALL: return "TAILCALL";
+        case Op::INC_LOCAL: return "INC_LOCAL";
+        case Op::JLT_LOCALS: return "JLT_LOCALS";
+        case Op::JLE_LOCALS: return "JLE_LOCALS";
+        case Op::JGT_LOCALS: return "JGT_LOCALS";
+        case Op::JGE_LOCALS: return "JGE_LOCALS";
+        case Op::JEQ_LOCALS: return "JEQ_LOCALS";
+        case Op::JNE_LOCALS: return "JNE_LOCALS";
+        case Op::JLT_LOCAL_CONST: return "JLT_LOCAL_CONST";
+        case Op::JLE_LOCAL_CONST: return "JLE_LOCAL_CONST";
+        case Op::JGT_LOCAL_CONST: return "JGT_LOCAL_CONST";
+        case Op::JGE_LOCAL_CONST: return "JGE_LOCAL_CONST";
+        case Op::JEQ_LOCAL_CONST: return "JEQ_LOCAL_CONST";
+        case Op::JNE_LOCAL_CONST: return "JNE_LOCAL_CONST";
+        case Op::FJNLT_LOCALS: return "FJNLT_LOCALS";
+        case Op::FJNLE_LOCALS: return "FJNLE_LOCALS";
+        case Op::FJNGT_LOCALS: return "FJNGT_LOCALS";
+        case Op::FJNGE_LOCALS: return "FJNGE_LOCALS";
+        case Op::FJNEQ_LOCALS: return "FJNEQ_LOCALS";
+        case Op::FJNNE_LOCALS: return "FJNNE_LOCALS";
+        case Op::FJNLT_LOCAL_CONST: return "FJNLT_LOCAL_CONST";
+        case Op::FJNLE_LOCAL_CONST: return "FJNLE_LOCAL_CONST";
+        case Op::FJNGT_LOCAL_CONST: return "FJNGT_LOCAL_CONST";
+        case Op::FJNGE_LOCAL_CONST: return "FJNGE_LOCAL_CONST";
+        case Op::FJNEQ_LOCAL_CONST: return "FJNEQ_LOCAL_CONST";
+        case Op::FJNNE_LOCAL_CONST: return "FJNNE_LOCAL_CONST";
+        case Op::JNE_ZERO: return "JNE_ZERO";
+    }
+    return "?";
+}
+
+uint32_t operandBytes(Op op) {
+    switch (op) {
+        case Op::ICONST:
+        case Op::FCONST:
+            return 8;
+
+        case Op::LOAD:
+        case Op::STORE:
+        case Op::JMP:
+        case Op::JMP_IF_FALSE:
+        case Op::JNE_ZERO:
+            return 4;
+
+        case Op::CALL:
+        case Op::TAILCALL:
+        case Op::SPAWN:
+            return 8;
+
+        case Op::ARRAY_COUNT:
+        case Op::ARRAY_MAP:
+            return 1;
+
+        case Op::INC_LOCAL:
+            return 12;
+
+        case Op::JLT_LOCALS:
+        case Op::JLE_LOCALS:
+        case Op::JGT_LOCALS:
+        case Op::JGE_LOCALS:
+        case Op::JEQ_LOCALS:
+        case Op::JNE_LOCALS:
+        case Op::FJNLT_LOCALS:
+        case Op::FJNLE_LOCALS:
+        case Op::FJNGT_LOCALS:
+        case Op::FJNGE_LOCALS:
+        case Op::FJNEQ_LOCALS:
+        case Op::FJNNE_LOCALS:
+            return 12;
+
+        case Op::JLT_LOCAL_CONST:
+        case Op::JLE_LOCAL_CONST:
+        case Op::JGT_LOCAL_CONST:
+        case Op::JGE_LOCAL_CONST:
+        case Op::JEQ_LOCAL_CONST:
+        case Op::JNE_LOCAL_CONST:
+        case Op::FJNLT_LOCAL_CONST:
+        case Op::FJNLE_LOCAL_CONST:
+        case Op::FJNGT_LOCAL_CONST:
+        case Op::FJNGE_LOCAL_CONST:
+        case Op::FJNEQ_LOCAL_CONST:
+        case Op::FJNNE_LOCAL_CONST:
+            return 16;
+
+        default:
+            return 0;
+    }
+}
+
+int jumpOperand(Op op) {
+    switch (op) {
+        case Op::JMP:
+        case Op::JMP_IF_FALSE:
+        case Op::JNE_ZERO:
+        case Op::JLT_LOCALS:
+        case Op::JLE_LOCALS:
+        case Op::JGT_LOCALS:
+        case Op::JGE_LOCALS:
+        case Op::JEQ_LOCALS:
+        case Op::JNE_LOCALS:
+        case Op::FJNLT_LOCALS:
+        case Op::FJNLE_LOCALS:
+        case Op::FJNGT_LOCALS:
+        case Op::FJNGE_LOCALS:
+        case Op::FJNEQ_LOCALS:
+        case Op::FJNNE_LOCALS:
+        case Op::JLT_LOCAL_CONST:
+        case Op::JLE_LOCAL_CONST:
+        case Op::JGT_LOCAL_CONST:
+        case Op::JGE_LOCAL_CONST:
+        case Op::JEQ_LOCAL_CONST:
+        case Op::JNE_LOCAL_CONST:
+        case Op::FJNLT_LOCAL_CONST:
+        case Op::FJNLE_LOCAL_CONST:
+        case Op::FJNGT_LOCAL_CONST:
+        case Op::FJNGE_LOCAL_CONST:
+        case Op::FJNEQ_LOCAL_CONST:
+        case Op::FJNNE_LOCAL_CONST:
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+Op branchCompare(Op op) {
+    switch (op) {
+        case Op::JLT_LOCALS:
+        case Op::JLT_LOCAL_CONST:
+            return Op::CMPLT;
+        case Op::JLE_LOCALS:
+        case Op::JLE_LOCAL_CONST:
+            return Op::CMPLE;
+        case Op::JGT_LOCALS:
+        case Op::JGT_LOCAL_CONST:
+            return Op::CMPGT;
+        case Op::JGE_LOCALS:
+        case Op::JGE_LOCAL_CONST:
+            return Op::CMPGE;
+        case Op::JEQ_LOCALS:
+        case Op::JEQ_LOCAL_CONST:
+            return Op::CMPEQ;
+        case Op::JNE_LOCALS:
+        case Op::JNE_LOCAL_CONST:
+            return Op::CMPNE;
+        case Op::FJNLT_LOCALS:
+        case Op::FJNLT_LOCAL_CONST:
+            return Op::FCMPLT;
+        case Op::FJNLE_LOCALS:
+        case Op::FJNLE_LOCAL_CONST:
+            return Op::FCMPLE;
+        case Op::FJNGT_LOCALS:
+        case Op::FJNGT_LOCAL_CONST:
+            return Op::FCMPGT;
+        case Op::FJNGE_LOCALS:
+        case Op::FJNGE_LOCAL_CONST:
+            return Op::FCMPGE;
+        case Op::FJNEQ_LOCALS:
+        case Op::FJNEQ_LOCAL_CONST:
+            return Op::FCMPEQ;
+        case Op::FJNNE_LOCALS:
+        case Op::FJNNE_LOCAL_CONST:
+            return Op::FCMPNE;
+
+        default:
+            return Op::NOP;
+    }
+}
+
 uint32_t computeMaxStack(const Program& prog, const Function& fn) {
     const auto& code = prog.code.buf;
     const size_t start = fn.entry;
@@ -100,45 +477,32 @@ uint32_t computeMaxStack(const Program& prog, const Function& fn) {
         Op op = static_cast<Op>(code[ip++]);
         uint32_t argc = 0;
 
-        size_t next_ip = ip;
+        size_t next_ip = ip + operandBytes(op);
         size_t jmp_target = 0;
         bool has_fallthrough = true;
         bool has_jump = false;
         bool is_end = false;
 
-        switch (op) {
-            case Op::ICONST:
-            case Op::FCONST:
-                next_ip += 8;
-                break;
-
-            case Op::LOAD:
-            case Op::STORE:
-                next_ip += 4;
-                break;
+        int jo = jumpOperand(op);
+        if (jo >= 0) {
+            jmp_target = loadU32p(&code[ip + static_cast<size_t>(jo)]);
+            has_jump = true;
+        }
 
-            case Op::JMP: {
-                jmp_target = loadU32p(&code[next_ip]);
-                next_ip += 4;
-                has_jump = true;
+        switch (op) {
+            case Op::JMP:
                 has_fallthrough = false;
                 break;
-            }
 
-            case Op::JMP_IF_FALSE: {
-                jmp_target = loadU32p(&code[next_ip]);
-                next_ip += 4;
-                has_jump = true;
+            case Op::CALL:
+            case Op::SPAWN:
+                argc = loadU32p(&code[ip + 4]);
                 break;
-            }
 
-            case Op::CALL: {
-                (void)loadU32p(&code[next_ip]);
-                next_ip += 4;
-                argc = loadU32p(&code[next_ip]);
-                next_ip += 4;
+            case Op::TAILCALL:
+                argc = loadU32p(&code[ip + 4]);
+                is_end = true;
                 break;
-            }
 
             case Op::RET:
             case Op::HALT:
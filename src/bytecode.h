@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <string>
@@ -50,7 +51,77 @@ enum class Op : uint8_t {
     FCMPNE,
     FSQRT,
     PRINT_BIG,
-    PRINT_F
+    PRINT_F,
+    IMIN,
+    IMAX,
+    IABS,
+    FMIN,
+    FMAX,
+    FABS,
+    FFLOOR,
+    IAND,
+    IOR,
+    IXOR,
+    ISHL,
+    ISHR,
+    ARRAY_FILL,
+    ARRAY_COPY,
+    ARRAY_SLICE,
+    ARRAY_EQUAL,
+    ARRAY_SUM,
+    ARRAY_COUNT,
+    ARRAY_MAP,
+    BIGINT,
+    BIG_ADD,
+    BIG_SUB,
+    BIG_MUL,
+    BIG_DIV,
+    BIG_MOD,
+    BIG_CMP,
+    PRINT_BIGINT,
+    PRINT_ARRAY,
+    FLUSH,
+    READ_INT,
+    READ_FLOAT,
+    READ_INTS,
+    READ_FLOATS,
+    READ_EOF,
+    MAP_ARRAY,
+    SAVE_ARRAY,
+    PARALLEL_FOR,
+    SPAWN,      // u32 function id, u32 argc, like CALL; pushes a task handle
+    JOIN,
+    TAILCALL,
+    INC_LOCAL,
+
+    // Fused compare-and-branch: u32 target, u32 local, then a u32 local or an i64
+    // constant. Integer forms jump when the comparison holds; float forms jump when
+    // it does not, so NaN goes the same way as FCMPxx + JMP_IF_FALSE.
+    JLT_LOCALS,
+    JLE_LOCALS,
+    JGT_LOCALS,
+    JGE_LOCALS,
+    JEQ_LOCALS,
+    JNE_LOCALS,
+    JLT_LOCAL_CONST,
+    JLE_LOCAL_CONST,
+    JGT_LOCAL_CONST,
+    JGE_LOCAL_CONST,
+    JEQ_LOCAL_CONST,
+    JNE_LOCAL_CONST,
+    FJNLT_LOCALS,
+    FJNLE_LOCALS,
+    FJNGT_LOCALS,
+    FJNGE_LOCALS,
+    FJNEQ_LOCALS,
+    FJNNE_LOCALS,
+    FJNLT_LOCAL_CONST,
+    FJNLE_LOCAL_CONST,
+    FJNGT_LOCAL_CONST,
+    FJNGE_LOCAL_CONST,
+    FJNEQ_LOCAL_CONST,
+    FJNNE_LOCAL_CONST,
+    JNE_ZERO
 };
 
 struct Code {
@@ -72,6 +143,8 @@ struct Code {
 
     void op(Op o) { emit8(static_cast<uint8_t>(o)); }
 
+    void u8(uint8_t v) { emit8(v); }
+
     void i64(int64_t v) { emit64(v); }
 
     void u32(uint32_t v) { emit32(v); }
@@ -82,6 +155,11 @@ struct Code {
     }
 };
 
+struct LineEntry {
+    uint32_t pc;
+    int line;
+};
+
 struct Function {
     std::string name;
     uint32_t id = 0;
@@ -90,8 +168,18 @@ struct Function {
     size_t entry = 0;
     size_t end = 0;
     uint32_t maxStack = 0;
+
+    // (pc, line) pairs as ULEB128 pc deltas from `entry` and zigzag line deltas.
+    std::vector<uint8_t> lineTable;
+
+    // Source line of the instruction at pc, or 0 if unknown.
+    int lineAt(size_t pc) const;
 };
 
+void packLineTable(Function& fn, const std::vector<LineEntry>& lines);
+
+struct Func;
+
 struct Program {
     Code code;
     std::vector<Function> funcs;
@@ -104,9 +192,50 @@ struct Program {
 
     std::vector<LoopContext> loopStack;
 
+    // Bodies the code generator may splice into call sites, indexed by function id.
+    struct InlineCandidate {
+        Func* func = nullptr;
+        uint32_t cost = 0;
+    };
+
+    struct InlineContext {
+        std::vector<size_t> returnPatches;
+        bool inLoop = false;
+    };
+
+    std::vector<InlineCandidate> inlineCandidates;
+    std::vector<InlineContext> inlineStack;
+
+    // Line entries of the function being generated, sorted by pc. An entry covers
+    // the code up to the next one; Module::gen packs them into Function::lineTable.
+    std::vector<LineEntry> lines;
+    std::string sourceName;
+
+    // String literals; the code refers to them by index.
+    std::vector<std::string> strings;
+
+    int64_t internString(const std::string& s) {
+        auto it = std::find(strings.begin(), strings.end(), s);
+        if (it != strings.end()) return it - strings.begin();
+        strings.emplace_back(s);
+        return static_cast<int64_t>(strings.size() - 1);
+    }
+
+    // Inlined bodies stay on the call site's line: the table has no way to name
+    // the callee, and its lines would be reported under the caller.
+    void markLine(int line) {
+        if (line <= 0 || !inlineStack.empty() || (!lines.empty() && lines.back().line == line)) return;
+        auto pc = static_cast<uint32_t>(code.pc());
+        if (!lines.empty() && lines.back().pc == pc) {
+            lines.back().line = line;
+        } else {
+            lines.push_back({pc, line});
+        }
+    }
+
     uint32_t addFunc(const std::string& name, uint32_t arity, uint32_t nlocals, size_t entry) {
         uint32_t id = static_cast<uint32_t>(funcs.size());
-        funcs.emplace_back(Function{name, id, arity, nlocals, entry});
+        funcs.emplace_back(Function{name, id, arity, nlocals, entry, 0, 0, {}});
         name2id[name] = id;
         return id;
     }
@@ -129,4 +258,18 @@ struct Program {
     }
 };
 
+const char* opName(Op op);
+
+// Net change in operand stack height; immArgc is the argument count of CALL / TAILCALL.
+int stackEffect(Op op, uint32_t immArgc = 0);
+
+// Number of operand bytes that follow the opcode.
+uint32_t operandBytes(Op op);
+
+// Offset of the u32 jump target within the operands, or -1 if the op does not branch.
+int jumpOperand(Op op);
+
+// The CMPxx / FCMPxx a fused compare-and-branch tests, or NOP for any other op.
+Op branchCompare(Op op);
+
 uint32_t computeMaxStack(const Program& prog, const Function& fn);
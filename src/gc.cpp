@@ -1,12 +1,23 @@
 #include "gc.h"
+#include "mapfile.h"
 #include "vm.h"
+#include <cstddef>
 #include <vector>
 
 namespace GC {
 
+    static constexpr size_t kMinTableSlack = 64;
+
+    // A queued task's VM starts with a copy of its spawner's table. That part is the
+    // spawner's to collect, and other threads may be writing to it, so it is skipped,
+    // as are the spawner's own arrays that its queued tasks can see.
+    static bool skipped(const VM* vm, size_t id) {
+        return id < vm->sharedArrays || vm->arrays[id].born < vm->pinnedBelow;
+    }
+
     void markReachable(VM* vm) {
-        for (auto& arr : vm->arrays) {
-            arr.marked = false;
+        for (size_t i = vm->sharedArrays; i < vm->arrays.size(); ++i) {
+            vm->arrays[i].marked = false;
         }
 
         std::vector<size_t> work;
@@ -15,7 +26,7 @@ namespace GC {
             if (!VM::isArrayHandle(v, vm->arrays.size())) return;
 
             size_t id = VM::handleToId(v);
-            if (vm->arrays[id].marked) return;
+            if (vm->arrays[id].marked || skipped(vm, id)) return;
 
             vm->arrays[id].marked = true;
             work.emplace_back(id);
@@ -32,29 +43,75 @@ namespace GC {
             }
         }
 
+        for (int64_t val : vm->hostRoots) {
+            markFromHandle(val);
+        }
+
+        for (int64_t val : vm->remembered) {
+            markFromHandle(val);
+        }
+
+        for (const auto& task : vm->tasks) {
+            if (!task) continue;
+            for (int64_t val : task->args) markFromHandle(val);
+            if (!task->queued) markFromHandle(task->result);
+        }
+
         while (!work.empty()) {
             size_t id = work.back();
             work.pop_back();
 
-            auto& data = vm->arrays[id].data;
-            for (int64_t v : data) {
-                markFromHandle(v);
+            const auto& arr = vm->arrays[id];
+            if (arr.bigint || arr.mapped) continue;
+            for (size_t i = 0; i < arr.size; ++i) {
+                markFromHandle(arr.data[i]);
             }
         }
     }
 
     void sweep(VM* vm) {
-        for (size_t i = 0; i < vm->arrays.size(); ++i) {
-            if (!vm->arrays[i].marked && !vm->arrays[i].data.empty()) {
-                vm->arrays[i].data.clear();
-                vm->arrays[i].data.shrink_to_fit();
-                vm->freeList.emplace_back(i);
+        auto& arrays = vm->arrays;
+        vm->freeList.clear();
+
+        // Walk downwards so the free list pops lowest ids first: new arrays fill the
+        // bottom of the table and the dead tail stays trimmable by compact().
+        for (size_t i = arrays.size(); i-- > vm->sharedArrays;) {
+            auto& arr = arrays[i];
+            if (!arr.marked && arr.data && !skipped(vm, i)) {
+                if (arr.mapped) {
+                    unmapArrayFile(arr.data, arr.size);
+                    arr.mapped = false;
+                } else {
+                    vm->heap.release(arr.data, arr.size);
+                }
+                arr.data = nullptr;
+                arr.size = 0;
             }
+            if (!arr.data && !arr.reserved) vm->freeList.emplace_back(i);
         }
     }
 
+    void compact(VM* vm) {
+        auto& arrays = vm->arrays;
+        auto& freeList = vm->freeList;
+
+        size_t live = arrays.size();
+        while (live > vm->sharedArrays && !arrays[live - 1].data) --live;
+        if (live == arrays.size()) return;
+
+        arrays.resize(live);
+
+        size_t keep = 0;
+        while (keep < freeList.size() && freeList[keep] >= live) ++keep;
+        freeList.erase(freeList.begin(), freeList.begin() + static_cast<std::ptrdiff_t>(keep));
+
+        if (arrays.capacity() > 2 * live + kMinTableSlack) arrays.shrink_to_fit();
+        if (freeList.capacity() > 2 * freeList.size() + kMinTableSlack) freeList.shrink_to_fit();
+    }
+
     void runGC(VM* vm) {
         markReachable(vm);
         sweep(vm);
+        compact(vm);
     }
 }
@@ -8,5 +8,6 @@ struct VM;
 namespace GC {
     void markReachable(VM* vm);
     void sweep(VM* vm);
+    void compact(VM* vm);
     void runGC(VM* vm);
 }
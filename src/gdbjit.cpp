@@ -0,0 +1,304 @@
+#include "gdbjit.h"
+#include <cstring>
+#include <mutex>
+
+#ifdef _MSC_VER
+#define GDBJIT_NOINLINE __declspec(noinline)
+#else
+#define GDBJIT_NOINLINE __attribute__((noinline))
+#endif
+
+// Names and layout are fixed by gdb.
+extern "C" {
+    struct jit_code_entry {
+        jit_code_entry* next_entry;
+        jit_code_entry* prev_entry;
+        const char* symfile_addr;
+        uint64_t symfile_size;
+    };
+
+    struct jit_descriptor {
+        uint32_t version;
+        uint32_t action_flag;
+        jit_code_entry* relevant_entry;
+        jit_code_entry* first_entry;
+    };
+
+    GDBJIT_NOINLINE void __jit_debug_register_code() {
+        // gdb sets a breakpoint here; the store keeps the call from being optimized away.
+        static volatile int hits = 0;
+        hits = hits + 1;
+    }
+
+    jit_descriptor __jit_debug_descriptor = {1, 0, nullptr, nullptr};
+}
+
+namespace {
+    enum : uint32_t { JIT_NOACTION = 0, JIT_REGISTER = 1, JIT_UNREGISTER = 2 };
+
+    struct Entry {
+        jit_code_entry link{};
+        std::vector<uint8_t> image;
+    };
+
+    std::mutex registryLock;
+
+    // Little-endian byte sink for the ELF image.
+    struct Out {
+        std::vector<uint8_t> buf;
+
+        size_t pos() const { return buf.size(); }
+        void u8(uint8_t v) { buf.emplace_back(v); }
+        void u16(uint16_t v) { raw(&v, 2); }
+        void u32(uint32_t v) { raw(&v, 4); }
+        void u64(uint64_t v) { raw(&v, 8); }
+        void raw(const void* p, size_t n) {
+            auto* b = static_cast<const uint8_t*>(p);
+            buf.insert(buf.end(), b, b + n);
+        }
+        void str(const std::string& s) { raw(s.c_str(), s.size() + 1); }
+        void uleb(uint64_t v) {
+            do {
+                uint8_t b = v & 0x7F;
+                v >>= 7;
+                u8(v ? (b | 0x80) : b);
+            } while (v);
+        }
+        void sleb(int64_t v) {
+            for (;;) {
+                uint8_t b = v & 0x7F;
+                v >>= 7;
+                if ((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40))) {
+                    u8(b);
+                    return;
+                }
+                u8(b | 0x80);
+            }
+        }
+        void align(size_t n) {
+            while (buf.size() % n) u8(0);
+        }
+        void patch32(size_t at, uint32_t v) { std::memcpy(&buf[at], &v, 4); }
+    };
+
+    enum Section { S_NULL, S_TEXT, S_SYMTAB, S_STRTAB, S_SHSTRTAB, S_DEBUG_INFO, S_DEBUG_ABBREV, S_DEBUG_LINE, S_COUNT };
+
+    struct SectionHeader {
+        uint32_t name = 0, type = 0;
+        uint64_t flags = 0, addr = 0, offset = 0, size = 0;
+        uint32_t link = 0, info = 0;
+        uint64_t addralign = 1, entsize = 0;
+    };
+
+    // DWARF 2 is enough for line tables and is understood by every gdb.
+    void writeDebugInfo(Out& o, const std::string& sourceName, uintptr_t start, size_t size) {
+        size_t len = o.pos();
+        o.u32(0);
+        o.u16(2);
+        o.u32(0);       // abbrev offset
+        o.u8(8);        // address size
+        o.uleb(1);
+        o.str(sourceName);
+        o.u32(0);       // stmt_list
+        o.u64(start);
+        o.u64(start + size);
+        o.patch32(len, static_cast<uint32_t>(o.pos() - len - 4));
+    }
+
+    void writeDebugAbbrev(Out& o) {
+        o.uleb(1);
+        o.uleb(0x11);   // DW_TAG_compile_unit
+        o.u8(0);        // no children
+        o.uleb(0x03); o.uleb(0x08);     // DW_AT_name, DW_FORM_string
+        o.uleb(0x10); o.uleb(0x06);     // DW_AT_stmt_list, DW_FORM_data4
+        o.uleb(0x11); o.uleb(0x01);     // DW_AT_low_pc, DW_FORM_addr
+        o.uleb(0x12); o.uleb(0x01);     // DW_AT_high_pc, DW_FORM_addr
+        o.uleb(0); o.uleb(0);
+        o.uleb(0);
+    }
+
+    void writeDebugLine(Out& o, const std::string& sourceName, uintptr_t start, size_t size,
+                        const std::vector<std::pair<uint32_t, int>>& lines) {
+        size_t len = o.pos();
+        o.u32(0);
+        o.u16(2);
+        size_t headerLen = o.pos();
+        o.u32(0);
+        o.u8(1);        // minimum instruction length
+        o.u8(1);        // default is_stmt
+        o.u8(static_cast<uint8_t>(-5));
+        o.u8(14);       // line range
+        o.u8(13);       // opcode base
+        for (uint8_t n : {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1}) o.u8(n);
+        o.u8(0);        // no include directories
+        o.str(sourceName);
+        o.uleb(0); o.uleb(0); o.uleb(0);
+        o.u8(0);
+        o.patch32(headerLen, static_cast<uint32_t>(o.pos() - headerLen - 4));
+
+        o.u8(0); o.uleb(9); o.u8(2);    // DW_LNE_set_address
+        o.u64(start);
+
+        uint32_t pc = 0;
+        int line = 1;
+        for (auto& [offset, l] : lines) {
+            if (offset != pc) {
+                o.u8(2);                // DW_LNS_advance_pc
+                o.uleb(offset - pc);
+                pc = offset;
+            }
+            if (l != line) {
+                o.u8(3);                // DW_LNS_advance_line
+                o.sleb(l - line);
+                line = l;
+            }
+            o.u8(1);                    // DW_LNS_copy
+        }
+        if (size > pc) {
+            o.u8(2);
+            o.uleb(size - pc);
+        }
+        o.u8(0); o.uleb(1); o.u8(1);    // DW_LNE_end_sequence
+        o.patch32(len, static_cast<uint32_t>(o.pos() - len - 4));
+    }
+
+    std::vector<uint8_t> buildImage(const std::string& name, const std::string& sourceName,
+                                    uintptr_t start, size_t size, const std::vector<std::pair<uint32_t, int>>& lines) {
+        Out o;
+        SectionHeader sh[S_COUNT];
+
+        // ELF64 header; e_shoff is patched once the section headers are placed.
+        const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2, 1, 1, 0};
+        o.raw(ident, 16);
+        o.u16(1);       // ET_REL
+        o.u16(62);      // EM_X86_64
+        o.u32(1);
+        o.u64(0);       // entry
+        o.u64(0);       // phoff
+        size_t shoff = o.pos();
+        o.u64(0);
+        o.u32(0);       // flags
+        o.u16(64);      // ehsize
+        o.u16(0); o.u16(0);
+        o.u16(64);      // shentsize
+        o.u16(S_COUNT);
+        o.u16(S_SHSTRTAB);
+
+        Out shstr;
+        shstr.u8(0);
+        auto sectionName = [&](Section s, const char* n) {
+            sh[s].name = static_cast<uint32_t>(shstr.pos());
+            shstr.str(n);
+        };
+        sectionName(S_TEXT, ".text");
+        sectionName(S_SYMTAB, ".symtab");
+        sectionName(S_STRTAB, ".strtab");
+        sectionName(S_SHSTRTAB, ".shstrtab");
+        sectionName(S_DEBUG_INFO, ".debug_info");
+        sectionName(S_DEBUG_ABBREV, ".debug_abbrev");
+        sectionName(S_DEBUG_LINE, ".debug_line");
+
+        // The code itself stays where the JIT put it.
+        sh[S_TEXT].type = 8;        // SHT_NOBITS
+        sh[S_TEXT].flags = 0x2 | 0x4;   // SHF_ALLOC | SHF_EXECINSTR
+        sh[S_TEXT].addr = start;
+        sh[S_TEXT].size = size;
+        sh[S_TEXT].addralign = 16;
+
+        Out strtab;
+        strtab.u8(0);
+        uint32_t fileName = static_cast<uint32_t>(strtab.pos());
+        strtab.str(sourceName);
+        uint32_t funcName = static_cast<uint32_t>(strtab.pos());
+        strtab.str(name);
+
+        auto place = [&](Section s, uint32_t type, const Out& body, uint64_t align) {
+            o.align(align);
+            sh[s].type = type;
+            sh[s].offset = o.pos();
+            sh[s].size = body.pos();
+            sh[s].addralign = align;
+            o.raw(body.buf.data(), body.buf.size());
+        };
+
+        Out symtab;
+        auto symbol = [&](uint32_t n, uint8_t info, uint16_t shndx, uint64_t value, uint64_t sz) {
+            symtab.u32(n);
+            symtab.u8(info);
+            symtab.u8(0);
+            symtab.u16(shndx);
+            symtab.u64(value);
+            symtab.u64(sz);
+        };
+        symbol(0, 0, 0, 0, 0);
+        symbol(fileName, 4, 0xFFF1, 0, 0);              // STB_LOCAL STT_FILE, SHN_ABS
+        symbol(funcName, (1 << 4) | 2, S_TEXT, 0, size); // STB_GLOBAL STT_FUNC
+        place(S_SYMTAB, 2, symtab, 8);
+        sh[S_SYMTAB].link = S_STRTAB;
+        sh[S_SYMTAB].info = 2;      // first global
+        sh[S_SYMTAB].entsize = 24;
+
+        place(S_STRTAB, 3, strtab, 1);
+        place(S_SHSTRTAB, 3, shstr, 1);
+
+        Out info, abbrev, line;
+        writeDebugInfo(info, sourceName, start, size);
+        writeDebugAbbrev(abbrev);
+        writeDebugLine(line, sourceName, start, size, lines);
+        place(S_DEBUG_INFO, 1, info, 1);
+        place(S_DEBUG_ABBREV, 1, abbrev, 1);
+        place(S_DEBUG_LINE, 1, line, 1);
+
+        o.align(8);
+        uint64_t headers = o.pos();
+        std::memcpy(&o.buf[shoff], &headers, 8);
+        for (auto& h : sh) {
+            o.u32(h.name);
+            o.u32(h.type);
+            o.u64(h.flags);
+            o.u64(h.addr);
+            o.u64(h.offset);
+            o.u64(h.size);
+            o.u32(h.link);
+            o.u32(h.info);
+            o.u64(h.addralign);
+            o.u64(h.entsize);
+        }
+        return std::move(o.buf);
+    }
+}
+
+void* gdbRegisterCode(const std::string& name, const std::string& sourceName,
+                      uintptr_t start, size_t size, const std::vector<std::pair<uint32_t, int>>& lines) {
+    auto* entry = new Entry();
+    entry->image = buildImage(name, sourceName.empty() ? "<unknown>" : sourceName, start, size, lines);
+    entry->link.symfile_addr = reinterpret_cast<const char*>(entry->image.data());
+    entry->link.symfile_size = entry->image.size();
+
+    std::lock_guard<std::mutex> guard(registryLock);
+    entry->link.next_entry = __jit_debug_descriptor.first_entry;
+    if (entry->link.next_entry) entry->link.next_entry->prev_entry = &entry->link;
+    __jit_debug_descriptor.first_entry = &entry->link;
+    __jit_debug_descriptor.relevant_entry = &entry->link;
+    __jit_debug_descriptor.action_flag = JIT_REGISTER;
+    __jit_debug_register_code();
+    __jit_debug_descriptor.action_flag = JIT_NOACTION;
+    return entry;
+}
+
+void gdbUnregisterCode(void* handle) {
+    auto* entry = static_cast<Entry*>(handle);
+    {
+        std::lock_guard<std::mutex> guard(registryLock);
+        jit_code_entry* link = &entry->link;
+        if (link->prev_entry) link->prev_entry->next_entry = link->next_entry;
+        else __jit_debug_descriptor.first_entry = link->next_entry;
+        if (link->next_entry) link->next_entry->prev_entry = link->prev_entry;
+
+        __jit_debug_descriptor.relevant_entry = link;
+        __jit_debug_descriptor.action_flag = JIT_UNREGISTER;
+        __jit_debug_register_code();
+        __jit_debug_descriptor.action_flag = JIT_NOACTION;
+    }
+    delete entry;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// GDB JIT interface. Each compiled function is described by a small in-memory
+// ELF object (a symbol covering the code plus a DWARF line program) and linked
+// into __jit_debug_descriptor, so gdb can name JIT frames and step by source line.
+// `lines` holds (code offset, source line) pairs sorted by offset.
+void* gdbRegisterCode(const std::string& name, const std::string& sourceName,
+                      uintptr_t start, size_t size, const std::vector<std::pair<uint32_t, int>>& lines);
+
+void gdbUnregisterCode(void* entry);
@@ -0,0 +1,87 @@
+#include "heap.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static inline size_t classElems(size_t idx) {
+    size_t half = idx / 2;
+    return (idx & 1) ? (size_t(3) << half) : (size_t(2) << half);
+}
+
+size_t ArrayHeap::classIndex(size_t n) {
+    if (n <= 2) return 0;
+
+    size_t m = n - 1;
+    size_t t = 1;
+    while (m >> (t + 1)) ++t;
+
+    return (m < (size_t(3) << (t - 1))) ? 2 * t - 1 : 2 * t;
+}
+
+ArrayHeap::~ArrayHeap() {
+    for (void* page : pages) std::free(page);
+    for (int64_t* p : large) std::free(p);
+}
+
+int64_t* ArrayHeap::refill(SizeClass& sc, size_t elems) {
+    size_t perPage = kPageBytes / (elems * sizeof(int64_t));
+
+    // calloc hands back zeroed pages, so blocks bumped out of a fresh page need no memset.
+    void* page = std::calloc(perPage * elems, sizeof(int64_t));
+    if (!page) throw std::bad_alloc();
+    pages.emplace_back(page);
+
+    sc.bump = static_cast<int64_t*>(page);
+    sc.bumpEnd = sc.bump + perPage * elems;
+
+    int64_t* p = sc.bump;
+    sc.bump += elems;
+    return p;
+}
+
+int64_t* ArrayHeap::allocate(size_t n) {
+    if (n > kMaxSmall) {
+        auto* p = static_cast<int64_t*>(std::calloc(n, sizeof(int64_t)));
+        if (!p) throw std::bad_alloc();
+        large.insert(p);
+        inUse += n * sizeof(int64_t);
+        return p;
+    }
+
+    size_t idx = classIndex(n);
+    size_t elems = classElems(idx);
+    SizeClass& sc = classes[idx];
+    inUse += elems * sizeof(int64_t);
+
+    if (sc.freeHead) {
+        int64_t* p = sc.freeHead;
+        std::memcpy(&sc.freeHead, p, sizeof(int64_t*));
+        std::memset(p, 0, (n ? n : 1) * sizeof(int64_t));
+        return p;
+    }
+
+    if (sc.bump != sc.bumpEnd) {
+        int64_t* p = sc.bump;
+        sc.bump += elems;
+        return p;
+    }
+
+    return refill(sc, elems);
+}
+
+void ArrayHeap::release(int64_t* p, size_t n) {
+    if (!p) return;
+
+    if (n > kMaxSmall) {
+        large.erase(p);
+        std::free(p);
+        inUse -= n * sizeof(int64_t);
+        return;
+    }
+
+    size_t idx = classIndex(n);
+    SizeClass& sc = classes[idx];
+    std::memcpy(p, &sc.freeHead, sizeof(int64_t*));
+    sc.freeHead = p;
+    inUse -= classElems(idx) * sizeof(int64_t);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+// Segregated-fit allocator for array payloads. Small requests are carved out of
+// slab pages per size class and recycled through intrusive free lists; anything
+// above the largest class goes to the large-object space.
+class ArrayHeap {
+public:
+    ArrayHeap() = default;
+    ~ArrayHeap();
+
+    ArrayHeap(const ArrayHeap&) = delete;
+    ArrayHeap& operator=(const ArrayHeap&) = delete;
+
+    // Returns a zeroed block of at least max(n, 1) elements.
+    int64_t* allocate(size_t n);
+    void release(int64_t* p, size_t n);
+
+    size_t bytesInUse() const { return inUse; }
+
+    static size_t classIndex(size_t n);
+
+    static constexpr size_t kNumClasses = 19;
+    static constexpr size_t kMaxSmall = 1024;
+    static constexpr size_t kPageBytes = 64 * 1024;
+
+private:
+    struct SizeClass {
+        int64_t* freeHead = nullptr;
+        int64_t* bump = nullptr;
+        int64_t* bumpEnd = nullptr;
+    };
+
+    SizeClass classes[kNumClasses];
+    std::vector<void*> pages;
+    std::unordered_set<int64_t*> large;
+    size_t inUse = 0;
+
+    int64_t* refill(SizeClass& sc, size_t elems);
+};
@@ -0,0 +1,165 @@
+#include "input.h"
+#include "output.h"
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+InputSource::~InputSource() {
+    reset();
+}
+
+void InputSource::reset() {
+#ifndef _WIN32
+    if (mapped) munmap(mapped, mappedSize);
+    if (ownsFd) close(fd);
+#else
+    if (ownsFd) _close(fd);
+#endif
+    mapped = nullptr;
+    mappedSize = 0;
+    fd = -1;
+    ownsFd = false;
+    buf.reset();
+    data.clear();
+    pos = end = nullptr;
+    eof = false;
+    opened = true;
+}
+
+void InputSource::fromFd(int source) {
+    reset();
+    fd = source;
+
+#ifndef _WIN32
+    struct stat st {};
+    off_t at = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && at >= 0 && st.st_size > at) {
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            mapped = p;
+            mappedSize = static_cast<size_t>(st.st_size);
+            pos = static_cast<const char*>(p) + at;
+            end = static_cast<const char*>(p) + mappedSize;
+            eof = true;
+            return;
+        }
+    }
+#endif
+
+    buf.reset(new char[kBufferSize]);
+    pos = end = buf.get();
+}
+
+void InputSource::fromFile(const std::string& path) {
+#ifdef _WIN32
+    int f = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int f = open(path.c_str(), O_RDONLY);
+#endif
+    if (f < 0) throw std::runtime_error("cannot open: " + path);
+    fromFd(f);
+    ownsFd = true;
+}
+
+void InputSource::fromMemory(std::string text) {
+    reset();
+    data = std::move(text);
+    pos = data.data();
+    end = pos + data.size();
+    eof = true;
+}
+
+// Moves the unread tail to the front of the buffer and reads more after it.
+bool InputSource::fill() {
+    if (eof) return false;
+
+    size_t kept = static_cast<size_t>(end - pos);
+    if (kept == kBufferSize) throw std::runtime_error("input: token longer than the read buffer");
+    std::memmove(buf.get(), pos, kept);
+    pos = buf.get();
+    end = pos + kept;
+    if (flushFirst) flushFirst->flush();
+
+    for (;;) {
+#ifdef _WIN32
+        int n = _read(fd, buf.get() + kept, static_cast<unsigned>(kBufferSize - kept));
+#else
+        ssize_t n = read(fd, buf.get() + kept, kBufferSize - kept);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n < 0) throw std::runtime_error("input: read failed");
+        if (n == 0) {
+            eof = true;
+            return false;
+        }
+        end += n;
+        return true;
+    }
+}
+
+InputSource::Status InputSource::token(const char*& begin, const char*& stop) {
+    if (!opened) fromFd(0);
+
+    for (;;) {
+        while (pos < end && isSpace(*pos)) ++pos;
+        if (pos < end) break;
+        if (!fill()) return Status::End;
+    }
+
+    size_t n = 0;
+    for (;;) {
+        while (pos + n < end && !isSpace(pos[n])) ++n;
+        if (pos + n < end || !fill()) break;
+    }
+
+    begin = pos;
+    stop = pos + n;
+    pos = stop;
+    return Status::Ok;
+}
+
+bool InputSource::atEnd() {
+    if (!opened) fromFd(0);
+
+    for (;;) {
+        while (pos < end && isSpace(*pos)) ++pos;
+        if (pos < end) return false;
+        if (!fill()) return true;
+    }
+}
+
+InputSource::Status InputSource::readInt(int64_t& v) {
+    const char *b, *e;
+    Status s = token(b, e);
+    if (s != Status::Ok) return s;
+
+    if (*b == '+' && e - b > 1) ++b;
+    auto r = std::from_chars(b, e, v);
+    return r.ec == std::errc() && r.ptr == e ? Status::Ok : Status::Malformed;
+}
+
+InputSource::Status InputSource::readDouble(double& v) {
+    const char *b, *e;
+    Status s = token(b, e);
+    if (s != Status::Ok) return s;
+
+    if (*b == '+' && e - b > 1) ++b;
+    auto r = std::from_chars(b, e, v);
+    return r.ec == std::errc() && r.ptr == e ? Status::Ok : Status::Malformed;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct OutputSink;
+
+// Program input: whitespace-separated numbers. A regular file (including a
+// redirected stdin) is mapped whole; pipes and terminals are read through a
+// large buffer. Until told otherwise the source is stdin, opened on first read.
+struct InputSource {
+    static constexpr size_t kBufferSize = 1 << 20;
+
+    enum class Status { Ok, End, Malformed };
+
+    InputSource() = default;
+    ~InputSource();
+
+    InputSource(const InputSource&) = delete;
+    InputSource& operator=(const InputSource&) = delete;
+
+    void fromFd(int fd);
+    void fromFile(const std::string& path);
+    void fromMemory(std::string data);
+
+    // True when nothing but whitespace is left.
+    bool atEnd();
+
+    Status readInt(int64_t& v);
+    Status readDouble(double& v);
+
+    // Flushed before a read from a pipe or terminal, which may block, so that a
+    // prompt printed ahead of it is seen.
+    OutputSink* flushFirst = nullptr;
+
+private:
+    void reset();
+    bool fill();
+    Status token(const char*& begin, const char*& stop);
+
+    const char* pos = nullptr;
+    const char* end = nullptr;
+    bool opened = false;
+    bool eof = false;
+
+    int fd = -1;
+    bool ownsFd = false;
+    std::unique_ptr<char[]> buf;
+    void* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::string data;
+};
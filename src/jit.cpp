@@ -1,9 +1,21 @@
 #include "jit.h"
+#include "builtins.h"
 #include "runtime.h"
+#include "gdbjit.h"
+#include "unwind.h"
+#include <algorithm>
 #include <cstring>
 #include <deque>
 #include <unordered_map>
 
+#ifdef _WIN32
+#include <process.h>
+static int currentProcessId() { return _getpid(); }
+#else
+#include <unistd.h>
+static int currentProcessId() { return static_cast<int>(getpid()); }
+#endif
+
 using namespace asmjit;
 
 static inline int64_t loadI64(const uint8_t* p) {
@@ -38,13 +50,414 @@ struct JitInstrInfo {
     bool result_live = true;
 };
 
+// Signed condition code for an integer compare-and-branch.
+static x86::CondCode intBranchCond(Op cmp) {
+    switch (cmp) {
+        case Op::CMPLT: return x86::CondCode::kL;
+        case Op::CMPLE: return x86::CondCode::kLE;
+        case Op::CMPGT: return x86::CondCode::kG;
+        case Op::CMPGE: return x86::CondCode::kGE;
+        case Op::CMPEQ: return x86::CondCode::kE;
+        default:        return x86::CondCode::kNE;
+    }
+}
+
+// Jumps unless xmm0 `cmp` xmm1 holds. ucomisd reports unordered as ZF=PF=CF=1,
+// so < and <= are tested as the swapped > and >= to keep NaN on the jump path.
+static void emitFloatBranchIfNot(x86::Assembler& a, Op cmp, const Label& target) {
+    switch (cmp) {
+        case Op::FCMPLT:
+            a.ucomisd(x86::xmm1, x86::xmm0);
+            a.jbe(target);
+            break;
+        case Op::FCMPLE:
+            a.ucomisd(x86::xmm1, x86::xmm0);
+            a.jb(target);
+            break;
+        case Op::FCMPGT:
+            a.ucomisd(x86::xmm0, x86::xmm1);
+            a.jbe(target);
+            break;
+        case Op::FCMPGE:
+            a.ucomisd(x86::xmm0, x86::xmm1);
+            a.jb(target);
+            break;
+        case Op::FCMPEQ:
+            a.ucomisd(x86::xmm0, x86::xmm1);
+            a.jp(target);
+            a.jne(target);
+            break;
+        default: {
+            Label unordered = a.new_label();
+            a.ucomisd(x86::xmm0, x86::xmm1);
+            a.jp(unordered);
+            a.je(target);
+            a.bind(unordered);
+            break;
+        }
+    }
+}
+
+// Inline kernels for ARRAY_SUM / ARRAY_COUNT / ARRAY_MAP. runtime_array_span
+// (runtime_array_span_mut for MAP) does the checks and hands back the first
+// element; the loop then runs 8 (AVX2) or 2 (SSE) lanes at a time with a scalar
+// epilogue. Only volatile registers are touched: xmm6-xmm15 belong to the caller
+// under the Win64 ABI.
+static void emitHorizontalAdd(x86::Assembler& a, bool wide) {
+    if (wide) {
+        a.vextracti128(x86::xmm1, x86::ymm0, 1);
+        a.vpaddq(x86::xmm0, x86::xmm0, x86::xmm1);
+        a.vpshufd(x86::xmm1, x86::xmm0, 0x4E);
+        a.vpaddq(x86::xmm0, x86::xmm0, x86::xmm1);
+        a.vmovq(x86::rdx, x86::xmm0);
+        a.vzeroupper();
+    } else {
+        a.pshufd(x86::xmm1, x86::xmm0, 0x4E);
+        a.paddq(x86::xmm0, x86::xmm1);
+        a.movq(x86::rdx, x86::xmm0);
+    }
+}
+
+static void emitBroadcastOperand(x86::Assembler& a, bool wide) {
+    if (wide) {
+        a.vmovq(x86::xmm5, x86::r8);
+        a.vpbroadcastq(x86::ymm5, x86::xmm5);
+    } else {
+        a.movq(x86::xmm5, x86::r8);
+        a.punpcklqdq(x86::xmm5, x86::xmm5);
+    }
+}
+
+static void emitSumKernel(x86::Assembler& a, bool wide) {
+    Label loop = a.new_label();
+    Label single = a.new_label();
+    Label reduce = a.new_label();
+
+    if (wide) {
+        a.vpxor(x86::ymm0, x86::ymm0, x86::ymm0);
+        a.vpxor(x86::ymm1, x86::ymm1, x86::ymm1);
+
+        a.bind(loop);
+        a.cmp(x86::rcx, 8);
+        a.jb(single);
+        a.vpaddq(x86::ymm0, x86::ymm0, x86::ymmword_ptr(x86::rax));
+        a.vpaddq(x86::ymm1, x86::ymm1, x86::ymmword_ptr(x86::rax, 32));
+        a.add(x86::rax, 64);
+        a.sub(x86::rcx, 8);
+        a.jmp(loop);
+
+        a.bind(single);
+        a.cmp(x86::rcx, 4);
+        a.jb(reduce);
+        a.vpaddq(x86::ymm0, x86::ymm0, x86::ymmword_ptr(x86::rax));
+        a.add(x86::rax, 32);
+        a.sub(x86::rcx, 4);
+
+        a.bind(reduce);
+        a.vpaddq(x86::ymm0, x86::ymm0, x86::ymm1);
+    } else {
+        a.pxor(x86::xmm0, x86::xmm0);
+
+        a.bind(loop);
+        a.cmp(x86::rcx, 2);
+        a.jb(reduce);
+        a.movdqu(x86::xmm1, x86::xmmword_ptr(x86::rax));
+        a.paddq(x86::xmm0, x86::xmm1);
+        a.add(x86::rax, 16);
+        a.sub(x86::rcx, 2);
+        a.jmp(loop);
+
+        a.bind(reduce);
+    }
+    emitHorizontalAdd(a, wide);
+
+    Label tail = a.new_label();
+    Label done = a.new_label();
+    a.bind(tail);
+    a.test(x86::rcx, x86::rcx);
+    a.jz(done);
+    a.add(x86::rdx, x86::qword_ptr(x86::rax));
+    a.add(x86::rax, 8);
+    a.dec(x86::rcx);
+    a.jmp(tail);
+    a.bind(done);
+}
+
+// Counts x == k, x > k or x < k; the other three comparisons are n minus one of these.
+static void emitCountKernel(x86::Assembler& a, const CpuFeatures::X86& cpu, Op cmp) {
+    Op base = cmp;
+    bool negate = false;
+    switch (cmp) {
+        case Op::CMPNE: base = Op::CMPEQ; negate = true; break;
+        case Op::CMPLE: base = Op::CMPGT; negate = true; break;
+        case Op::CMPGE: base = Op::CMPLT; negate = true; break;
+        default: break;
+    }
+
+    const bool wide = cpu.has_avx2();
+    const bool vector = wide || (base == Op::CMPEQ ? cpu.has_sse4_1() : cpu.has_sse4_2());
+
+    auto compare = [&](const x86::Vec& v, const x86::Vec& tmp) {
+        if (wide) {
+            if (base == Op::CMPEQ) a.vpcmpeqq(v, v, x86::ymm5);
+            else if (base == Op::CMPGT) a.vpcmpgtq(v, v, x86::ymm5);
+            else a.vpcmpgtq(v, x86::ymm5, v);
+        } else {
+            if (base == Op::CMPEQ) {
+                a.pcmpeqq(v, x86::xmm5);
+            } else if (base == Op::CMPGT) {
+                a.pcmpgtq(v, x86::xmm5);
+            } else {
+                a.movdqa(tmp, x86::xmm5);
+                a.pcmpgtq(tmp, v);
+                a.movdqa(v, tmp);
+            }
+        }
+    };
+
+    if (vector) {
+        Label loop = a.new_label();
+        Label single = a.new_label();
+        Label reduce = a.new_label();
+
+        emitBroadcastOperand(a, wide);
+
+        // Matching lanes compare to all-ones (-1), so subtracting the mask counts them.
+        if (wide) {
+            a.vpxor(x86::ymm0, x86::ymm0, x86::ymm0);
+            a.vpxor(x86::ymm3, x86::ymm3, x86::ymm3);
+
+            a.bind(loop);
+            a.cmp(x86::rcx, 8);
+            a.jb(single);
+            a.vmovdqu(x86::ymm1, x86::ymmword_ptr(x86::rax));
+            a.vmovdqu(x86::ymm2, x86::ymmword_ptr(x86::rax, 32));
+            compare(x86::ymm1, x86::ymm4);
+            compare(x86::ymm2, x86::ymm4);
+            a.vpsubq(x86::ymm0, x86::ymm0, x86::ymm1);
+            a.vpsubq(x86::ymm3, x86::ymm3, x86::ymm2);
+            a.add(x86::rax, 64);
+            a.sub(x86::rcx, 8);
+            a.jmp(loop);
+
+            a.bind(single);
+            a.cmp(x86::rcx, 4);
+            a.jb(reduce);
+            a.vmovdqu(x86::ymm1, x86::ymmword_ptr(x86::rax));
+            compare(x86::ymm1, x86::ymm4);
+            a.vpsubq(x86::ymm0, x86::ymm0, x86::ymm1);
+            a.add(x86::rax, 32);
+            a.sub(x86::rcx, 4);
+
+            a.bind(reduce);
+            a.vpaddq(x86::ymm0, x86::ymm0, x86::ymm3);
+        } else {
+            a.pxor(x86::xmm0, x86::xmm0);
+
+            a.bind(loop);
+            a.cmp(x86::rcx, 2);
+            a.jb(reduce);
+            a.movdqu(x86::xmm1, x86::xmmword_ptr(x86::rax));
+            compare(x86::xmm1, x86::xmm2);
+            a.psubq(x86::xmm0, x86::xmm1);
+            a.add(x86::rax, 16);
+            a.sub(x86::rcx, 2);
+            a.jmp(loop);
+
+            a.bind(reduce);
+        }
+        emitHorizontalAdd(a, wide);
+    }
+
+    Label tail = a.new_label();
+    Label done = a.new_label();
+    a.bind(tail);
+    a.test(x86::rcx, x86::rcx);
+    a.jz(done);
+    a.cmp(x86::qword_ptr(x86::rax), x86::r8);
+    if (base == Op::CMPEQ) a.sete(x86::r10b);
+    else if (base == Op::CMPGT) a.setg(x86::r10b);
+    else a.setl(x86::r10b);
+    a.movzx(x86::r10d, x86::r10b);
+    a.add(x86::rdx, x86::r10);
+    a.add(x86::rax, 8);
+    a.dec(x86::rcx);
+    a.jmp(tail);
+    a.bind(done);
+
+    if (negate) {
+        a.mov(x86::rax, x86::r9);
+        a.sub(x86::rax, x86::rdx);
+        a.mov(x86::rdx, x86::rax);
+    }
+}
+
+static void emitMapKernel(x86::Assembler& a, const CpuFeatures::X86& cpu, Op fn) {
+    const bool isFloat = fn == Op::FADD || fn == Op::FSUB || fn == Op::FMUL || fn == Op::FDIV;
+    const bool wide = cpu.has_avx2();
+
+    // There is no packed 64-bit multiply below AVX-512, so IMUL stays scalar.
+    if (fn != Op::IMUL) {
+        Label loop = a.new_label();
+        Label done = a.new_label();
+        const int lanes = wide ? 4 : 2;
+
+        emitBroadcastOperand(a, wide);
+
+        a.bind(loop);
+        a.cmp(x86::rcx, lanes);
+        a.jb(done);
+        if (wide) {
+            a.vmovdqu(x86::ymm1, x86::ymmword_ptr(x86::rax));
+            switch (fn) {
+                case Op::IADD: a.vpaddq(x86::ymm1, x86::ymm1, x86::ymm5); break;
+                case Op::ISUB: a.vpsubq(x86::ymm1, x86::ymm1, x86::ymm5); break;
+                case Op::FADD: a.vaddpd(x86::ymm1, x86::ymm1, x86::ymm5); break;
+                case Op::FSUB: a.vsubpd(x86::ymm1, x86::ymm1, x86::ymm5); break;
+                case Op::FMUL: a.vmulpd(x86::ymm1, x86::ymm1, x86::ymm5); break;
+                default:       a.vdivpd(x86::ymm1, x86::ymm1, x86::ymm5); break;
+            }
+            a.vmovdqu(x86::ymmword_ptr(x86::rax), x86::ymm1);
+        } else {
+            a.movdqu(x86::xmm1, x86::xmmword_ptr(x86::rax));
+            switch (fn) {
+                case Op::IADD: a.paddq(x86::xmm1, x86::xmm5); break;
+                case Op::ISUB: a.psubq(x86::xmm1, x86::xmm5); break;
+                case Op::FADD: a.addpd(x86::xmm1, x86::xmm5); break;
+                case Op::FSUB: a.subpd(x86::xmm1, x86::xmm5); break;
+                case Op::FMUL: a.mulpd(x86::xmm1, x86::xmm5); break;
+                default:       a.divpd(x86::xmm1, x86::xmm5); break;
+            }
+            a.movdqu(x86::xmmword_ptr(x86::rax), x86::xmm1);
+        }
+        a.add(x86::rax, lanes * 8);
+        a.sub(x86::rcx, lanes);
+        a.jmp(loop);
+
+        a.bind(done);
+        if (wide) a.vzeroupper();
+    }
+
+    Label tail = a.new_label();
+    Label done = a.new_label();
+    a.bind(tail);
+    a.test(x86::rcx, x86::rcx);
+    a.jz(done);
+    if (isFloat) {
+        a.movsd(x86::xmm0, x86::qword_ptr(x86::rax));
+        a.movq(x86::xmm1, x86::r8);
+        switch (fn) {
+            case Op::FADD: a.addsd(x86::xmm0, x86::xmm1); break;
+            case Op::FSUB: a.subsd(x86::xmm0, x86::xmm1); break;
+            case Op::FMUL: a.mulsd(x86::xmm0, x86::xmm1); break;
+            default:       a.divsd(x86::xmm0, x86::xmm1); break;
+        }
+        a.movsd(x86::qword_ptr(x86::rax), x86::xmm0);
+    } else {
+        a.mov(x86::r10, x86::qword_ptr(x86::rax));
+        switch (fn) {
+            case Op::IADD: a.add(x86::r10, x86::r8); break;
+            case Op::ISUB: a.sub(x86::r10, x86::r8); break;
+            default:       a.imul(x86::r10, x86::r8); break;
+        }
+        a.mov(x86::qword_ptr(x86::rax), x86::r10);
+    }
+    a.add(x86::rax, 8);
+    a.dec(x86::rcx);
+    a.jmp(tail);
+    a.bind(done);
+}
+
+static void emitArrayKernel(x86::Assembler& a, const CpuFeatures::X86& cpu, Op op, Op sub) {
+    const int nargs = op == Op::ARRAY_SUM ? 3 : 4;
+
+    a.sub(x86::r13, nargs);
+    a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+    a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+    a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+    a.mov(x86::r9, x86::ptr(x86::r12, x86::r13, 3, 16));
+    a.sub(x86::rsp, 32);
+    a.call(imm(reinterpret_cast<uint64_t>(op == Op::ARRAY_MAP ? runtime_array_span_mut : runtime_array_span)));
+    a.add(x86::rsp, 32);
+
+    // rax walks the span, rcx counts what is left of it, r9 keeps its length,
+    // r8 holds the operand and rdx the result.
+    a.mov(x86::rcx, x86::ptr(x86::r12, x86::r13, 3, 16));
+    a.sub(x86::rcx, x86::ptr(x86::r12, x86::r13, 3, 8));
+    a.mov(x86::r9, x86::rcx);
+    if (nargs == 4) a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 24));
+    a.xor_(x86::edx, x86::edx);
+
+    Label empty = a.new_label();
+    a.test(x86::rcx, x86::rcx);
+    a.jle(empty);
+
+    switch (op) {
+        case Op::ARRAY_SUM:   emitSumKernel(a, cpu.has_avx2()); break;
+        case Op::ARRAY_COUNT: emitCountKernel(a, cpu, sub); break;
+        default:              emitMapKernel(a, cpu, sub); break;
+    }
+
+    a.bind(empty);
+    if (op != Op::ARRAY_MAP) {
+        a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rdx);
+        a.inc(x86::r13);
+    }
+}
+
 JITCompiler::JITCompiler() {
 }
 
 JITCompiler::~JITCompiler() {
+    for (void* entry : gdbEntries) gdbUnregisterCode(entry);
+    for (void* entry : unwindEntries) unregisterUnwindInfo(entry);
     compiledFunctions.clear();
 }
 
+bool JITCompiler::locate(const void* returnAddress, uint32_t& funcId, size_t& ip) const {
+    auto pc = reinterpret_cast<uintptr_t>(returnAddress);
+    for (auto& info : codeInfos) {
+        if (pc <= info.start || pc > info.start + info.size || info.pcMap.empty()) continue;
+
+        // The return address is one past the call; step back into it.
+        auto offset = static_cast<uint32_t>(pc - info.start - 1);
+        auto it = std::upper_bound(info.pcMap.begin(), info.pcMap.end(), std::make_pair(offset, UINT32_MAX));
+        if (it == info.pcMap.begin()) return false;
+        funcId = info.funcId;
+        ip = std::prev(it)->second;
+        return true;
+    }
+    return false;
+}
+
+void JITCompiler::enablePerfMap() {
+    if (perfMap.is_open()) return;
+    perfMap.open("/tmp/perf-" + std::to_string(currentProcessId()) + ".map", std::ios::app);
+}
+
+void JITCompiler::enableGdbJit() {
+    gdbJit = true;
+}
+
+void JITCompiler::publish(const Program& prog, const CodeInfo& info) {
+    const Function& func = prog.funcs[info.funcId];
+
+    if (perfMap.is_open()) {
+        perfMap << std::hex << info.start << " " << info.size << std::dec << " " << func.name << std::endl;
+    }
+
+    if (gdbJit) {
+        std::vector<std::pair<uint32_t, int>> lines;
+        for (auto& [offset, ip] : info.pcMap) {
+            int line = func.lineAt(ip);
+            if (line && (lines.empty() || lines.back().second != line)) lines.emplace_back(offset, line);
+        }
+        if (void* entry = gdbRegisterCode(func.name, prog.sourceName, info.start, info.size, lines)) {
+            gdbEntries.emplace_back(entry);
+        }
+    }
+}
+
 bool JITCompiler::isCompiled(uint32_t funcId) const {
     return compiledFunctions.find(funcId) != compiledFunctions.end();
 }
@@ -57,6 +470,13 @@ JITCompiler::CompiledFunc JITCompiler::getCompiledFunction(uint32_t funcId) cons
     return nullptr;
 }
 
+void JITCompiler::compileAll(const Program& prog, const std::vector<bool>& only) {
+    std::lock_guard<std::mutex> lock(compileMutex);
+    for (uint32_t i = 0; i < prog.funcs.size(); ++i) {
+        if ((only.empty() || only[i]) && !isCompiled(i)) compileFunction(prog, i);
+    }
+}
+
 JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint32_t funcId) {
     if (funcId >= prog.funcs.size()) {
         return nullptr;
@@ -106,6 +526,14 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 ins.side_effect = true;
                 break;
 
+            case Op::INC_LOCAL:
+                ins.imm0 = loadU32(&code[ip]);
+                ins.imm64 = loadI64(&code[ip + 4]);
+                ip += 12;
+                ins.side_effect = true;
+                ins.uses_inputs = false;
+                break;
+
             case Op::IADD:
             case Op::ISUB:
             case Op::IMUL:
@@ -170,6 +598,59 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 ins.side_effect = true;
                 break;
 
+            case Op::JNE_ZERO:
+                ins.imm0 = loadU32(&code[ip]);
+                ip += 4;
+                ins.jmp_target = ins.imm0;
+                ins.has_jump = true;
+                ins.consume = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::JLT_LOCALS:
+            case Op::JLE_LOCALS:
+            case Op::JGT_LOCALS:
+            case Op::JGE_LOCALS:
+            case Op::JEQ_LOCALS:
+            case Op::JNE_LOCALS:
+            case Op::FJNLT_LOCALS:
+            case Op::FJNLE_LOCALS:
+            case Op::FJNGT_LOCALS:
+            case Op::FJNGE_LOCALS:
+            case Op::FJNEQ_LOCALS:
+            case Op::FJNNE_LOCALS:
+                ins.imm0 = loadU32(&code[ip]);
+                ins.imm1 = loadU32(&code[ip + 4]);
+                ins.imm64 = loadU32(&code[ip + 8]);
+                ip += 12;
+                ins.jmp_target = ins.imm0;
+                ins.has_jump = true;
+                ins.side_effect = true;
+                ins.uses_inputs = false;
+                break;
+
+            case Op::JLT_LOCAL_CONST:
+            case Op::JLE_LOCAL_CONST:
+            case Op::JGT_LOCAL_CONST:
+            case Op::JGE_LOCAL_CONST:
+            case Op::JEQ_LOCAL_CONST:
+            case Op::JNE_LOCAL_CONST:
+            case Op::FJNLT_LOCAL_CONST:
+            case Op::FJNLE_LOCAL_CONST:
+            case Op::FJNGT_LOCAL_CONST:
+            case Op::FJNGE_LOCAL_CONST:
+            case Op::FJNEQ_LOCAL_CONST:
+            case Op::FJNNE_LOCAL_CONST:
+                ins.imm0 = loadU32(&code[ip]);
+                ins.imm1 = loadU32(&code[ip + 4]);
+                ins.imm64 = loadI64(&code[ip + 8]);
+                ip += 16;
+                ins.jmp_target = ins.imm0;
+                ins.has_jump = true;
+                ins.side_effect = true;
+                ins.uses_inputs = false;
+                break;
+
             case Op::CALL:
                 ins.imm0 = loadU32(&code[ip]);
                 ip += 4;
@@ -180,6 +661,17 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 ins.side_effect = true;
                 break;
 
+            case Op::TAILCALL:
+                ins.imm0 = loadU32(&code[ip]);
+                ip += 4;
+                ins.imm1 = loadU32(&code[ip]);
+                ip += 4;
+                ins.consume = static_cast<int>(ins.imm1);
+                ins.side_effect = true;
+                ins.is_end = true;
+                ins.has_fallthrough = false;
+                break;
+
             case Op::RET:
                 ins.consume = 1;
                 ins.side_effect = true;
@@ -210,6 +702,64 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 ins.side_effect = true;
                 break;
 
+            case Op::PRINT_ARRAY:
+                ins.consume = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::FLUSH:
+                ins.side_effect = true;
+                ins.uses_inputs = false;
+                break;
+
+            case Op::READ_INT:
+            case Op::READ_FLOAT:
+            case Op::READ_EOF:
+                ins.produce = 1;
+                ins.side_effect = true;
+                ins.uses_inputs = false;
+                break;
+
+            case Op::READ_INTS:
+            case Op::READ_FLOATS:
+                ins.consume = 1;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::MAP_ARRAY:
+                ins.consume = 2;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::SAVE_ARRAY:
+                ins.consume = 2;
+                ins.side_effect = true;
+                break;
+
+            case Op::PARALLEL_FOR:
+                ins.consume = 4;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::SPAWN:
+                ins.imm0 = loadU32(&code[ip]);
+                ip += 4;
+                ins.imm1 = loadU32(&code[ip]);
+                ip += 4;
+                ins.consume = static_cast<int>(ins.imm1);
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::JOIN:
+                ins.consume = 1;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
             case Op::ARRAY_NEW:
                 ins.consume = 1;
                 ins.produce = 1;
@@ -233,6 +783,69 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 ins.side_effect = true;
                 break;
 
+            case Op::ARRAY_FILL:
+                ins.consume = 4;
+                ins.side_effect = true;
+                break;
+
+            case Op::ARRAY_COPY:
+                ins.consume = 5;
+                ins.side_effect = true;
+                break;
+
+            case Op::ARRAY_SLICE:
+                ins.consume = 3;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::ARRAY_EQUAL:
+                ins.consume = 2;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::ARRAY_SUM:
+                ins.consume = 3;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::ARRAY_COUNT:
+                ins.imm0 = code[ip++];
+                ins.consume = 4;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::ARRAY_MAP:
+                ins.imm0 = code[ip++];
+                ins.consume = 4;
+                ins.side_effect = true;
+                break;
+
+            case Op::BIGINT:
+                ins.consume = 1;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::BIG_ADD:
+            case Op::BIG_SUB:
+            case Op::BIG_MUL:
+            case Op::BIG_DIV:
+            case Op::BIG_MOD:
+            case Op::BIG_CMP:
+                ins.consume = 2;
+                ins.produce = 1;
+                ins.side_effect = true;
+                break;
+
+            case Op::PRINT_BIGINT:
+                ins.consume = 1;
+                ins.side_effect = true;
+                break;
+
             case Op::TIME_MS:
             case Op::RAND:
                 ins.produce = 1;
@@ -240,8 +853,14 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 ins.uses_inputs = false;
                 break;
 
-            default:
-                return nullptr;
+            default: {
+                const Builtin* b = builtinForOp(ins.op);
+                if (!b || !b->jitInline) return nullptr;
+                ins.consume = static_cast<int>(b->arity);
+                ins.produce = b->producesValue() ? 1 : 0;
+                ins.side_effect = !b->pure;
+                break;
+            }
         }
 
         ins.next_ip = ip;
@@ -254,19 +873,23 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
 
     x86::Assembler a(&codeHolder);
 
+    FrameLayout frame;
     a.push(x86::rbp);
+    frame.afterPushRbp = static_cast<uint32_t>(a.offset());
     a.mov(x86::rbp, x86::rsp);
-    a.push(x86::rbx);
-    a.push(x86::rdi);
-    a.push(x86::r12);
-    a.push(x86::r13);
-    a.push(x86::r14);
-    a.push(x86::r15);
+    frame.afterSetFrame = static_cast<uint32_t>(a.offset());
+    for (const x86::Gp& reg : {x86::rbx, x86::rdi, x86::r12, x86::r13, x86::r14, x86::r15}) {
+        a.push(reg);
+        frame.saves.emplace_back(static_cast<uint32_t>(a.offset()), reg.id());
+    }
 
     a.mov(x86::rdi, x86::rcx);
 
     a.mov(x86::rbx, x86::ptr(x86::rdi, offsetof(JITContext, locals)));
     a.mov(x86::r12, x86::ptr(x86::rdi, offsetof(JITContext, stack)));
+
+    Label body_entry = a.new_label();
+    a.bind(body_entry);
     a.xor_(x86::r13, x86::r13);
 
     std::unordered_map<size_t, Label> labels;
@@ -276,22 +899,14 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
         Op op = static_cast<Op>(code[ip]);
         ip++;
 
-        if (op == Op::JMP || op == Op::JMP_IF_FALSE) {
-            uint32_t target = loadU32(&code[ip]);
+        int jo = jumpOperand(op);
+        if (jo >= 0) {
+            uint32_t target = loadU32(&code[ip + static_cast<size_t>(jo)]);
             if (labels.find(target) == labels.end()) {
                 labels[target] = a.new_label();
             }
-            ip += 4;
-        } else {
-            switch (op) {
-                case Op::ICONST: ip += 8; break;
-                case Op::FCONST: ip += 8; break;
-                case Op::LOAD:
-                case Op::STORE: ip += 4; break;
-                case Op::CALL: ip += 8; break;
-                default: break;
-            }
         }
+        ip += operandBytes(op);
     }
 
     bool dce_enabled = true;
@@ -493,6 +1108,17 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
         }
     }
 
+    auto emit_epilogue = [&] {
+        a.pop(x86::r15);
+        a.pop(x86::r14);
+        a.pop(x86::r13);
+        a.pop(x86::r12);
+        a.pop(x86::rdi);
+        a.pop(x86::rbx);
+        a.pop(x86::rbp);
+        a.ret();
+    };
+
     auto adjust_stack = [&](int delta) {
         if (delta > 0) {
             if (delta == 1) a.inc(x86::r13);
@@ -503,9 +1129,13 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
         }
     };
 
+    CodeInfo info;
+    info.funcId = funcId;
+
     ip = func_start;
     while (ip < func_end) {
         size_t cur_ip = ip;
+        info.pcMap.emplace_back(static_cast<uint32_t>(a.offset()), static_cast<uint32_t>(cur_ip));
 
         auto itLab = labels.find(cur_ip);
         if (itLab != labels.end()) {
@@ -582,6 +1212,19 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 break;
             }
 
+            case Op::INC_LOCAL: {
+                uint32_t slot = loadU32(&code[ip]);
+                int64_t k = loadI64(&code[ip + 4]);
+                ip += 12;
+                if (k == static_cast<int32_t>(k)) {
+                    a.add(x86::qword_ptr(x86::rbx, slot * 8), static_cast<int32_t>(k));
+                } else {
+                    a.mov(x86::rax, k);
+                    a.add(x86::ptr(x86::rbx, slot * 8), x86::rax);
+                }
+                break;
+            }
+
             case Op::IADD: {
                 a.dec(x86::r13);
                 a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
@@ -734,108 +1377,204 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 break;
             }
 
-            case Op::CMPLE: {
+            case Op::IMIN:
+            case Op::IMAX: {
                 a.dec(x86::r13);
                 a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
                 a.cmp(x86::rax, x86::rdx);
-                a.setle(x86::al);
-                a.movzx(x86::rax, x86::al);
+                if (op == Op::IMIN) a.cmovg(x86::rax, x86::rdx);
+                else a.cmovl(x86::rax, x86::rdx);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::CMPLT: {
-                a.dec(x86::r13);
-                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+            case Op::IABS: {
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.cmp(x86::rax, x86::rdx);
-                a.setl(x86::al);
-                a.movzx(x86::rax, x86::al);
+                a.mov(x86::rdx, x86::rax);
+                a.neg(x86::rdx);
+                a.cmovns(x86::rax, x86::rdx);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::CMPGE: {
+            case Op::FMIN:
+            case Op::FMAX: {
                 a.dec(x86::r13);
                 a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.cmp(x86::rax, x86::rdx);
-                a.setge(x86::al);
-                a.movzx(x86::rax, x86::al);
+                a.movq(x86::xmm0, x86::rax);
+                a.movq(x86::xmm1, x86::rdx);
+                if (op == Op::FMIN) a.minsd(x86::xmm0, x86::xmm1);
+                else a.maxsd(x86::xmm0, x86::xmm1);
+                a.movq(x86::rax, x86::xmm0);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::CMPGT: {
-                a.dec(x86::r13);
-                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+            case Op::FABS: {
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.cmp(x86::rax, x86::rdx);
-                a.setg(x86::al);
-                a.movzx(x86::rax, x86::al);
+                a.btr(x86::rax, 63);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::CMPEQ: {
-                a.dec(x86::r13);
-                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+            case Op::FFLOOR: {
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.cmp(x86::rax, x86::rdx);
-                a.sete(x86::al);
-                a.movzx(x86::rax, x86::al);
+                if (runtime.cpu_features().x86().has_sse4_1()) {
+                    a.movq(x86::xmm0, x86::rax);
+                    a.roundsd(x86::xmm0, x86::xmm0, 9);
+                    a.movq(x86::rax, x86::xmm0);
+                } else {
+                    a.mov(x86::rcx, x86::rax);
+                    a.sub(x86::rsp, 32);
+                    a.call(imm(reinterpret_cast<uint64_t>(runtime_floor_bits)));
+                    a.add(x86::rsp, 32);
+                }
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::CMPNE: {
+            case Op::IAND:
+            case Op::IOR:
+            case Op::IXOR: {
                 a.dec(x86::r13);
                 a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.cmp(x86::rax, x86::rdx);
-                a.setne(x86::al);
-                a.movzx(x86::rax, x86::al);
+                if (op == Op::IAND) a.and_(x86::rax, x86::rdx);
+                else if (op == Op::IOR) a.or_(x86::rax, x86::rdx);
+                else a.xor_(x86::rax, x86::rdx);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::FCMPLE: {
+            case Op::ISHL:
+            case Op::ISHR: {
                 a.dec(x86::r13);
-                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::rcx, x86::ptr(x86::r12, x86::r13, 3));
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.movq(x86::xmm0, x86::rax);
-                a.movq(x86::xmm1, x86::rdx);
-                a.ucomisd(x86::xmm0, x86::xmm1);
-                a.setbe(x86::al);
-                a.movzx(x86::rax, x86::al);
+                if (op == Op::ISHL) a.shl(x86::rax, x86::cl);
+                else a.sar(x86::rax, x86::cl);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
                 break;
             }
 
-            case Op::FCMPLT: {
+            case Op::CMPLE: {
                 a.dec(x86::r13);
                 a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.movq(x86::xmm0, x86::rax);
-                a.movq(x86::xmm1, x86::rdx);
-                a.ucomisd(x86::xmm0, x86::xmm1);
-                a.setb(x86::al);
+                a.cmp(x86::rax, x86::rdx);
+                a.setle(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::CMPLT: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.cmp(x86::rax, x86::rdx);
+                a.setl(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::CMPGE: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.cmp(x86::rax, x86::rdx);
+                a.setge(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::CMPGT: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.cmp(x86::rax, x86::rdx);
+                a.setg(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::CMPEQ: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.cmp(x86::rax, x86::rdx);
+                a.sete(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::CMPNE: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.cmp(x86::rax, x86::rdx);
+                a.setne(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::FCMPLE: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.movq(x86::xmm0, x86::rax);
+                a.movq(x86::xmm1, x86::rdx);
+                a.ucomisd(x86::xmm1, x86::xmm0);
+                a.setae(x86::al);
+                a.movzx(x86::rax, x86::al);
+                a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::FCMPLT: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.movq(x86::xmm0, x86::rax);
+                a.movq(x86::xmm1, x86::rdx);
+                a.ucomisd(x86::xmm1, x86::xmm0);
+                a.seta(x86::al);
                 a.movzx(x86::rax, x86::al);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
@@ -881,6 +1620,8 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 a.movq(x86::xmm1, x86::rdx);
                 a.ucomisd(x86::xmm0, x86::xmm1);
                 a.sete(x86::al);
+                a.setnp(x86::dl);
+                a.and_(x86::al, x86::dl);
                 a.movzx(x86::rax, x86::al);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
@@ -896,6 +1637,8 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 a.movq(x86::xmm1, x86::rdx);
                 a.ucomisd(x86::xmm0, x86::xmm1);
                 a.setne(x86::al);
+                a.setp(x86::dl);
+                a.or_(x86::al, x86::dl);
                 a.movzx(x86::rax, x86::al);
                 a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
                 a.inc(x86::r13);
@@ -919,6 +1662,75 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 break;
             }
 
+            case Op::JNE_ZERO: {
+                uint32_t target = loadU32(&code[ip]);
+                ip += 4;
+                a.dec(x86::r13);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
+                a.test(x86::rax, x86::rax);
+                a.jnz(labels[target]);
+                break;
+            }
+
+            case Op::JLT_LOCALS:
+            case Op::JLE_LOCALS:
+            case Op::JGT_LOCALS:
+            case Op::JGE_LOCALS:
+            case Op::JEQ_LOCALS:
+            case Op::JNE_LOCALS:
+            case Op::JLT_LOCAL_CONST:
+            case Op::JLE_LOCAL_CONST:
+            case Op::JGT_LOCAL_CONST:
+            case Op::JGE_LOCAL_CONST:
+            case Op::JEQ_LOCAL_CONST:
+            case Op::JNE_LOCAL_CONST:
+            {
+                uint32_t target = loadU32(&code[ip]);
+                uint32_t slot = loadU32(&code[ip + 4]);
+                a.mov(x86::rax, x86::ptr(x86::rbx, slot * 8));
+                if (operandBytes(op) == 12) {
+                    a.cmp(x86::rax, x86::ptr(x86::rbx, loadU32(&code[ip + 8]) * 8));
+                } else {
+                    int64_t k = loadI64(&code[ip + 8]);
+                    if (k == static_cast<int32_t>(k)) {
+                        a.cmp(x86::rax, static_cast<int32_t>(k));
+                    } else {
+                        a.mov(x86::rdx, k);
+                        a.cmp(x86::rax, x86::rdx);
+                    }
+                }
+                ip += operandBytes(op);
+                a.j(intBranchCond(branchCompare(op)), labels[target]);
+                break;
+            }
+
+            case Op::FJNLT_LOCALS:
+            case Op::FJNLE_LOCALS:
+            case Op::FJNGT_LOCALS:
+            case Op::FJNGE_LOCALS:
+            case Op::FJNEQ_LOCALS:
+            case Op::FJNNE_LOCALS:
+            case Op::FJNLT_LOCAL_CONST:
+            case Op::FJNLE_LOCAL_CONST:
+            case Op::FJNGT_LOCAL_CONST:
+            case Op::FJNGE_LOCAL_CONST:
+            case Op::FJNEQ_LOCAL_CONST:
+            case Op::FJNNE_LOCAL_CONST:
+            {
+                uint32_t target = loadU32(&code[ip]);
+                uint32_t slot = loadU32(&code[ip + 4]);
+                a.movsd(x86::xmm0, x86::ptr(x86::rbx, slot * 8));
+                if (operandBytes(op) == 12) {
+                    a.movsd(x86::xmm1, x86::ptr(x86::rbx, loadU32(&code[ip + 8]) * 8));
+                } else {
+                    a.mov(x86::rax, loadI64(&code[ip + 8]));
+                    a.movq(x86::xmm1, x86::rax);
+                }
+                ip += operandBytes(op);
+                emitFloatBranchIfNot(a, branchCompare(op), labels[target]);
+                break;
+            }
+
             case Op::POP: {
                 a.dec(x86::r13);
                 break;
@@ -926,8 +1738,8 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
 
             case Op::PRINT: {
                 a.dec(x86::r13);
-                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.mov(x86::rcx, x86::rax);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
                 a.sub(x86::rsp, 32);
                 a.call(imm(reinterpret_cast<uint64_t>(runtime_print)));
                 a.add(x86::rsp, 32);
@@ -936,14 +1748,73 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
 
             case Op::PRINT_F: {
                 a.dec(x86::r13);
-                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-                a.mov(x86::rcx, x86::rax);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
                 a.sub(x86::rsp, 32);
                 a.call(imm(reinterpret_cast<uint64_t>(runtime_print_f_bits)));
                 a.add(x86::rsp, 32);
                 break;
             }
 
+            case Op::PRINT_ARRAY: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_print_array)));
+                a.add(x86::rsp, 32);
+                break;
+            }
+
+            case Op::FLUSH: {
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_flush)));
+                a.add(x86::rsp, 32);
+                break;
+            }
+
+            case Op::READ_INT:
+            case Op::READ_FLOAT:
+            case Op::READ_EOF: {
+                uint64_t fn = op == Op::READ_INT ? reinterpret_cast<uint64_t>(runtime_read_int)
+                            : op == Op::READ_FLOAT ? reinterpret_cast<uint64_t>(runtime_read_float_bits)
+                            : reinterpret_cast<uint64_t>(runtime_eof);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.sub(x86::rsp, 32);
+                a.call(imm(fn));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::READ_INTS:
+            case Op::READ_FLOATS: {
+                uint64_t fn = op == Op::READ_INTS ? reinterpret_cast<uint64_t>(runtime_read_ints)
+                                                  : reinterpret_cast<uint64_t>(runtime_read_floats);
+                a.dec(x86::r13);
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.sub(x86::rsp, 32);
+                a.call(imm(fn));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
             case Op::PRINT_BIG: {
                 a.dec(x86::r13);
                 a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3));
@@ -991,6 +1862,45 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 break;
             }
 
+            case Op::TAILCALL: {
+                uint32_t fid = loadU32(&code[ip]);
+                ip += 4;
+                uint32_t argc = loadU32(&code[ip]);
+                ip += 4;
+
+                if (fid == funcId) {
+                    // Self tail call: rebind the parameters, clear the other locals
+                    // the way a fresh frame would, and start over.
+                    for (uint32_t i = 0; i < argc; ++i) {
+                        auto disp = -static_cast<int32_t>((argc - i) * 8);
+                        a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3, disp));
+                        a.mov(x86::ptr(x86::rbx, i * 8), x86::rax);
+                    }
+                    for (uint32_t i = argc; i < func.nlocals; ++i) {
+                        a.mov(x86::qword_ptr(x86::rbx, i * 8), 0);
+                    }
+                    a.jmp(body_entry);
+                    break;
+                }
+
+                a.mov(x86::r14, x86::r13);
+                a.sub(x86::r14, argc);
+                a.shl(x86::r14, 3);
+                a.add(x86::r14, x86::r12);
+
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::edx, fid);
+                a.mov(x86::r8, x86::r14);
+                a.mov(x86::r9d, argc);
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_call_function)));
+                a.add(x86::rsp, 32);
+                emit_epilogue();
+                break;
+            }
+
             case Op::ARRAY_NEW: {
                 a.dec(x86::r13);
                 a.mov(x86::r14, x86::ptr(x86::r12, x86::r13, 3));
@@ -1070,7 +1980,231 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
                 break;
             }
 
+            case Op::ARRAY_FILL: {
+                a.sub(x86::r13, 4);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.mov(x86::r9, x86::ptr(x86::r12, x86::r13, 3, 16));
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3, 24));
+                a.sub(x86::rsp, 48);
+                a.mov(x86::ptr(x86::rsp, 32), x86::rax);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_array_fill)));
+                a.add(x86::rsp, 48);
+                break;
+            }
+
+            case Op::ARRAY_COPY: {
+                a.sub(x86::r13, 5);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.mov(x86::r9, x86::ptr(x86::r12, x86::r13, 3, 16));
+                a.sub(x86::rsp, 48);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3, 24));
+                a.mov(x86::ptr(x86::rsp, 32), x86::rax);
+                a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3, 32));
+                a.mov(x86::ptr(x86::rsp, 40), x86::rax);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_array_copy)));
+                a.add(x86::rsp, 48);
+                break;
+            }
+
+            case Op::ARRAY_SLICE: {
+                // The source stays on the visible stack so a GC inside the allocation keeps it alive.
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.sub(x86::r13, 3);
+
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.mov(x86::r9, x86::ptr(x86::r12, x86::r13, 3, 16));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_array_slice)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::ARRAY_EQUAL: {
+                a.sub(x86::r13, 2);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_array_equal)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::MAP_ARRAY: {
+                a.sub(x86::r13, 2);
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_map_array)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::SAVE_ARRAY: {
+                a.sub(x86::r13, 2);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_save_array)));
+                a.add(x86::rsp, 32);
+                break;
+            }
+
+            case Op::PARALLEL_FOR: {
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.sub(x86::r13, 4);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.lea(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_parallel_for)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::SPAWN: {
+                uint32_t fid = loadU32(&code[ip]);
+                ip += 4;
+                uint32_t argc = loadU32(&code[ip]);
+                ip += 4;
+
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.sub(x86::r13, argc);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::edx, fid);
+                a.lea(x86::r8, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r9d, argc);
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_spawn)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::JOIN: {
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3, -8));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_join)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3, -8), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3, -8), 0);
+                }
+                break;
+            }
+
+            case Op::BIGINT: {
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3, -8));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_bigint)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3, -8), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3, -8), 0);
+                }
+                break;
+            }
+
+            case Op::BIG_ADD:
+            case Op::BIG_SUB:
+            case Op::BIG_MUL:
+            case Op::BIG_DIV:
+            case Op::BIG_MOD:
+            case Op::BIG_CMP: {
+                // Operands stay on the visible stack so a GC inside the allocation keeps them alive.
+                a.mov(x86::ptr(x86::rdi, offsetof(JITContext, stack_size)), x86::r13);
+                a.sub(x86::r13, 2);
+
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::r8, x86::ptr(x86::r12, x86::r13, 3, 8));
+                a.mov(x86::r9d, static_cast<uint32_t>(op));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_big_binary)));
+                a.add(x86::rsp, 32);
+
+                if (need_value) {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), x86::rax);
+                } else {
+                    a.mov(x86::ptr(x86::r12, x86::r13, 3), 0);
+                }
+                a.inc(x86::r13);
+                break;
+            }
+
+            case Op::PRINT_BIGINT: {
+                a.dec(x86::r13);
+                a.mov(x86::rdx, x86::ptr(x86::r12, x86::r13, 3));
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
+                a.sub(x86::rsp, 32);
+                a.call(imm(reinterpret_cast<uint64_t>(runtime_print_bigint)));
+                a.add(x86::rsp, 32);
+                break;
+            }
+
+            case Op::ARRAY_SUM:
+                emitArrayKernel(a, runtime.cpu_features().x86(), op, Op::NOP);
+                break;
+
+            case Op::ARRAY_COUNT:
+            case Op::ARRAY_MAP: {
+                auto sub = static_cast<Op>(code[ip++]);
+                emitArrayKernel(a, runtime.cpu_features().x86(), op, sub);
+                break;
+            }
+
             case Op::TIME_MS: {
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
                 a.sub(x86::rsp, 32);
                 a.call(imm(reinterpret_cast<uint64_t>(runtime_time_ms)));
                 a.add(x86::rsp, 32);
@@ -1084,6 +2218,7 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
             }
 
             case Op::RAND: {
+                a.mov(x86::rcx, x86::ptr(x86::rdi, offsetof(JITContext, vm)));
                 a.sub(x86::rsp, 32);
                 a.call(imm(reinterpret_cast<uint64_t>(runtime_rand)));
                 a.add(x86::rsp, 32);
@@ -1105,27 +2240,11 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
 
                 a.dec(x86::r13);
                 a.mov(x86::rax, x86::ptr(x86::r12, x86::r13, 3));
-
-                a.pop(x86::r15);
-                a.pop(x86::r14);
-                a.pop(x86::r13);
-                a.pop(x86::r12);
-                a.pop(x86::rdi);
-                a.pop(x86::rbx);
-                a.pop(x86::rbp);
-                a.ret();
+                emit_epilogue();
 
                 a.bind(empty_stack);
                 a.xor_(x86::rax, x86::rax);
-
-                a.pop(x86::r15);
-                a.pop(x86::r14);
-                a.pop(x86::r13);
-                a.pop(x86::r12);
-                a.pop(x86::rdi);
-                a.pop(x86::rbx);
-                a.pop(x86::rbp);
-                a.ret();
+                emit_epilogue();
                 break;
             }
 
@@ -1141,5 +2260,11 @@ JITCompiler::CompiledFunc JITCompiler::compileFunction(const Program& prog, uint
     }
 
     compiledFunctions[funcId] = fn;
+
+    info.start = reinterpret_cast<uintptr_t>(fn);
+    info.size = codeHolder.code_size();
+    if (void* unwind = registerUnwindInfo(info.start, info.size, frame)) unwindEntries.emplace_back(unwind);
+    publish(prog, info);
+    codeInfos.emplace_back(std::move(info));
     return fn;
 }
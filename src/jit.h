@@ -3,7 +3,11 @@
 #include <asmjit/x86.h>
 #include <cstddef>
 #include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 struct VM;
@@ -23,10 +27,45 @@ public:
     typedef int64_t (*CompiledFunc)(JITContext* ctx);
     CompiledFunc compileFunction(const Program& prog, uint32_t funcId);
 
+    // Compiles every function that is not compiled yet, or only those flagged in
+    // `only` when it is non-empty. VMs on different threads may share one compiler
+    // for the same Program: each calls this before running, and after it returns
+    // the compiled code and lookups below are read-only.
+    void compileAll(const Program& prog, const std::vector<bool>& only);
+
     bool isCompiled(uint32_t funcId) const;
     CompiledFunc getCompiledFunction(uint32_t funcId) const;
 
+    // Native code of one compiled function. pcMap holds (code offset, bytecode ip)
+    // for every emitted instruction, sorted by offset.
+    struct CodeInfo {
+        uint32_t funcId = 0;
+        uintptr_t start = 0;
+        size_t size = 0;
+        std::vector<std::pair<uint32_t, uint32_t>> pcMap;
+    };
+
+    // Maps a return address inside compiled code back to the function and the
+    // bytecode ip of the instruction that made the call.
+    bool locate(const void* returnAddress, uint32_t& funcId, size_t& ip) const;
+
+    // Appends every function compiled from now on to /tmp/perf-<pid>.map.
+    void enablePerfMap();
+
+    // Registers every function compiled from now on with GDB's JIT interface.
+    void enableGdbJit();
+
 private:
+    void publish(const Program& prog, const CodeInfo& info);
+
+    std::mutex compileMutex;
     asmjit::JitRuntime runtime;
     std::unordered_map<uint32_t, CompiledFunc> compiledFunctions;
+    std::vector<CodeInfo> codeInfos;
+    std::vector<void*> unwindEntries;
+
+    std::ofstream perfMap;
+
+    bool gdbJit = false;
+    std::vector<void*> gdbEntries;
 };
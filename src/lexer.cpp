@@ -42,6 +42,7 @@ Token Lexer::identOrKeyword() {
     else if (t.text == "for") t.kind = TokKind::KwFor;
     else if (t.text == "break") t.kind = TokKind::KwBreak;
     else if (t.text == "continue") t.kind = TokKind::KwContinue;
+    else if (t.text == "spawn") t.kind = TokKind::KwSpawn;
 
     return t;
 }
@@ -93,6 +94,29 @@ Token Lexer::number() {
     return t;
 }
 
+Token Lexer::string() {
+    Token t{TokKind::String, "", 0, line, col};
+    get();
+
+    for (;;) {
+        if (eof() || peek() == '\n') throw std::runtime_error("unterminated string literal");
+        char c = get();
+        if (c == '"') break;
+        if (c == '\\') {
+            switch (get()) {
+                case 'n':  c = '\n'; break;
+                case 't':  c = '\t'; break;
+                case '\\': c = '\\'; break;
+                case '"':  c = '"'; break;
+                default: throw std::runtime_error("bad escape in string literal");
+            }
+        }
+        t.text.push_back(c);
+    }
+
+    return t;
+}
+
 std::vector<Token> Lexer::lex() {
     std::vector<Token> out;
 
@@ -104,6 +128,8 @@ std::vector<Token> Lexer::lex() {
             out.emplace_back(identOrKeyword());
         } else if (std::isdigit((unsigned char)c) || (c == '.' && std::isdigit((unsigned char)peek(1)))) {
             out.emplace_back(number());
+        } else if (c == '"') {
+            out.emplace_back(string());
         } else {
             Token t{TokKind::Unknown, std::string(1, c), 0, line, col};
 
@@ -8,7 +8,8 @@ enum class TokKind {
     Ident,
     Int,
     Float,
-    KwFn, KwReturn, KwIf, KwElse, KwLet, KwWhile, KwFor, KwBreak, KwContinue,
+    String,
+    KwFn, KwReturn, KwIf, KwElse, KwLet, KwWhile, KwFor, KwBreak, KwContinue, KwSpawn,
     LParen, RParen, LBrace, RBrace, LBracket, RBracket,
     Comma, Semicolon, Arrow,
     Plus, Minus, Star, Slash, Percent,
@@ -44,4 +45,5 @@ private:
     void skipSpaceAndComments();
     Token identOrKeyword();
     Token number();
+    Token string();
 };
@@ -1,11 +1,19 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
+#include "batch.h"
 #include "vm.h"
+#include "opstats.h"
+#include "perfcounters.h"
+#include "profiler.h"
+#include "server.h"
 
 static std::string readFile(const std::string& path) {
     std::ifstream f(path, std::ios::binary);
@@ -19,45 +27,205 @@ static bool startsWith(const std::string& s, const std::string& pref) {
     return s.rfind(pref, 0) == 0;
 }
 
+static void compile(const std::string& file, Program& prog) {
+    Lexer lx(readFile(file));
+    Parser ps(lx.lex());
+    auto mod = ps.parseModule();
+    prog.sourceName = file;
+    mod->gen(prog);
+}
+
+// Every (script, input) pair `repeat` times, each in its own VM. Output is
+// printed per job, in order; a failed job does not stop the others.
+static int runJobs(const std::vector<std::string>& files, const std::vector<std::string>& inputs,
+                   unsigned repeat, unsigned threads, bool enableJit, bool perfMap, bool gdbJit, size_t gcTh) {
+    std::vector<std::unique_ptr<Program>> progs;
+    std::vector<std::shared_ptr<JITCompiler>> code;
+    for (auto& file : files) {
+        progs.emplace_back(std::make_unique<Program>());
+        compile(file, *progs.back());
+
+        std::shared_ptr<JITCompiler> jit;
+        if (enableJit) {
+            jit = std::make_shared<JITCompiler>();
+            if (gdbJit) jit->enableGdbJit();
+            if (perfMap) jit->enablePerfMap();
+        }
+        code.emplace_back(std::move(jit));
+    }
+
+    std::vector<BatchJob> jobs;
+    for (size_t f = 0; f < files.size(); ++f) {
+        for (size_t in = 0; in < std::max<size_t>(1, inputs.size()); ++in) {
+            for (unsigned r = 0; r < repeat; ++r) {
+                BatchJob job;
+                job.prog = progs[f].get();
+                job.jit = code[f];
+                job.inputPath = inputs.empty() ? "" : inputs[in];
+                job.label = files[f] + (inputs.empty() ? "" : " < " + inputs[in]) + (repeat > 1 ? " #" + std::to_string(r + 1) : "");
+                jobs.emplace_back(std::move(job));
+            }
+        }
+    }
+
+    int rc = 0;
+    runBatch(jobs, threads, gcTh, [&](BatchJob& job) {
+        std::cout.write(job.output.data(), static_cast<std::streamsize>(job.output.size()));
+        std::cout.flush();
+        if (!job.error.empty()) {
+            std::cerr << "Error: " << job.label << ": " << job.error << "\n";
+            rc = 1;
+        }
+        std::string().swap(job.output);
+    });
+    return rc;
+}
+
 int main(int argc, char** argv) {
     try {
         if (argc < 2) {
             return 2;
         }
 
-        std::string file = argv[1];
+        std::vector<std::string> files;
+        std::vector<std::string> inputs;
+        unsigned jobs = 0;
+        unsigned repeat = 1;
         bool enableJit = true;
         size_t gcTh = 100;
+        std::string opStatsPath;
+        std::string profilePath;
+        bool perfMap = false;
+        bool gdbJit = false;
+        bool perfCounters = false;
+        bool perfCountersPerFunction = false;
+        std::string servePath;
+        std::string connectPath;
 
-        for (int i = 2; i < argc; ++i) {
+        for (int i = 1; i < argc; ++i) {
             std::string arg = argv[i];
             if (arg == "--no-jit") {
                 enableJit = false;
             } else if (startsWith(arg, "--gc=")) {
                 gcTh = static_cast<size_t>(std::stoull(arg.substr(5)));
+            } else if (startsWith(arg, "--op-stats=")) {
+                opStatsPath = arg.substr(11);
+            } else if (startsWith(arg, "--profile=")) {
+                profilePath = arg.substr(10);
+            } else if (startsWith(arg, "--input=")) {
+                inputs.emplace_back(arg.substr(8));
+            } else if (startsWith(arg, "--jobs=")) {
+                jobs = static_cast<unsigned>(std::stoul(arg.substr(7)));
+            } else if (startsWith(arg, "--repeat=")) {
+                repeat = std::max(1u, static_cast<unsigned>(std::stoul(arg.substr(9))));
+            } else if (startsWith(arg, "--serve=")) {
+                servePath = arg.substr(8);
+            } else if (startsWith(arg, "--connect=")) {
+                connectPath = arg.substr(10);
+            } else if (arg == "--perf-map") {
+                perfMap = true;
+            } else if (arg == "--gdb-jit") {
+                gdbJit = true;
+            } else if (arg == "--perf-counters") {
+                perfCounters = true;
+            } else if (arg == "--perf-counters=functions") {
+                perfCounters = true;
+                perfCountersPerFunction = true;
+            } else if (!startsWith(arg, "--")) {
+                files.emplace_back(arg);
             } else {
                 std::cerr << "Unknown arg: " << arg << "\n";
                 return 2;
             }
         }
 
-        std::string src = readFile(file);
-        Lexer lx(std::move(src));
-        auto toks = lx.lex();
-        Parser ps(std::move(toks));
-        auto mod = ps.parseModule();
+        if (!servePath.empty()) {
+            if (!files.empty()) {
+                std::cerr << "--serve takes no script\n";
+                return 2;
+            }
+            serve(servePath, jobs ? jobs : std::max(1u, std::thread::hardware_concurrency()), enableJit, gcTh);
+            return 0;
+        }
+
+        if (files.empty()) {
+            return 2;
+        }
 
+        // The server's --no-jit and --gc= apply, not the client's.
+        if (!connectPath.empty()) {
+            if (files.size() > 1 || inputs.size() > 1 || repeat > 1) {
+                std::cerr << "--connect runs a single script\n";
+                return 2;
+            }
+            runRemote(connectPath, files[0], inputs.empty() ? "" : inputs[0]);
+            return 0;
+        }
+
+        if (files.size() > 1 || inputs.size() > 1 || repeat > 1 || jobs > 0) {
+            if (!opStatsPath.empty() || !profilePath.empty() || perfCounters) {
+                std::cerr << "--op-stats, --profile and --perf-counters need a single run\n";
+                return 2;
+            }
+            if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+            return runJobs(files, inputs, repeat, jobs, enableJit, perfMap, gdbJit, gcTh);
+        }
+
+        const std::string& file = files[0];
         Program prog;
-        mod->gen(prog);
+        compile(file, prog);
 
         VM vm(&prog);
         vm.gcThreshold = gcTh;
+        if (!inputs.empty()) vm.input.fromFile(inputs[0]);
+
+        // Statistics come from the interpreter, so collecting them turns the JIT off.
+        OpStats stats;
+        if (!opStatsPath.empty()) {
+            vm.opStats = &stats;
+            enableJit = false;
+        }
 
         if (!enableJit) {
             vm.jit.reset();
+        } else {
+            if (gdbJit) vm.jit->enableGdbJit();
+            if (perfMap) vm.jit->enablePerfMap();
+        }
+
+        std::unique_ptr<Profiler> profiler;
+        if (!profilePath.empty()) {
+            profiler = std::make_unique<Profiler>(&prog);
+            vm.profiler = profiler.get();
+            profiler->start();
+        }
+
+        std::unique_ptr<PerfCounters> counters;
+        if (perfCounters) {
+            counters = std::make_unique<PerfCounters>(&prog);
+            counters->perFunction = perfCountersPerFunction;
+            if (perfCountersPerFunction && counters->available()) vm.perfCounters = counters.get();
+            counters->start();
         }
 
         vm.run("main");
+
+        // Reported on stderr so program output stays comparable between runs.
+        if (counters) {
+            counters->stop();
+            counters->write(std::cerr, file + (vm.jit ? " (jit)" : " (interpreter)"));
+        }
+
+        if (profiler) {
+            profiler->stop();
+            profiler->write(profilePath);
+        }
+
+        if (!opStatsPath.empty()) {
+            std::ofstream out(opStatsPath);
+            if (!out) throw std::runtime_error("cannot open: " + opStatsPath);
+            stats.write(out, prog);
+        }
         return 0;
     } catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << "\n";
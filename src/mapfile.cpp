@@ -0,0 +1,113 @@
+#include "mapfile.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t byteSize(const std::string& path, size_t n) {
+    if (n > SIZE_MAX / sizeof(int64_t)) throw std::runtime_error("array too large for " + path);
+    return n * sizeof(int64_t);
+}
+
+#ifdef _WIN32
+
+int64_t* mapArrayFile(const std::string& path, size_t n) {
+    size_t bytes = byteSize(path, n);
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open: " + path);
+    if (n == 0) {
+        CloseHandle(f);
+        return nullptr;
+    }
+
+    // A mapping larger than the file extends it with zeros.
+    LARGE_INTEGER size{};
+    GetFileSizeEx(f, &size);
+    ULONGLONG want = static_cast<ULONGLONG>(size.QuadPart) > bytes ? static_cast<ULONGLONG>(size.QuadPart) : bytes;
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READWRITE, static_cast<DWORD>(want >> 32),
+                                  static_cast<DWORD>(want & 0xFFFFFFFFull), nullptr);
+    void* p = m ? MapViewOfFile(m, FILE_MAP_WRITE, 0, 0, bytes) : nullptr;
+    if (m) CloseHandle(m);
+    CloseHandle(f);
+    if (!p) throw std::runtime_error("cannot map: " + path);
+    return static_cast<int64_t*>(p);
+}
+
+void unmapArrayFile(int64_t* p, size_t) {
+    UnmapViewOfFile(p);
+}
+
+static void replaceFile(const std::string& from, const std::string& to) {
+    if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        std::remove(from.c_str());
+        throw std::runtime_error("cannot write: " + to);
+    }
+}
+
+#else
+
+int64_t* mapArrayFile(const std::string& path, size_t n) {
+    size_t bytes = byteSize(path, n);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw std::runtime_error("cannot open: " + path + ": " + std::strerror(errno));
+    if (n == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) < bytes && ftruncate(fd, static_cast<off_t>(bytes)) != 0)) {
+        std::string err = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error("cannot resize: " + path + ": " + err);
+    }
+
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    std::string err = p == MAP_FAILED ? std::strerror(errno) : "";
+    close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("cannot map: " + path + ": " + err);
+    return static_cast<int64_t*>(p);
+}
+
+void unmapArrayFile(int64_t* p, size_t n) {
+    munmap(p, n * sizeof(int64_t));
+}
+
+static void replaceFile(const std::string& from, const std::string& to) {
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        std::string err = std::strerror(errno);
+        std::remove(from.c_str());
+        throw std::runtime_error("cannot write: " + to + ": " + err);
+    }
+}
+
+#endif
+
+// Goes through a temporary so a mapping of the old file, possibly the very
+// array being saved, is never truncated underneath its users.
+void saveArrayFile(const std::string& path, const int64_t* p, size_t n) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot write: " + tmp);
+        out.write(reinterpret_cast<const char*>(p), static_cast<std::streamsize>(byteSize(path, n)));
+        if (!out) {
+            out.close();
+            std::remove(tmp.c_str());
+            throw std::runtime_error("cannot write: " + tmp);
+        }
+    }
+    replaceFile(tmp, path);
+}
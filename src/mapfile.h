@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Array storage backed by a file of raw native-endian int64 elements. The file
+// is created or zero-extended to n elements and mapped shared, so stores reach
+// the file and other processes mapping it see the same pages. Errors throw;
+// n == 0 only creates the file and returns nullptr.
+int64_t* mapArrayFile(const std::string& path, size_t n);
+void unmapArrayFile(int64_t* p, size_t n);
+
+// Writes n elements to path, replacing the file atomically.
+void saveArrayFile(const std::string& path, const int64_t* p, size_t n);
@@ -0,0 +1,159 @@
+#include "opstats.h"
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+OpStats::OpStats() : ops(256, 0), bigrams(256 * 256, 0) {}
+
+namespace {
+    struct Sequence {
+        std::vector<Op> ops;
+        uint64_t count = 0;
+    };
+}
+
+static std::string joinNames(const std::vector<Op>& seq, const char* sep) {
+    std::string s;
+    for (size_t i = 0; i < seq.size(); ++i) {
+        if (i) s += sep;
+        s += opName(seq[i]);
+    }
+    return s;
+}
+
+static bool transfersControl(Op op) {
+    return jumpOperand(op) >= 0 || op == Op::CALL || op == Op::TAILCALL || op == Op::RET || op == Op::HALT;
+}
+
+// Control can only leave a fused instruction at its end.
+static bool fusable(const std::vector<Op>& seq) {
+    for (size_t i = 0; i + 1 < seq.size(); ++i) {
+        if (transfersControl(seq[i])) return false;
+    }
+    return true;
+}
+
+static std::vector<const char*> operandTypes(Op op) {
+    switch (operandBytes(op)) {
+        case 1:  return {"uint8_t"};
+        case 4:  return {"uint32_t"};
+        case 8:
+            if (op == Op::ICONST || op == Op::FCONST) return {"int64_t"};
+            return {"uint32_t", "uint32_t"};
+        case 12:
+            if (op == Op::INC_LOCAL) return {"uint32_t", "int64_t"};
+            return {"uint32_t", "uint32_t", "uint32_t"};
+        case 16: return {"uint32_t", "uint32_t", "int64_t"};
+        default: return {};
+    }
+}
+
+static void writeTable(std::ostream& out, const std::vector<Sequence>& rows, uint64_t total, size_t top) {
+    for (size_t i = 0; i < rows.size() && i < top; ++i) {
+        double pct = total ? 100.0 * static_cast<double>(rows[i].count) / static_cast<double>(total) : 0.0;
+        out << std::setw(14) << rows[i].count << std::setw(8) << std::fixed << std::setprecision(2) << pct
+            << "%  " << joinNames(rows[i].ops, " ") << "\n";
+    }
+}
+
+static void writeSkeleton(std::ostream& out, const std::vector<Sequence>& picks) {
+    out << "\n// enum class Op\n";
+    for (auto& s : picks) {
+        out << "    " << joinNames(s.ops, "_") << ",  // " << s.count << " executions\n";
+    }
+
+    out << "\n// operandBytes\n";
+    for (auto& s : picks) {
+        uint32_t bytes = 0;
+        for (Op op : s.ops) bytes += operandBytes(op);
+        out << "        case Op::" << joinNames(s.ops, "_") << ": return " << bytes << ";\n";
+    }
+
+    out << "\n// VM::run\n";
+    for (auto& s : picks) {
+        int effect = 0;
+        bool known = true;
+        for (Op op : s.ops) {
+            if (op == Op::CALL || op == Op::TAILCALL || op == Op::SPAWN) known = false;
+            effect += stackEffect(op);
+        }
+
+        out << "            case Op::" << joinNames(s.ops, "_") << ": {\n";
+        out << "                // stack effect: " << (known ? std::to_string(effect) : std::string("depends on argc")) << "\n";
+        int field = 0;
+        for (Op op : s.ops) {
+            out << "                // " << opName(op) << "\n";
+            for (const char* type : operandTypes(op)) {
+                std::string read = std::string(type) == "uint8_t" ? "code[ip++]"
+                                 : std::string(type) == "int64_t" ? "readI64(ip)" : "readU32(ip)";
+                out << "                " << type << " x" << field++ << " = " << read << ";\n";
+            }
+        }
+        out << "                break;\n";
+        out << "            }\n\n";
+    }
+}
+
+void OpStats::write(std::ostream& out, const Program& prog, size_t top) const {
+    auto byCount = [](const Sequence& a, const Sequence& b) { return a.count > b.count; };
+
+    std::vector<Sequence> singles;
+    for (uint32_t i = 0; i < ops.size(); ++i) {
+        if (ops[i]) singles.push_back({{static_cast<Op>(i)}, ops[i]});
+    }
+
+    std::vector<Sequence> pairs;
+    for (uint32_t i = 0; i < bigrams.size(); ++i) {
+        if (bigrams[i]) pairs.push_back({{static_cast<Op>(i >> 8), static_cast<Op>(i & 0xFF)}, bigrams[i]});
+    }
+
+    std::vector<Sequence> triples;
+    for (auto& [key, count] : trigrams) {
+        triples.push_back({{static_cast<Op>(key >> 16), static_cast<Op>((key >> 8) & 0xFF), static_cast<Op>(key & 0xFF)}, count});
+    }
+
+    std::sort(singles.begin(), singles.end(), byCount);
+    std::sort(pairs.begin(), pairs.end(), byCount);
+    std::sort(triples.begin(), triples.end(), byCount);
+
+    out << "# dispatches: " << total << "\n";
+
+    out << "\n# opcodes\n";
+    writeTable(out, singles, total, singles.size());
+
+    out << "\n# bigrams\n";
+    writeTable(out, pairs, total, top);
+
+    out << "\n# trigrams\n";
+    writeTable(out, triples, total, top);
+
+    out << "\n# functions\n";
+    std::vector<std::pair<uint64_t, uint32_t>> funcs;
+    for (uint32_t i = 0; i < perFunction.size(); ++i) {
+        if (perFunction[i]) funcs.emplace_back(perFunction[i], i);
+    }
+    std::sort(funcs.begin(), funcs.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (auto& [count, fid] : funcs) {
+        double pct = total ? 100.0 * static_cast<double>(count) / static_cast<double>(total) : 0.0;
+        out << std::setw(14) << count << std::setw(8) << std::fixed << std::setprecision(2) << pct
+            << "%  " << prog.funcs[fid].name << "\n";
+    }
+
+    // A fused op of length n saves n - 1 dispatches per execution.
+    std::vector<Sequence> candidates;
+    for (auto* rows : {&pairs, &triples}) {
+        for (auto& s : *rows) {
+            if (fusable(s.ops)) candidates.push_back(s);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Sequence& a, const Sequence& b) {
+        return a.count * (a.ops.size() - 1) > b.count * (b.ops.size() - 1);
+    });
+    if (candidates.size() > 8) candidates.resize(8);
+
+    out << "\n# superinstruction candidates (dispatches saved)\n";
+    for (auto& s : candidates) {
+        out << std::setw(14) << s.count * (s.ops.size() - 1) << "  " << joinNames(s.ops, " ") << "\n";
+    }
+    writeSkeleton(out, candidates);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "bytecode.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Dynamic opcode statistics gathered by the interpreter: single-op, bigram and
+// trigram frequencies plus instructions executed per function. Sequences never
+// span a call or return.
+struct OpStats {
+    OpStats();
+
+    // `frame` is the call depth; a change means a call or return happened in between.
+    void record(Op op, uint32_t funcId, size_t frame) {
+        auto cur = static_cast<uint32_t>(op);
+        if (frame != lastFrame) {
+            history = 0;
+            depth = 0;
+            lastFrame = frame;
+        }
+
+        total++;
+        ops[cur]++;
+        if (funcId >= perFunction.size()) perFunction.resize(funcId + 1, 0);
+        perFunction[funcId]++;
+
+        if (depth >= 1) bigrams[((history & 0xFF) << 8) | cur]++;
+        if (depth >= 2) trigrams[((history & 0xFFFF) << 8) | cur]++;
+
+        history = (history << 8) | cur;
+        if (depth < 2) depth++;
+    }
+
+    // Text report: totals, top sequences, per-function counts, and a C++ skeleton
+    // (enum entries, operandBytes cases and VM handlers) for the best fusion candidates.
+    void write(std::ostream& out, const Program& prog, size_t top = 30) const;
+
+private:
+    uint64_t total = 0;
+    std::vector<uint64_t> ops;
+    std::vector<uint64_t> bigrams;
+    std::unordered_map<uint32_t, uint64_t> trigrams;
+    std::vector<uint64_t> perFunction;
+
+    uint32_t history = 0;
+    int depth = 0;
+    size_t lastFrame = SIZE_MAX;
+};
@@ -0,0 +1,128 @@
+#include "output.h"
+#include <charconv>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+// Longest "%.17g" double plus the sign.
+static constexpr size_t kMaxDouble = 32;
+static constexpr size_t kMaxInt = 20;
+
+static void writeAll(int fd, const char* p, size_t n) {
+    while (n > 0) {
+#ifdef _WIN32
+        int w = _write(fd, p, static_cast<unsigned>(n));
+#else
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+#endif
+        // Nothing sensible to do about a closed or full stdout; drop the rest.
+        if (w <= 0) return;
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+}
+
+OutputSink::OutputSink() = default;
+
+OutputSink::~OutputSink() {
+    flush();
+}
+
+void OutputSink::toFd(int target) {
+    flush();
+    fd = target;
+    inMemory = false;
+}
+
+void OutputSink::toMemory() {
+    flush();
+    inMemory = true;
+}
+
+void OutputSink::beginCapture() {
+    captures.push_back(Capture{len, std::string()});
+}
+
+std::string OutputSink::endCapture() {
+    Capture c = std::move(captures.back());
+    captures.pop_back();
+    if (len > c.mark) c.spilled.append(buf.get() + c.mark, len - c.mark);
+    len = c.mark;
+    return std::move(c.spilled);
+}
+
+void OutputSink::dropCaptures() {
+    if (captures.empty()) return;
+    len = captures.front().mark;
+    captures.clear();
+}
+
+void OutputSink::flush() {
+    if (len == 0) return;
+
+    // Bytes below the first mark are the target's; each capture gets its own slice.
+    size_t own = captures.empty() ? len : captures.front().mark;
+    if (inMemory) {
+        mem.append(buf.get(), own);
+    } else if (own > 0) {
+        writeAll(fd, buf.get(), own);
+    }
+    for (size_t i = 0; i < captures.size(); ++i) {
+        size_t end = i + 1 < captures.size() ? captures[i + 1].mark : len;
+        captures[i].spilled.append(buf.get() + captures[i].mark, end - captures[i].mark);
+        captures[i].mark = 0;
+    }
+    len = 0;
+}
+
+char* OutputSink::reserve(size_t n) {
+    if (!buf) buf.reset(new char[kCapacity]);
+    if (len + n > kCapacity) flush();
+    return buf.get() + len;
+}
+
+void OutputSink::write(const char* s, size_t n) {
+    if (n > kCapacity / 2) {
+        flush();
+        if (!captures.empty()) {
+            captures.back().spilled.append(s, n);
+        } else if (inMemory) {
+            mem.append(s, n);
+        } else {
+            writeAll(fd, s, n);
+        }
+        return;
+    }
+    std::memcpy(reserve(n), s, n);
+    len += n;
+}
+
+void OutputSink::put(char c) {
+    *reserve(1) = c;
+    len++;
+}
+
+void OutputSink::writeInt(int64_t v) {
+    char* p = reserve(kMaxInt);
+    len = static_cast<size_t>(std::to_chars(p, p + kMaxInt, v).ptr - buf.get());
+}
+
+void OutputSink::writeDouble(double v) {
+    char* p = reserve(kMaxDouble);
+    len = static_cast<size_t>(std::to_chars(p, p + kMaxDouble, v, std::chars_format::general, 17).ptr - buf.get());
+}
+
+void OutputSink::writeInts(const int64_t* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        char* out = reserve(kMaxInt + 1);
+        out = std::to_chars(out, out + kMaxInt, p[i]).ptr;
+        *out++ = '\n';
+        len = static_cast<size_t>(out - buf.get());
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Program output. The print builtins append to a buffer that is written out when
+// it fills, on flush(), and when the VM finishes a run. Output goes to a file
+// descriptor (stdout by default) or is collected in memory for embedders. The
+// buffer is allocated by the first write, so a sink nobody prints to is free.
+struct OutputSink {
+    static constexpr size_t kCapacity = 64 * 1024;
+
+    OutputSink();
+    ~OutputSink();
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    // Both flush whatever is pending to the old target first.
+    void toFd(int fd);
+    void toMemory();
+
+    // Everything flushed so far while writing to memory.
+    const std::string& memory() const { return mem; }
+    void clearMemory() { mem.clear(); }
+
+    // Collects everything written until the matching endCapture(), which returns
+    // it and goes back to the previous target. Captures nest, and one that nothing
+    // is written to costs no more than a push and a pop.
+    void beginCapture();
+    std::string endCapture();
+
+    // Ends every open capture and discards what it holds, for a run that failed
+    // without ending its own.
+    void dropCaptures();
+
+    void write(const char* s, size_t n);
+    void write(const std::string& s) { write(s.data(), s.size()); }
+    void put(char c);
+    void writeInt(int64_t v);
+    void writeDouble(double v);     // like printf("%.17g")
+
+    // One integer per line.
+    void writeInts(const int64_t* p, size_t n);
+
+    void flush();
+
+private:
+    char* reserve(size_t n);
+
+    std::unique_ptr<char[]> buf;
+    size_t len = 0;
+    int fd = 1;
+    bool inMemory = false;
+    std::string mem;
+
+    // A capture owns buf from mark up, and whatever a flush moved out of there.
+    struct Capture {
+        size_t mark;
+        std::string spilled;
+    };
+    std::vector<Capture> captures;
+};
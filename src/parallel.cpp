@@ -0,0 +1,284 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // A participant's remaining tasks [lo, hi) in one word, lo in the low half:
+    // the owner advances lo and thieves lower hi, each with a single CAS.
+    struct alignas(64) Range {
+        std::atomic<uint64_t> bits{0};
+    };
+
+    uint64_t pack(uint32_t lo, uint32_t hi) {
+        return static_cast<uint64_t>(hi) << 32 | lo;
+    }
+
+    struct Job {
+        size_t tasks = 0;
+        size_t width = 0;
+        const std::function<void(size_t, size_t)>* body = nullptr;
+        std::unique_ptr<Range[]> ranges;
+
+        size_t joined = 1;              // slots handed out, under the pool lock; 0 is the caller
+        std::atomic<bool> failed{false};
+
+        std::mutex m;
+        std::condition_variable cv;
+        size_t active = 1;              // participants still running
+        std::exception_ptr error;
+    };
+
+    bool takeOwn(Range& own, size_t& task) {
+        uint64_t v = own.bits.load();
+        for (;;) {
+            auto lo = static_cast<uint32_t>(v);
+            auto hi = static_cast<uint32_t>(v >> 32);
+            if (lo >= hi) return false;
+            if (own.bits.compare_exchange_weak(v, pack(lo + 1, hi))) {
+                task = lo;
+                return true;
+            }
+        }
+    }
+
+    // Only called with an empty block of our own, which no thief will touch, so the
+    // stolen half can be stored into it plainly.
+    bool steal(Job& job, size_t slot, size_t& task) {
+        for (size_t i = 1; i < job.width; ++i) {
+            Range& victim = job.ranges[(slot + i) % job.width];
+            uint64_t v = victim.bits.load();
+            for (;;) {
+                auto lo = static_cast<uint32_t>(v);
+                auto hi = static_cast<uint32_t>(v >> 32);
+                if (lo >= hi) break;
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (victim.bits.compare_exchange_weak(v, pack(lo, mid))) {
+                    task = mid;
+                    job.ranges[slot].bits.store(pack(mid + 1, hi));
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void participate(Job& job, size_t slot) {
+        size_t task;
+        while (!job.failed.load() && (takeOwn(job.ranges[slot], task) || steal(job, slot, task))) {
+            try {
+                (*job.body)(task, slot);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(job.m);
+                if (!job.error) job.error = std::current_exception();
+                job.failed.store(true);
+            }
+        }
+    }
+
+    class Pool {
+    public:
+        Pool() {
+            unsigned hw = std::thread::hardware_concurrency();
+            for (unsigned i = 1; i < hw; ++i) threads.emplace_back([this] { loop(); });
+        }
+
+        ~Pool() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& t : threads) t.join();
+        }
+
+        size_t size() const { return threads.size(); }
+
+        void run(size_t tasks, size_t width, const std::function<void(size_t, size_t)>& body) {
+            if (tasks == 0) return;
+            if (tasks > UINT32_MAX) throw std::runtime_error("too many parallel tasks");
+
+            Job job;
+            job.tasks = tasks;
+            job.width = std::max<size_t>(1, std::min({width, tasks, threads.size() + 1}));
+            job.body = &body;
+            job.ranges.reset(new Range[job.width]);
+            for (size_t s = 0; s < job.width; ++s) {
+                job.ranges[s].bits.store(pack(static_cast<uint32_t>(tasks * s / job.width),
+                                              static_cast<uint32_t>(tasks * (s + 1) / job.width)));
+            }
+
+            if (job.width > 1) {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    open.emplace_back(&job);
+                }
+                cv.notify_all();
+            }
+
+            participate(job, 0);
+
+            // Nobody joins after this, so active only falls from here.
+            if (job.width > 1) {
+                std::lock_guard<std::mutex> lock(m);
+                auto it = std::find(open.begin(), open.end(), &job);
+                if (it != open.end()) open.erase(it);
+            }
+            {
+                std::unique_lock<std::mutex> lock(job.m);
+                --job.active;
+                job.cv.wait(lock, [&] { return job.active == 0; });
+            }
+
+            if (job.error) std::rethrow_exception(job.error);
+        }
+
+        bool submit(std::shared_ptr<WorkPool::Task> task) {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                if (queue.size() >= kQueuedPerThread * threads.size()) return false;
+                queue.emplace_back(std::move(task));
+                backlog.store(queue.size(), std::memory_order_relaxed);
+            }
+            cv.notify_one();
+            return true;
+        }
+
+        bool hasRoom() const {
+            return backlog.load(std::memory_order_relaxed) < kQueuedPerThread * threads.size();
+        }
+
+        void wait(WorkPool::Task& task) {
+            std::unique_lock<std::mutex> lock(m);
+            while (!task.finished) {
+                std::shared_ptr<WorkPool::Task> next;
+                if (!task.started) {
+                    next = take(task);
+                } else if (!queue.empty()) {
+                    next = std::move(queue.back());
+                    queue.pop_back();
+                    backlog.store(queue.size(), std::memory_order_relaxed);
+                }
+
+                if (next) {
+                    execute(std::move(next), lock);
+                } else {
+                    done.wait(lock);
+                }
+            }
+        }
+
+        bool cancel(WorkPool::Task& task) {
+            std::lock_guard<std::mutex> lock(m);
+            if (task.started) return false;
+            take(task);
+            task.started = true;
+            task.finished = true;
+            return true;
+        }
+
+    private:
+        // A thread with this many tasks queued ahead of it has no use for more.
+        static constexpr size_t kQueuedPerThread = 2;
+
+        void loop() {
+            for (;;) {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return stop || !open.empty() || !queue.empty(); });
+                if (stop) return;
+
+                if (open.empty()) {
+                    auto task = std::move(queue.front());
+                    queue.pop_front();
+                    backlog.store(queue.size(), std::memory_order_relaxed);
+                    execute(std::move(task), lock);
+                    continue;
+                }
+
+                Job* job = open.front();
+                size_t slot = job->joined++;
+                if (job->joined == job->width) open.pop_front();
+                {
+                    std::lock_guard<std::mutex> jobLock(job->m);
+                    ++job->active;
+                }
+                lock.unlock();
+
+                participate(*job, slot);
+
+                std::lock_guard<std::mutex> jobLock(job->m);
+                if (--job->active == 0) job->cv.notify_all();
+            }
+        }
+
+        // Called and returns with the lock held.
+        void execute(std::shared_ptr<WorkPool::Task> task, std::unique_lock<std::mutex>& lock) {
+            task->started = true;
+            lock.unlock();
+            task->run();
+            lock.lock();
+            task->finished = true;
+            done.notify_all();
+        }
+
+        std::shared_ptr<WorkPool::Task> take(WorkPool::Task& task) {
+            auto it = std::find_if(queue.begin(), queue.end(), [&](const std::shared_ptr<WorkPool::Task>& t) {
+                return t.get() == &task;
+            });
+            if (it == queue.end()) return nullptr;
+            auto found = std::move(*it);
+            queue.erase(it);
+            backlog.store(queue.size(), std::memory_order_relaxed);
+            return found;
+        }
+
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<Job*> open;
+        std::deque<std::shared_ptr<WorkPool::Task>> queue;
+        std::atomic<size_t> backlog{0};     // queue.size(), for reading without the lock
+        std::condition_variable done;
+        bool stop = false;
+        std::vector<std::thread> threads;
+    };
+
+    Pool& pool() {
+        static Pool p;
+        return p;
+    }
+}
+
+namespace WorkPool {
+    size_t width() {
+        return pool().size() + 1;
+    }
+
+    void run(size_t tasks, size_t width, const std::function<void(size_t task, size_t slot)>& body) {
+        pool().run(tasks, width, body);
+    }
+
+    bool submit(std::shared_ptr<Task> task) {
+        return pool().submit(std::move(task));
+    }
+
+    bool hasRoom() {
+        return pool().hasRoom();
+    }
+
+    void wait(Task& task) {
+        pool().wait(task);
+    }
+
+    bool cancel(Task& task) {
+        return pool().cancel(task);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+// Process-wide work-stealing pool. A run splits its tasks into one contiguous
+// block per participant; each takes tasks from the bottom of its own block and,
+// once that is empty, steals the top half of another's. The calling thread is
+// always a participant, so a run finishes even when every pool thread is busy,
+// and runs may nest.
+//
+// Single tasks go on a shared queue: idle pool threads take the oldest, and a
+// thread waiting for one of them runs queued tasks itself, newest first, until
+// its own is done.
+namespace WorkPool {
+    // run() is called once, on whichever thread gets to it first, and must not throw.
+    struct Task {
+        virtual ~Task() = default;
+        virtual void run() = 0;
+
+        // Guarded by the pool.
+        bool started = false;
+        bool finished = false;
+    };
+
+    // Participants a run can have: the pool threads plus the caller.
+    size_t width();
+
+    // Calls body(task, slot) once for every task in [0, tasks), on at most
+    // `width` participants. slot < width names the participant, so per-slot state
+    // needs no locking. The first exception stops the remaining tasks and is
+    // rethrown once every participant has finished.
+    void run(size_t tasks, size_t width, const std::function<void(size_t task, size_t slot)>& body);
+
+    // Queues task, unless there are no pool threads or already enough queued work
+    // to keep them busy: then it returns false and the caller should run the task
+    // itself.
+    bool submit(std::shared_ptr<Task> task);
+
+    // Whether submit() would take a task now. Only a hint, but one that costs no
+    // lock, for skipping the work of preparing a task the pool would decline.
+    bool hasRoom();
+
+    // Returns once a submitted task has finished, running it here if no thread
+    // has started it yet.
+    void wait(Task& task);
+
+    // Takes a submitted task off the queue if no thread has started it yet.
+    bool cancel(Task& task);
+}
@@ -36,7 +36,9 @@ std::unique_ptr<SBlock> Parser::parseBlock() {
     auto blk = std::make_unique<SBlock>();
 
     while (cur().kind != TokKind::RBrace) {
+        int line = cur().line;
         blk->items.emplace_back(parseStmt());
+        blk->items.back()->line = line;
     }
 
     expect(TokKind::RBrace, "'}'");
@@ -178,22 +180,21 @@ ExprPtr Parser::parsePrimary() {
         lhs = std::make_unique<EInt>(cur().ival); ++i;
     } else if (cur().kind == TokKind::Float) {
         lhs = std::make_unique<EFloat>(cur().ival); ++i;
+    } else if (cur().kind == TokKind::String) {
+        lhs = std::make_unique<EStr>(cur().text); ++i;
     } else if (cur().kind == TokKind::Ident) {
         std::string name = cur().text; ++i;
 
         if (accept(TokKind::LParen)) {
-            std::vector<ExprPtr> args;
-
-            if (cur().kind != TokKind::RParen) {
-                args.emplace_back(parseExpr());
-                while (accept(TokKind::Comma)) args.emplace_back(parseExpr());
-            }
-
-            expect(TokKind::RParen, "')'");
-            lhs = std::make_unique<ECall>(name, std::move(args));
+            lhs = std::make_unique<ECall>(name, parseArgs());
         } else {
             lhs = std::make_unique<EVar>(name);
         }
+    } else if (accept(TokKind::KwSpawn)) {
+        std::string name = cur().text;
+        expect(TokKind::Ident, "function call after 'spawn'");
+        expect(TokKind::LParen, "'('");
+        lhs = std::make_unique<ESpawn>(name, parseArgs());
     } else if (accept(TokKind::LParen)) {
         lhs = parseExpr();
         expect(TokKind::RParen, "')'");
@@ -210,6 +211,19 @@ ExprPtr Parser::parsePrimary() {
     return lhs;
 }
 
+// After the '(' of a call, up to and including the ')'.
+std::vector<ExprPtr> Parser::parseArgs() {
+    std::vector<ExprPtr> args;
+
+    if (cur().kind != TokKind::RParen) {
+        args.emplace_back(parseExpr());
+        while (accept(TokKind::Comma)) args.emplace_back(parseExpr());
+    }
+
+    expect(TokKind::RParen, "')'");
+    return args;
+}
+
 ExprPtr Parser::parseExpr() {
     auto lhs = parsePrimary();
     return parseBinRhs(0, std::move(lhs));
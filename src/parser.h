@@ -10,7 +10,7 @@ struct Parser {
     std::unique_ptr<Module> parseModule();
 
 private:
-    const std::vector<Token>& ts;
+    std::vector<Token> ts;
     size_t i = 0;
 
     const Token& cur() const { return ts[i]; }
@@ -24,6 +24,7 @@ private:
     StmtPtr parseStmt();
     ExprPtr parseExpr();
     ExprPtr parsePrimary();
+    std::vector<ExprPtr> parseArgs();
     ExprPtr parseBinRhs(int minPrec, ExprPtr lhs);
     int precOf(TokKind k);
 };
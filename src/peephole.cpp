@@ -0,0 +1,519 @@
+#include "peephole.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    struct Insn {
+        Op op = Op::NOP;
+        std::array<uint8_t, 16> operands{};
+        size_t target = 0;
+        int line = 0;
+        bool isTarget = false;
+        bool dead = false;
+
+        uint32_t u32(size_t at) const {
+            uint32_t v;
+            std::memcpy(&v, &operands[at], 4);
+            return v;
+        }
+
+        int64_t i64(size_t at) const {
+            int64_t v;
+            std::memcpy(&v, &operands[at], 8);
+            return v;
+        }
+
+        void setU32(size_t at, uint32_t v) { std::memcpy(&operands[at], &v, 4); }
+        void setI64(size_t at, int64_t v) { std::memcpy(&operands[at], &v, 8); }
+    };
+
+    using Insns = std::vector<Insn>;
+}
+
+static Insn makeInsn(Op op) {
+    Insn x;
+    x.op = op;
+    return x;
+}
+
+static Insn makeConst(Op op, int64_t v) {
+    Insn x = makeInsn(op);
+    x.setI64(0, v);
+    return x;
+}
+
+// Replaces x in place; it stays a jump target and keeps its source line.
+static void rewrite(Insn& x, Insn with) {
+    with.isTarget = x.isTarget;
+    with.line = x.line;
+    x = with;
+}
+
+static bool isConst(const Insn& x) {
+    return x.op == Op::ICONST || x.op == Op::FCONST;
+}
+
+static bool isBranch(const Insn& x) {
+    return jumpOperand(x.op) >= 0;
+}
+
+static double asDouble(int64_t bits) {
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static int64_t asBits(double d) {
+    int64_t bits;
+    std::memcpy(&bits, &d, sizeof(d));
+    return bits;
+}
+
+// Line entries are still unpacked in prog.lines while a function is being generated.
+static int pendingLine(const Program& prog, size_t pc) {
+    auto it = std::upper_bound(prog.lines.begin(), prog.lines.end(), pc,
+                               [](size_t v, const LineEntry& e) { return v < e.pc; });
+    return it == prog.lines.begin() ? 0 : std::prev(it)->line;
+}
+
+static Insns decode(const Program& prog, const Function& fn) {
+    const auto& code = prog.code.buf;
+    const size_t none = std::numeric_limits<size_t>::max();
+
+    Insns out;
+    std::vector<size_t> index(fn.end - fn.entry + 1, none);
+
+    for (size_t ip = fn.entry; ip < fn.end;) {
+        Insn x = makeInsn(static_cast<Op>(code[ip]));
+        uint32_t n = operandBytes(x.op);
+        std::memcpy(x.operands.data(), &code[ip + 1], n);
+        x.line = pendingLine(prog, ip);
+
+        index[ip - fn.entry] = out.size();
+        out.emplace_back(x);
+        ip += 1 + n;
+    }
+    index[fn.end - fn.entry] = out.size();
+
+    for (auto& x : out) {
+        if (!isBranch(x)) continue;
+
+        size_t t = x.u32(static_cast<size_t>(jumpOperand(x.op)));
+        if (t < fn.entry || t > fn.end || index[t - fn.entry] == none) {
+            throw std::runtime_error("peephole: jump target outside of function " + fn.name);
+        }
+        x.target = index[t - fn.entry];
+    }
+
+    for (auto& x : out) {
+        if (isBranch(x) && x.target < out.size()) out[x.target].isTarget = true;
+    }
+    return out;
+}
+
+// Drops dead instructions. A jump to a removed instruction lands on the next one kept.
+static void compact(Insns& v) {
+    std::vector<size_t> remap(v.size() + 1);
+    size_t n = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        remap[i] = n;
+        if (!v[i].dead) ++n;
+    }
+    remap[v.size()] = n;
+
+    Insns out;
+    out.reserve(n);
+    for (auto& x : v) {
+        if (x.dead) continue;
+        out.emplace_back(x);
+        out.back().isTarget = false;
+        if (isBranch(x)) out.back().target = remap[x.target];
+    }
+
+    for (auto& x : out) {
+        if (isBranch(x) && x.target < out.size()) out[x.target].isTarget = true;
+    }
+    v.swap(out);
+}
+
+static void encode(Program& prog, Function& fn, Insns& v) {
+    std::vector<size_t> ipOf(v.size() + 1);
+    size_t ip = fn.entry;
+    for (size_t i = 0; i < v.size(); ++i) {
+        ipOf[i] = ip;
+        ip += 1 + operandBytes(v[i].op);
+    }
+    ipOf[v.size()] = ip;
+
+    auto& code = prog.code.buf;
+    code.resize(fn.entry);
+
+    auto& lines = prog.lines;
+    while (!lines.empty() && lines.back().pc >= fn.entry) lines.pop_back();
+
+    for (auto& x : v) {
+        prog.markLine(x.line);
+        if (isBranch(x)) {
+            x.setU32(static_cast<size_t>(jumpOperand(x.op)), static_cast<uint32_t>(ipOf[x.target]));
+        }
+        code.emplace_back(static_cast<uint8_t>(x.op));
+        code.insert(code.end(), x.operands.begin(), x.operands.begin() + operandBytes(x.op));
+    }
+    fn.end = code.size();
+}
+
+// Mirrors the interpreter exactly; anything that could trap is left for runtime.
+static bool foldBinary(Op op, int64_t a, int64_t b, Insn& out) {
+    auto ua = static_cast<uint64_t>(a);
+    auto ub = static_cast<uint64_t>(b);
+    double fa = asDouble(a);
+    double fb = asDouble(b);
+
+    auto icst = [&](int64_t v) { out = makeConst(Op::ICONST, v); return true; };
+    auto fcst = [&](double v) { out = makeConst(Op::FCONST, asBits(v)); return true; };
+
+    switch (op) {
+        case Op::IADD: return icst(static_cast<int64_t>(ua + ub));
+        case Op::ISUB: return icst(static_cast<int64_t>(ua - ub));
+        case Op::IMUL: return icst(static_cast<int64_t>(ua * ub));
+        case Op::IDIV:
+        case Op::IMOD:
+            if (b == 0 || (a == std::numeric_limits<int64_t>::min() && b == -1)) return false;
+            return icst(op == Op::IDIV ? a / b : a % b);
+
+        case Op::CMPLE: return icst(a <= b);
+        case Op::CMPLT: return icst(a < b);
+        case Op::CMPGE: return icst(a >= b);
+        case Op::CMPGT: return icst(a > b);
+        case Op::CMPEQ: return icst(a == b);
+        case Op::CMPNE: return icst(a != b);
+
+        case Op::IMIN: return icst(a < b ? a : b);
+        case Op::IMAX: return icst(a > b ? a : b);
+        case Op::IAND: return icst(a & b);
+        case Op::IOR:  return icst(a | b);
+        case Op::IXOR: return icst(a ^ b);
+        case Op::ISHL: return icst(static_cast<int64_t>(ua << (b & 63)));
+        case Op::ISHR: return icst(a >> (b & 63));
+
+        case Op::FADD: return fcst(fa + fb);
+        case Op::FSUB: return fcst(fa - fb);
+        case Op::FMUL: return fcst(fa * fb);
+        case Op::FDIV: return fcst(fa / fb);
+        case Op::FMIN: return fcst(fa < fb ? fa : fb);
+        case Op::FMAX: return fcst(fa > fb ? fa : fb);
+
+        case Op::FCMPLE: return icst(fa <= fb);
+        case Op::FCMPLT: return icst(fa < fb);
+        case Op::FCMPGE: return icst(fa >= fb);
+        case Op::FCMPGT: return icst(fa > fb);
+        case Op::FCMPEQ: return icst(fa == fb);
+        case Op::FCMPNE: return icst(fa != fb);
+
+        default: return false;
+    }
+}
+
+static bool foldUnary(Op op, int64_t a, Insn& out) {
+    switch (op) {
+        case Op::IABS:
+            out = makeConst(Op::ICONST, a < 0 ? static_cast<int64_t>(0 - static_cast<uint64_t>(a)) : a);
+            return true;
+        case Op::FABS:
+            out = makeConst(Op::FCONST, a & std::numeric_limits<int64_t>::max());
+            return true;
+        case Op::FSQRT:
+            out = makeConst(Op::FCONST, asBits(std::sqrt(asDouble(a))));
+            return true;
+        case Op::FFLOOR:
+            out = makeConst(Op::FCONST, asBits(std::floor(asDouble(a))));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool foldConstants(Insns& v) {
+    bool changed = false;
+    for (size_t i = 0; i + 1 < v.size(); ++i) {
+        if (!isConst(v[i])) continue;
+
+        Insn r;
+        if (!v[i + 1].isTarget && foldUnary(v[i + 1].op, v[i].i64(0), r)) {
+            rewrite(v[i], r);
+            v[i + 1].dead = true;
+            changed = true;
+            ++i;
+            continue;
+        }
+
+        if (i + 2 < v.size() && isConst(v[i + 1]) && !v[i + 1].isTarget && !v[i + 2].isTarget &&
+            foldBinary(v[i + 2].op, v[i].i64(0), v[i + 1].i64(0), r)) {
+            rewrite(v[i], r);
+            v[i + 1].dead = true;
+            v[i + 2].dead = true;
+            changed = true;
+            i += 2;
+        }
+    }
+    return changed;
+}
+
+// A local stored exactly once, from a constant, on the straight-line path from
+// the entry and never read before that store, holds the constant at every load.
+static bool propagateConstants(Insns& v) {
+    std::vector<int> stores;
+    std::vector<size_t> storeAt;
+    auto grow = [&](uint32_t slot) {
+        if (slot >= stores.size()) {
+            stores.resize(slot + 1, 0);
+            storeAt.resize(slot + 1, 0);
+        }
+    };
+
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (v[i].op == Op::STORE || v[i].op == Op::INC_LOCAL) {
+            uint32_t slot = v[i].u32(0);
+            grow(slot);
+            stores[slot]++;
+            storeAt[slot] = i;
+        }
+    }
+
+    size_t prefix = 0;
+    while (prefix < v.size() && !isBranch(v[prefix]) &&
+           v[prefix].op != Op::RET && v[prefix].op != Op::TAILCALL && v[prefix].op != Op::HALT) {
+        ++prefix;
+    }
+
+    bool changed = false;
+    for (uint32_t slot = 0; slot < stores.size(); ++slot) {
+        size_t at = storeAt[slot];
+        if (stores[slot] != 1 || at == 0 || at >= prefix) continue;
+        if (v[at].op != Op::STORE || v[at].isTarget || !isConst(v[at - 1])) continue;
+
+        bool readEarly = false;
+        for (size_t i = 0; i < at && !readEarly; ++i) {
+            readEarly = v[i].op == Op::LOAD && v[i].u32(0) == slot;
+        }
+        if (readEarly) continue;
+
+        for (size_t i = at + 1; i < v.size(); ++i) {
+            if (v[i].op == Op::LOAD && v[i].u32(0) == slot) {
+                rewrite(v[i], v[at - 1]);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// `c; JMP_IF_FALSE t` becomes `JMP t` or disappears.
+static bool foldBranches(Insns& v) {
+    bool changed = false;
+    for (size_t i = 0; i + 1 < v.size(); ++i) {
+        if (!isConst(v[i]) || v[i + 1].op != Op::JMP_IF_FALSE || v[i + 1].isTarget) continue;
+
+        if (v[i].i64(0) == 0) {
+            v[i + 1].op = Op::JMP;
+        } else {
+            v[i + 1].dead = true;
+        }
+        v[i].dead = true;
+        changed = true;
+        ++i;
+    }
+    return changed;
+}
+
+// `LOAD x; ICONST k; IADD; STORE x` (and the ISUB and `k + x` forms) becomes `INC_LOCAL x, k`.
+static bool fuseIncrements(Insns& v) {
+    bool changed = false;
+    for (size_t i = 0; i + 3 < v.size(); ++i) {
+        const Insn& st = v[i + 3];
+        if (st.op != Op::STORE || v[i + 1].isTarget || v[i + 2].isTarget || st.isTarget) continue;
+
+        uint32_t slot = st.u32(0);
+        Op arith = v[i + 2].op;
+        int64_t k = 0;
+
+        if (v[i].op == Op::LOAD && v[i].u32(0) == slot && isConst(v[i + 1]) &&
+            (arith == Op::IADD || arith == Op::ISUB)) {
+            k = v[i + 1].i64(0);
+            if (arith == Op::ISUB) k = static_cast<int64_t>(0 - static_cast<uint64_t>(k));
+        } else if (isConst(v[i]) && v[i + 1].op == Op::LOAD && v[i + 1].u32(0) == slot && arith == Op::IADD) {
+            k = v[i].i64(0);
+        } else {
+            continue;
+        }
+
+        Insn inc = makeInsn(Op::INC_LOCAL);
+        inc.setU32(0, slot);
+        inc.setI64(4, k);
+        rewrite(v[i], inc);
+        v[i + 1].dead = true;
+        v[i + 2].dead = true;
+        v[i + 3].dead = true;
+        changed = true;
+        i += 3;
+    }
+    return changed;
+}
+
+// Values pushed only to be popped, and jumps to the next instruction.
+static bool dropNoops(Insns& v) {
+    bool changed = false;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (v[i].op == Op::JMP && v[i].target == i + 1) {
+            v[i].dead = true;
+            changed = true;
+            continue;
+        }
+
+        if (i + 1 < v.size() && (isConst(v[i]) || v[i].op == Op::LOAD) &&
+            v[i + 1].op == Op::POP && !v[i + 1].isTarget) {
+            v[i].dead = true;
+            v[i + 1].dead = true;
+            changed = true;
+            ++i;
+        }
+    }
+    return changed;
+}
+
+static Op negateCompare(Op cmp) {
+    switch (cmp) {
+        case Op::CMPLT: return Op::CMPGE;
+        case Op::CMPLE: return Op::CMPGT;
+        case Op::CMPGT: return Op::CMPLE;
+        case Op::CMPGE: return Op::CMPLT;
+        case Op::CMPEQ: return Op::CMPNE;
+        case Op::CMPNE: return Op::CMPEQ;
+        default:        return cmp;
+    }
+}
+
+// `k < x` is `x > k`, for floats as well since swapping operands keeps NaN unordered.
+static Op swapCompare(Op cmp) {
+    switch (cmp) {
+        case Op::CMPLT:  return Op::CMPGT;
+        case Op::CMPLE:  return Op::CMPGE;
+        case Op::CMPGT:  return Op::CMPLT;
+        case Op::CMPGE:  return Op::CMPLE;
+        case Op::FCMPLT: return Op::FCMPGT;
+        case Op::FCMPLE: return Op::FCMPGE;
+        case Op::FCMPGT: return Op::FCMPLT;
+        case Op::FCMPGE: return Op::FCMPLE;
+        default:         return cmp;
+    }
+}
+
+static Op compareBranch(Op cmp, bool withConst) {
+    switch (cmp) {
+        case Op::CMPLT: return withConst ? Op::JLT_LOCAL_CONST : Op::JLT_LOCALS;
+        case Op::CMPLE: return withConst ? Op::JLE_LOCAL_CONST : Op::JLE_LOCALS;
+        case Op::CMPGT: return withConst ? Op::JGT_LOCAL_CONST : Op::JGT_LOCALS;
+        case Op::CMPGE: return withConst ? Op::JGE_LOCAL_CONST : Op::JGE_LOCALS;
+        case Op::CMPEQ: return withConst ? Op::JEQ_LOCAL_CONST : Op::JEQ_LOCALS;
+        case Op::CMPNE: return withConst ? Op::JNE_LOCAL_CONST : Op::JNE_LOCALS;
+        case Op::FCMPLT: return withConst ? Op::FJNLT_LOCAL_CONST : Op::FJNLT_LOCALS;
+        case Op::FCMPLE: return withConst ? Op::FJNLE_LOCAL_CONST : Op::FJNLE_LOCALS;
+        case Op::FCMPGT: return withConst ? Op::FJNGT_LOCAL_CONST : Op::FJNGT_LOCALS;
+        case Op::FCMPGE: return withConst ? Op::FJNGE_LOCAL_CONST : Op::FJNGE_LOCALS;
+        case Op::FCMPEQ: return withConst ? Op::FJNEQ_LOCAL_CONST : Op::FJNEQ_LOCALS;
+        case Op::FCMPNE: return withConst ? Op::FJNNE_LOCAL_CONST : Op::FJNNE_LOCALS;
+        default: return Op::NOP;
+    }
+}
+
+// `LOAD a; LOAD b | CONST k; CMPxx; JMP_IF_FALSE t` becomes a single compare-and-branch
+// on the negated integer comparison (floats branch on the original one failing), and
+// `ICONST 0; CMPEQ/CMPNE; JMP_IF_FALSE t` becomes JNE_ZERO t or a plain JMP_IF_FALSE t.
+static void fuseCompareBranches(Insns& v) {
+    for (size_t i = 0; i + 2 < v.size(); ++i) {
+        if (i + 3 < v.size() && v[i + 3].op == Op::JMP_IF_FALSE &&
+            !v[i + 1].isTarget && !v[i + 2].isTarget && !v[i + 3].isTarget) {
+            Op cmp = v[i + 2].op;
+            bool isFloat = cmp >= Op::FCMPLE && cmp <= Op::FCMPNE;
+            bool withConst = true;
+            uint32_t slot = 0;
+            int64_t rhs = 0;
+
+            if (v[i].op == Op::LOAD && v[i + 1].op == Op::LOAD) {
+                slot = v[i].u32(0);
+                rhs = v[i + 1].u32(0);
+                withConst = false;
+            } else if (v[i].op == Op::LOAD && isConst(v[i + 1])) {
+                slot = v[i].u32(0);
+                rhs = v[i + 1].i64(0);
+            } else if (isConst(v[i]) && v[i + 1].op == Op::LOAD) {
+                slot = v[i + 1].u32(0);
+                rhs = v[i].i64(0);
+                cmp = swapCompare(cmp);
+            } else {
+                cmp = Op::NOP;
+            }
+
+            Op fused = compareBranch(isFloat ? cmp : negateCompare(cmp), withConst);
+            if (fused != Op::NOP) {
+                Insn br = makeInsn(fused);
+                br.setU32(4, slot);
+                if (withConst) {
+                    br.setI64(8, rhs);
+                } else {
+                    br.setU32(8, static_cast<uint32_t>(rhs));
+                }
+                br.target = v[i + 3].target;
+                rewrite(v[i], br);
+                v[i + 1].dead = true;
+                v[i + 2].dead = true;
+                v[i + 3].dead = true;
+                i += 3;
+                continue;
+            }
+        }
+
+        if (v[i].op == Op::ICONST && v[i].i64(0) == 0 && v[i + 2].op == Op::JMP_IF_FALSE &&
+            (v[i + 1].op == Op::CMPEQ || v[i + 1].op == Op::CMPNE) &&
+            !v[i + 1].isTarget && !v[i + 2].isTarget) {
+            Insn br = makeInsn(v[i + 1].op == Op::CMPEQ ? Op::JNE_ZERO : Op::JMP_IF_FALSE);
+            br.target = v[i + 2].target;
+            rewrite(v[i], br);
+            v[i + 1].dead = true;
+            v[i + 2].dead = true;
+            i += 2;
+        }
+    }
+}
+
+void optimizeFunction(Program& prog, Function& fn) {
+    if (fn.end != prog.code.buf.size()) {
+        throw std::runtime_error("peephole: function " + fn.name + " is not the last one emitted");
+    }
+
+    Insns v = decode(prog, fn);
+
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        changed |= propagateConstants(v);
+        compact(v);
+        changed |= foldConstants(v);
+        compact(v);
+        changed |= foldBranches(v);
+        compact(v);
+        changed |= fuseIncrements(v);
+        compact(v);
+        changed |= dropNoops(v);
+        compact(v);
+    }
+
+    fuseCompareBranches(v);
+    compact(v);
+
+    encode(prog, fn, v);
+}
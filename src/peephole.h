@@ -0,0 +1,8 @@
+#pragma once
+
+#include "bytecode.h"
+
+// Constant folding and peephole rewrites over the code of one function. `fn` must
+// be the last function emitted into `prog.code`; its code is re-encoded in place
+// and fn.end, every jump target inside it and its line table entries are updated.
+void optimizeFunction(Program& prog, Function& fn);
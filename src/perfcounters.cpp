@@ -0,0 +1,192 @@
+#include "perfcounters.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+static const char* const kEventNames[PerfCounters::kEvents] = {
+    "cycles", "instructions", "branch-misses", "cache-misses"
+};
+
+static uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+#ifdef __linux__
+
+static int openEvent(uint64_t config, int groupFd) {
+    perf_event_attr attr {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = groupFd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+PerfCounters::PerfCounters(const Program* p) : prog(p) {
+    static const uint64_t configs[kEvents] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    fds.fill(-1);
+    slot.fill(-1);
+    for (int e = 0; e < kEvents; ++e) {
+        int fd = openEvent(configs[e], leader);
+        if (fd < 0) {
+            if (openError.empty()) openError = std::string(kEventNames[e]) + ": " + std::strerror(errno);
+            continue;
+        }
+        if (leader < 0) leader = fd;
+        fds[e] = fd;
+        slot[e] = opened++;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+// A group read is nr, time_enabled, time_running, then one value per member.
+static bool readGroup(int fd, int members, uint64_t (&buf)[3 + PerfCounters::kEvents]) {
+    return read(fd, buf, sizeof(buf)) >= static_cast<ssize_t>(sizeof(uint64_t) * static_cast<size_t>(3 + members));
+}
+
+PerfCounters::Values PerfCounters::snapshot() const {
+    Values v{};
+    uint64_t buf[3 + kEvents] = {};
+    if (leader < 0 || !readGroup(leader, opened, buf)) return v;
+    for (int e = 0; e < kEvents; ++e) {
+        if (slot[e] >= 0) v[e] = buf[3 + slot[e]];
+    }
+    return v;
+}
+
+void PerfCounters::start() {
+    if (leader < 0) return;
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    startNs = nowNs();
+    runBegin = snapshot();
+}
+
+void PerfCounters::stop() {
+    if (leader < 0) return;
+    Values end = snapshot();
+    elapsedNs = nowNs() - startNs;
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (int e = 0; e < kEvents; ++e) runTotal[e] = end[e] - runBegin[e];
+
+    // Counts are extrapolated when the kernel had to multiplex the group.
+    uint64_t buf[3 + kEvents] = {};
+    if (readGroup(leader, opened, buf) && buf[2] && buf[2] < buf[1]) {
+        scale = static_cast<double>(buf[1]) / static_cast<double>(buf[2]);
+    }
+}
+
+#else
+
+PerfCounters::PerfCounters(const Program* p) : prog(p) {
+    fds.fill(-1);
+    slot.fill(-1);
+    openError = "hardware counters need Linux perf_event_open";
+}
+
+PerfCounters::~PerfCounters() {}
+
+PerfCounters::Values PerfCounters::snapshot() const {
+    return Values{};
+}
+
+void PerfCounters::start() {}
+
+void PerfCounters::stop() {}
+
+#endif
+
+void PerfCounters::enter(uint32_t funcId) {
+    active.push_back({funcId, snapshot(), Values{}});
+}
+
+void PerfCounters::leave() {
+    Values end = snapshot();
+    Active a = active.back();
+    active.pop_back();
+
+    if (a.funcId >= functions.size()) functions.resize(a.funcId + 1);
+    Totals& t = functions[a.funcId];
+    t.calls++;
+
+    Values spent{};
+    for (int e = 0; e < kEvents; ++e) {
+        spent[e] = end[e] - a.begin[e];
+        t.self[e] += spent[e] - std::min(spent[e], a.children[e]);
+    }
+    if (!active.empty()) {
+        for (int e = 0; e < kEvents; ++e) active.back().children[e] += spent[e];
+    }
+}
+
+void PerfCounters::write(std::ostream& out, const std::string& label) const {
+    auto scaled = [&](uint64_t v) { return static_cast<uint64_t>(static_cast<double>(v) * scale); };
+    auto ratio = [](uint64_t a, uint64_t b) { return b ? static_cast<double>(a) / static_cast<double>(b) : 0.0; };
+
+    out << "# perf counters: " << label << " (user space)\n";
+    if (!available()) {
+        out << "  unavailable: " << openError << "\n";
+        return;
+    }
+
+    out << std::fixed;
+    for (int e = 0; e < kEvents; ++e) {
+        out << std::setw(18);
+        if (slot[e] < 0) out << "<not supported>"; else out << scaled(runTotal[e]);
+        out << "  " << kEventNames[e];
+        if (e == Instructions && slot[Cycles] >= 0 && slot[e] >= 0) {
+            out << "  # " << std::setprecision(2) << ratio(runTotal[e], runTotal[Cycles]) << " per cycle";
+        }
+        if (e == BranchMisses && slot[Instructions] >= 0 && slot[e] >= 0) {
+            out << "  # " << std::setprecision(2) << 1000.0 * ratio(runTotal[e], runTotal[Instructions]) << " per 1k instructions";
+        }
+        out << "\n";
+    }
+    out << std::setw(18) << std::setprecision(3) << static_cast<double>(elapsedNs) / 1e6 << "  ms elapsed";
+    if (scale != 1.0) out << "  # multiplexed, counts scaled by " << std::setprecision(2) << scale;
+    out << "\n";
+
+    if (!perFunction) return;
+
+    std::vector<uint32_t> order;
+    for (uint32_t f = 0; f < functions.size(); ++f) {
+        if (functions[f].calls) order.emplace_back(f);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return functions[a].self[Cycles] > functions[b].self[Cycles];
+    });
+
+    out << "\n# compiled functions (self, excluding compiled callees)\n";
+    out << "          calls            cycles      instructions   IPC     branch-misses      cache-misses  function\n";
+    for (uint32_t f : order) {
+        const Totals& t = functions[f];
+        out << std::setw(15) << t.calls << std::setw(18) << t.self[Cycles] << std::setw(18) << t.self[Instructions]
+            << std::setw(6) << std::setprecision(2) << ratio(t.self[Instructions], t.self[Cycles])
+            << std::setw(18) << t.self[BranchMisses] << std::setw(18) << t.self[CacheMisses]
+            << "  " << prog->funcs[f].name << "\n";
+    }
+    if (order.empty()) out << "  (no compiled calls)\n";
+}
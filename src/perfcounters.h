@@ -0,0 +1,67 @@
+#pragma once
+
+#include "bytecode.h"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Hardware counters for the calling thread via Linux perf_event_open, user space
+// only. All events are opened as one group so a snapshot is a single read().
+// With per-function accounting, runtime_call_function brackets every compiled
+// call and each function is charged what it ran minus what its callees ran.
+struct PerfCounters {
+    enum Event { Cycles, Instructions, BranchMisses, CacheMisses, kEvents };
+    using Values = std::array<uint64_t, kEvents>;
+
+    explicit PerfCounters(const Program* prog);
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // False when no event could be opened; `error` says why.
+    bool available() const { return leader >= 0; }
+    const std::string& error() const { return openError; }
+
+    void start();
+    void stop();
+
+    bool perFunction = false;
+
+    void enter(uint32_t funcId);
+    void leave();
+
+    void write(std::ostream& out, const std::string& label) const;
+
+private:
+    struct Active {
+        uint32_t funcId;
+        Values begin;
+        Values children;
+    };
+
+    struct Totals {
+        uint64_t calls = 0;
+        Values self{};
+    };
+
+    Values snapshot() const;
+
+    const Program* prog;
+    int leader = -1;
+    std::array<int, kEvents> fds;
+    std::array<int, kEvents> slot;   // position of each event in a group read, or -1
+    int opened = 0;
+    std::string openError;
+
+    Values runBegin{};
+    Values runTotal{};
+    double scale = 1.0;
+    uint64_t elapsedNs = 0;
+    uint64_t startNs = 0;
+
+    std::vector<Active> active;
+    std::vector<Totals> functions;
+};
@@ -0,0 +1,184 @@
+#include "profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <chrono>
+#else
+#include <csignal>
+#include <sys/time.h>
+#endif
+
+static std::atomic<Profiler*> activeProfiler{nullptr};
+
+Profiler::Profiler(const Program* p) : prog(p), pool(new uint32_t[kPoolWords]) {}
+
+Profiler::~Profiler() {
+    stop();
+}
+
+void Profiler::onSignal(int) {
+    if (Profiler* p = activeProfiler.load(std::memory_order_acquire)) p->sample();
+}
+
+void Profiler::sample() {
+    uint32_t d = depth.load(std::memory_order_acquire);
+    uint32_t n = std::min(d, kMaxDepth);
+    if (used + 2 + n > kPoolWords) {
+        dropped++;
+        return;
+    }
+
+    pool[used] = d;
+    pool[used + 1] = ip.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < n; ++i) {
+        pool[used + 2 + i] = frames[i].load(std::memory_order_relaxed);
+    }
+    used += 2 + n;
+    samples++;
+}
+
+void Profiler::start() {
+    if (running) return;
+
+    Profiler* expected = nullptr;
+    if (!activeProfiler.compare_exchange_strong(expected, this)) {
+        throw std::runtime_error("profiler: another profiler is already running");
+    }
+    running = true;
+
+#ifdef _WIN32
+    stopping.store(false);
+    sampler = std::thread([this] {
+        while (!stopping.load(std::memory_order_relaxed)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(kIntervalUs));
+            sample();
+        }
+    });
+#else
+    struct sigaction sa {};
+    sa.sa_handler = &Profiler::onSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, nullptr);
+
+    itimerval timer {};
+    timer.it_interval.tv_usec = kIntervalUs;
+    timer.it_value.tv_usec = kIntervalUs;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+}
+
+void Profiler::stop() {
+    if (!running) return;
+
+#ifdef _WIN32
+    stopping.store(true);
+    sampler.join();
+#else
+    itimerval timer {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+#endif
+
+    activeProfiler.store(nullptr, std::memory_order_release);
+    running = false;
+}
+
+void Profiler::write(const std::string& path) const {
+    const size_t nfuncs = prog->funcs.size();
+    std::vector<uint64_t> self(nfuncs, 0);
+    std::vector<uint64_t> total(nfuncs, 0);
+    std::vector<uint64_t> seenIn(nfuncs, 0);
+    std::map<std::pair<uint32_t, int>, uint64_t> lineSelf;
+    std::map<std::string, uint64_t> stacks;
+    uint64_t outside = 0;
+    uint64_t sampleNo = 0;
+
+    auto frameName = [&](uint32_t frame) {
+        std::string name = prog->funcs[frame & ~kCompiledBit].name;
+        return (frame & kCompiledBit) ? name + "_[j]" : name;
+    };
+
+    for (size_t at = 0; at < used;) {
+        uint32_t d = pool[at];
+        uint32_t pc = pool[at + 1];
+        uint32_t n = std::min(d, kMaxDepth);
+        const uint32_t* fr = &pool[at + 2];
+        at += 2 + n;
+        sampleNo++;
+
+        if (n == 0) {
+            outside++;
+            continue;
+        }
+
+        std::string stack;
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t fid = fr[i] & ~kCompiledBit;
+            if (seenIn[fid] != sampleNo) {
+                seenIn[fid] = sampleNo;
+                total[fid]++;
+            }
+            if (i) stack += ';';
+            stack += frameName(fr[i]);
+        }
+        if (d > n) stack += ";[truncated]";
+        stacks[stack]++;
+
+        // The leaf of a truncated stack is unknown. Only interpreted frames publish
+        // an ip; compiled ones are attributed to line 0.
+        if (d == n) {
+            uint32_t leaf = fr[n - 1];
+            uint32_t fid = leaf & ~kCompiledBit;
+            self[fid]++;
+            lineSelf[{fid, (leaf & kCompiledBit) ? 0 : prog->funcs[fid].lineAt(pc)}]++;
+        }
+    }
+
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("cannot open: " + path);
+
+    auto pct = [&](uint64_t v) {
+        return samples ? 100.0 * static_cast<double>(v) / static_cast<double>(samples) : 0.0;
+    };
+
+    out << "# samples: " << samples << " (" << kIntervalUs << " us interval)";
+    if (dropped) out << ", dropped: " << dropped;
+    if (outside) out << ", outside any function: " << outside;
+    out << "\n";
+
+    out << "\n# functions\n";
+    out << "   self%  total%        self       total  function\n";
+    std::vector<uint32_t> order;
+    for (uint32_t f = 0; f < nfuncs; ++f) {
+        if (total[f]) order.emplace_back(f);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return self[a] != self[b] ? self[a] > self[b] : total[a] > total[b];
+    });
+    out << std::fixed << std::setprecision(2);
+    for (uint32_t f : order) {
+        out << std::setw(8) << pct(self[f]) << std::setw(8) << pct(total[f])
+            << std::setw(12) << self[f] << std::setw(12) << total[f] << "  " << prog->funcs[f].name << "\n";
+    }
+
+    out << "\n# lines\n";
+    out << "   self%        self  location\n";
+    std::vector<std::pair<uint64_t, std::pair<uint32_t, int>>> lines;
+    for (auto& [key, count] : lineSelf) lines.emplace_back(count, key);
+    std::sort(lines.begin(), lines.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (auto& [count, key] : lines) {
+        out << std::setw(8) << pct(count) << std::setw(12) << count << "  " << prog->funcs[key.first].name << ":";
+        if (key.second) out << key.second; else out << "?";
+        out << "\n";
+    }
+
+    std::ofstream folded(path + ".folded");
+    if (!folded) throw std::runtime_error("cannot open: " + path + ".folded");
+    for (auto& [stack, count] : stacks) folded << stack << " " << count << "\n";
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "bytecode.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#include <thread>
+#endif
+
+// Sampling profiler. The interpreter and runtime_call_function keep a shadow
+// call stack here, and the interpreter publishes the ip it is executing. A
+// SIGPROF interval timer (a sampling thread on Windows) copies both into a
+// preallocated buffer, so taking a sample never allocates or locks.
+struct Profiler {
+    static constexpr uint32_t kMaxDepth = 1024;
+    static constexpr uint32_t kIntervalUs = 1000;
+
+    explicit Profiler(const Program* prog);
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    void start();
+    void stop();
+
+    void enter(uint32_t funcId, bool compiled) {
+        uint32_t d = depth.load(std::memory_order_relaxed);
+        if (d < kMaxDepth) frames[d].store(funcId | (compiled ? kCompiledBit : 0), std::memory_order_relaxed);
+        depth.store(d + 1, std::memory_order_release);
+    }
+
+    void leave() {
+        depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    // For callers that drop frames without leaving them, as when an error unwinds.
+    uint32_t level() const { return depth.load(std::memory_order_relaxed); }
+    void unwindTo(uint32_t d) { depth.store(d, std::memory_order_release); }
+
+    void at(size_t pc) {
+        ip.store(static_cast<uint32_t>(pc), std::memory_order_relaxed);
+    }
+
+    // Flat profiles by function and by source line go to `path`, collapsed stacks
+    // (one `a;b;c count` line per distinct stack, for flamegraph.pl) to `path`.folded.
+    void write(const std::string& path) const;
+
+private:
+    static constexpr uint32_t kCompiledBit = 1u << 31;
+    static constexpr size_t kPoolWords = size_t(1) << 22;
+
+    void sample();
+    static void onSignal(int);
+
+    const Program* prog;
+
+    std::atomic<uint32_t> depth{0};
+    std::atomic<uint32_t> ip{0};
+    std::array<std::atomic<uint32_t>, kMaxDepth> frames{};
+
+    // Samples are laid out as [depth, ip, frame 0 .. frame depth-1].
+    std::unique_ptr<uint32_t[]> pool;
+    size_t used = 0;
+    uint64_t samples = 0;
+    uint64_t dropped = 0;
+    bool running = false;
+
+#ifdef _WIN32
+    std::thread sampler;
+    std::atomic<bool> stopping{false};
+#endif
+};
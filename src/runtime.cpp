@@ -1,33 +1,61 @@
 #include "runtime.h"
+#include "bigint.h"
+#include "mapfile.h"
+#include "parallel.h"
+#include "perfcounters.h"
+#include "profiler.h"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstring>
-#include <iomanip>
-#include <iostream>
-#include <random>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RETURN_ADDRESS() _ReturnAddress()
+#else
+#define RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+// Remembers which call in compiled code reached the failing helper, so VM::run
+// can report the source line.
+[[noreturn]] static void fail(VM* vm, const void* site, const char* msg) {
+    vm->faultSite = site;
+    throw std::runtime_error(msg);
+}
 
-void runtime_print(int64_t v) {
-    std::cout << v << std::endl;
+void runtime_print(VM* vm, int64_t v) {
+    vm->output.writeInt(v);
+    vm->output.put('\n');
 }
 
-void runtime_print_f_bits(int64_t bits) {
+void runtime_print_f_bits(VM* vm, int64_t bits) {
     double x = 0.0;
     std::memcpy(&x, &bits, sizeof(double));
+    vm->output.writeDouble(x);
+    vm->output.put('\n');
+}
 
-    std::ios::fmtflags f = std::cout.flags();
-    std::streamsize p = std::cout.precision();
-
-    std::cout.setf(std::ios::fmtflags(0), std::ios::floatfield);
-    std::cout.precision(17);
-    std::cout << x << std::endl;
+void runtime_print_array(VM* vm, int64_t handle) {
+    if (!VM::isArrayHandle(handle, vm->arrays.size())) {
+        fail(vm, RETURN_ADDRESS(), "PRINT_ARRAY: invalid array handle");
+    }
+    const auto& arr = vm->arrays[VM::handleToId(handle)];
+    vm->output.writeInts(arr.data, arr.size);
+}
 
-    std::cout.flags(f);
-    std::cout.precision(p);
+void runtime_flush(VM* vm) {
+    vm->output.flush();
 }
 
-int64_t runtime_array_new(VM* vm, int64_t size) {
-    if (size < 0) throw std::runtime_error("ARRAY_NEW: negative size");
+// Counts an allocation towards the next collection and picks a free slot in the
+// array table, stamped with the task level. The caller fills in the rest.
+static size_t newArraySlot(VM* vm) {
+    if (vm->allocError) throw std::runtime_error(vm->allocError);
+    vm->arraySnapshot.reset();
 
     vm->allocCount++;
     if (vm->allocCount >= vm->gcThreshold) {
@@ -39,58 +67,247 @@ int64_t runtime_array_new(VM* vm, int64_t size) {
     if (!vm->freeList.empty()) {
         arr_id = vm->freeList.back();
         vm->freeList.pop_back();
-        vm->arrays[arr_id].data = std::vector<int64_t>(static_cast<size_t>(size), 0);
-        vm->arrays[arr_id].marked = false;
     } else {
-        arr_id = vm->arrays.size();
-        VM::Array arr;
-        arr.data = std::vector<int64_t>(static_cast<size_t>(size), 0);
-        arr.marked = false;
-        vm->arrays.emplace_back(arr);
+        arr_id = vm->newArrayId();
     }
+    vm->arrays[arr_id].level = vm->taskLevel;
+    vm->arrays[arr_id].born = vm->allocations++;
+    return arr_id;
+}
+
+int64_t runtime_array_new(VM* vm, int64_t size) {
+    if (size < 0) fail(vm, RETURN_ADDRESS(), "ARRAY_NEW: negative size");
+
+    size_t arr_id = newArraySlot(vm);
+    auto& arr = vm->arrays[arr_id];
+    arr.data = vm->heap.allocate(static_cast<size_t>(size));
+    arr.size = static_cast<size_t>(size);
+    arr.marked = false;
+    arr.bigint = false;
+    arr.mapped = false;
 
     return VM::idToHandle(arr_id);
 }
 
+// A bigint is an array only so that the GC manages it. Scripts may read its limbs
+// but not write them, so the limb count it starts with stays consistent.
+static void checkWritable(VM* vm, const void* site, const VM::Array& arr, const char* op) {
+    if (arr.bigint) fail(vm, site, (std::string(op) + ": cannot write to a bigint").c_str());
+}
+
+// An array allocated by a task is the task's until it returns, so it may only be
+// stored in arrays at its own level or deeper. One stored in an array the GC
+// leaves alone for queued tasks is remembered, or nothing would keep it alive.
+static void checkStore(VM* vm, const void* site, const VM::Array& into, int64_t v, const char* op) {
+    bool pinned = into.born < vm->pinnedBelow;
+    if ((into.level >= vm->taskLevel && !pinned) || !VM::isArrayHandle(v, vm->arrays.size())) return;
+
+    const auto& arr = vm->arrays[VM::handleToId(v)];
+    if (arr.level > into.level) {
+        fail(vm, site, (std::string(op) + ": array would outlive the task that allocated it").c_str());
+    }
+    if (pinned && arr.born >= vm->pinnedBelow) vm->remembered.emplace_back(v);
+}
+
 int64_t runtime_array_get(VM* vm, int64_t handle, int64_t idx) {
     if (!VM::isArrayHandle(handle, vm->arrays.size())) {
-        throw std::runtime_error("ARRAY_GET: invalid array handle");
+        fail(vm, RETURN_ADDRESS(), "ARRAY_GET: invalid array handle");
     }
 
     size_t arr_id = VM::handleToId(handle);
-    auto& arr = vm->arrays[arr_id].data;
+    auto& arr = vm->arrays[arr_id];
 
-    if (idx < 0 || static_cast<size_t>(idx) >= arr.size()) {
-        throw std::runtime_error("ARRAY_GET: index out of bounds");
+    if (idx < 0 || static_cast<size_t>(idx) >= arr.size) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_GET: index out of bounds");
     }
 
-    return arr[static_cast<size_t>(idx)];
+    return arr.data[static_cast<size_t>(idx)];
 }
 
 void runtime_array_set(VM* vm, int64_t handle, int64_t idx, int64_t val) {
     if (!VM::isArrayHandle(handle, vm->arrays.size())) {
-        throw std::runtime_error("ARRAY_SET: invalid array handle");
+        fail(vm, RETURN_ADDRESS(), "ARRAY_SET: invalid array handle");
     }
 
     size_t arr_id = VM::handleToId(handle);
-    auto& arr = vm->arrays[arr_id].data;
+    auto& arr = vm->arrays[arr_id];
 
-    if (idx < 0 || static_cast<size_t>(idx) >= arr.size()) {
-        throw std::runtime_error("ARRAY_SET: index out of bounds");
+    if (idx < 0 || static_cast<size_t>(idx) >= arr.size) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_SET: index out of bounds");
     }
+    checkWritable(vm, RETURN_ADDRESS(), arr, "ARRAY_SET");
+    checkStore(vm, RETURN_ADDRESS(), arr, val, "ARRAY_SET");
 
-    arr[static_cast<size_t>(idx)] = val;
+    arr.data[static_cast<size_t>(idx)] = val;
 }
 
 int64_t runtime_array_len(VM* vm, int64_t handle) {
     if (!VM::isArrayHandle(handle, vm->arrays.size())) {
-        throw std::runtime_error("ARRAY_LEN: invalid array handle");
+        fail(vm, RETURN_ADDRESS(), "ARRAY_LEN: invalid array handle");
     }
 
     size_t arr_id = VM::handleToId(handle);
-    return static_cast<int64_t>(vm->arrays[arr_id].data.size());
+    return static_cast<int64_t>(vm->arrays[arr_id].size);
+}
+
+void runtime_array_fill(VM* vm, int64_t handle, int64_t from, int64_t to, int64_t val) {
+    if (!VM::isArrayHandle(handle, vm->arrays.size())) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_FILL: invalid array handle");
+    }
+
+    auto& arr = vm->arrays[VM::handleToId(handle)];
+    if (from < 0 || to < from || static_cast<size_t>(to) > arr.size) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_FILL: range out of bounds");
+    }
+    checkWritable(vm, RETURN_ADDRESS(), arr, "ARRAY_FILL");
+    checkStore(vm, RETURN_ADDRESS(), arr, val, "ARRAY_FILL");
+
+    int64_t* p = arr.data + from;
+    size_t n = static_cast<size_t>(to - from);
+    if (val == 0) {
+        std::memset(p, 0, n * sizeof(int64_t));
+    } else {
+        std::fill_n(p, n, val);
+    }
+}
+
+void runtime_array_copy(VM* vm, int64_t dst, int64_t dpos, int64_t src, int64_t spos, int64_t n) {
+    if (!VM::isArrayHandle(dst, vm->arrays.size()) || !VM::isArrayHandle(src, vm->arrays.size())) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_COPY: invalid array handle");
+    }
+
+    auto& d = vm->arrays[VM::handleToId(dst)];
+    auto& s = vm->arrays[VM::handleToId(src)];
+    if (n < 0 || dpos < 0 || spos < 0 ||
+        static_cast<size_t>(dpos) > d.size || static_cast<size_t>(n) > d.size - static_cast<size_t>(dpos) ||
+        static_cast<size_t>(spos) > s.size || static_cast<size_t>(n) > s.size - static_cast<size_t>(spos)) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_COPY: range out of bounds");
+    }
+    checkWritable(vm, RETURN_ADDRESS(), d, "ARRAY_COPY");
+    if ((d.level < vm->taskLevel && s.level > d.level) || (d.born < vm->pinnedBelow && s.born >= vm->pinnedBelow)) {
+        for (int64_t i = 0; i < n; ++i) checkStore(vm, RETURN_ADDRESS(), d, s.data[spos + i], "ARRAY_COPY");
+    }
+
+    std::memmove(d.data + dpos, s.data + spos, static_cast<size_t>(n) * sizeof(int64_t));
+}
+
+int64_t runtime_array_slice(VM* vm, int64_t handle, int64_t from, int64_t to) {
+    if (!VM::isArrayHandle(handle, vm->arrays.size())) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_SLICE: invalid array handle");
+    }
+
+    size_t src_id = VM::handleToId(handle);
+    if (from < 0 || to < from || static_cast<size_t>(to) > vm->arrays[src_id].size) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_SLICE: range out of bounds");
+    }
+
+    int64_t out = runtime_array_new(vm, to - from);
+
+    // runtime_array_new may grow vm->arrays, so look both entries up afterwards.
+    const auto& s = vm->arrays[src_id];
+    auto& d = vm->arrays[VM::handleToId(out)];
+    std::memcpy(d.data, s.data + from, static_cast<size_t>(to - from) * sizeof(int64_t));
+
+    return out;
+}
+
+int64_t runtime_array_equal(VM* vm, int64_t a, int64_t b) {
+    if (!VM::isArrayHandle(a, vm->arrays.size()) || !VM::isArrayHandle(b, vm->arrays.size())) {
+        fail(vm, RETURN_ADDRESS(), "ARRAY_EQUAL: invalid array handle");
+    }
+
+    const auto& x = vm->arrays[VM::handleToId(a)];
+    const auto& y = vm->arrays[VM::handleToId(b)];
+    if (x.size != y.size) return 0;
+
+    return std::memcmp(x.data, y.data, x.size * sizeof(int64_t)) == 0 ? 1 : 0;
+}
+
+static int64_t* checkedSpan(VM* vm, const void* site, int64_t handle, int64_t from, int64_t to, bool write = false) {
+    if (to <= from) return nullptr;
+
+    if (!VM::isArrayHandle(handle, vm->arrays.size())) {
+        fail(vm, site, "ARRAY_GET: invalid array handle");
+    }
+
+    auto& arr = vm->arrays[VM::handleToId(handle)];
+    if (from < 0 || static_cast<size_t>(to) > arr.size) {
+        fail(vm, site, "ARRAY_GET: index out of bounds");
+    }
+    if (write) checkWritable(vm, site, arr, "ARRAY_MAP");
+
+    return arr.data + from;
+}
+
+// Element range [from, to) of an array, checked the way the per-element loop it
+// replaces would have been. Returns nullptr for an empty range.
+int64_t* runtime_array_span(VM* vm, int64_t handle, int64_t from, int64_t to) {
+    return checkedSpan(vm, RETURN_ADDRESS(), handle, from, to);
+}
+
+// The same for a range the caller is going to overwrite.
+int64_t* runtime_array_span_mut(VM* vm, int64_t handle, int64_t from, int64_t to) {
+    return checkedSpan(vm, RETURN_ADDRESS(), handle, from, to, true);
 }
 
+int64_t runtime_array_sum(VM* vm, int64_t handle, int64_t from, int64_t to) {
+    const int64_t* p = checkedSpan(vm, RETURN_ADDRESS(), handle, from, to);
+    if (!p) return 0;
+
+    uint64_t s = 0;
+    for (int64_t i = 0; i < to - from; ++i) s += static_cast<uint64_t>(p[i]);
+    return static_cast<int64_t>(s);
+}
+
+int64_t runtime_array_count(VM* vm, int64_t handle, int64_t from, int64_t to, int64_t k, Op cmp) {
+    const int64_t* p = checkedSpan(vm, RETURN_ADDRESS(), handle, from, to);
+    if (!p) return 0;
+
+    int64_t n = to - from;
+    int64_t c = 0;
+    switch (cmp) {
+        case Op::CMPEQ: for (int64_t i = 0; i < n; ++i) c += p[i] == k; break;
+        case Op::CMPNE: for (int64_t i = 0; i < n; ++i) c += p[i] != k; break;
+        case Op::CMPLT: for (int64_t i = 0; i < n; ++i) c += p[i] < k;  break;
+        case Op::CMPLE: for (int64_t i = 0; i < n; ++i) c += p[i] <= k; break;
+        case Op::CMPGT: for (int64_t i = 0; i < n; ++i) c += p[i] > k;  break;
+        case Op::CMPGE: for (int64_t i = 0; i < n; ++i) c += p[i] >= k; break;
+        default: throw std::runtime_error("ARRAY_COUNT: bad comparison");
+    }
+    return c;
+}
+
+template <typename T, typename F>
+static void mapSpan(int64_t* p, int64_t n, int64_t v, F f) {
+    T y;
+    std::memcpy(&y, &v, sizeof(T));
+    for (int64_t i = 0; i < n; ++i) {
+        T x;
+        std::memcpy(&x, &p[i], sizeof(T));
+        x = f(x, y);
+        std::memcpy(&p[i], &x, sizeof(T));
+    }
+}
+
+void runtime_array_map(VM* vm, int64_t handle, int64_t from, int64_t to, int64_t v, Op op) {
+    int64_t* p = checkedSpan(vm, RETURN_ADDRESS(), handle, from, to, true);
+    if (!p) return;
+
+    int64_t n = to - from;
+    switch (op) {
+        case Op::IADD: mapSpan<uint64_t>(p, n, v, [](uint64_t x, uint64_t y) { return x + y; }); break;
+        case Op::ISUB: mapSpan<uint64_t>(p, n, v, [](uint64_t x, uint64_t y) { return x - y; }); break;
+        case Op::IMUL: mapSpan<uint64_t>(p, n, v, [](uint64_t x, uint64_t y) { return x * y; }); break;
+        case Op::FADD: mapSpan<double>(p, n, v, [](double x, double y) { return x + y; }); break;
+        case Op::FSUB: mapSpan<double>(p, n, v, [](double x, double y) { return x - y; }); break;
+        case Op::FMUL: mapSpan<double>(p, n, v, [](double x, double y) { return x * y; }); break;
+        case Op::FDIV: mapSpan<double>(p, n, v, [](double x, double y) { return x / y; }); break;
+        default: throw std::runtime_error("ARRAY_MAP: bad operator");
+    }
+}
+
+static constexpr size_t kSmallFrame = 64;
+
 int64_t runtime_call_function(VM* vm, uint32_t func_id, int64_t* args, uint32_t argc) {
     if (func_id >= vm->prog->funcs.size()) {
         throw std::runtime_error("CALL: invalid function ID");
@@ -112,26 +329,37 @@ int64_t runtime_call_function(VM* vm, uint32_t func_id, int64_t* args, uint32_t
         );
     }
 
-    std::vector<int64_t> locals(func.nlocals, 0);
+    // Locals and operand stack share one block, on the native stack unless it is big.
+    size_t cap = func.maxStack ? func.maxStack : 1024;
+    size_t slots = func.nlocals + cap;
+    int64_t small[kSmallFrame];
+    std::unique_ptr<int64_t[]> big;
+    int64_t* locals = small;
+    if (slots > kSmallFrame) {
+        big.reset(new int64_t[slots]);
+        locals = big.get();
+    }
+    std::fill_n(locals, func.nlocals, 0);
     for (uint32_t i = 0; i < argc && i < func.arity; ++i) {
         locals[i] = args[i];
     }
 
-    size_t cap = func.maxStack ? func.maxStack : 1024;
-    std::unique_ptr<int64_t[]> stack(new int64_t[cap]);
-
     JITContext ctx;
-    ctx.locals = locals.data();
-    ctx.stack = stack.get();
+    ctx.locals = locals;
+    ctx.stack = locals + func.nlocals;
     ctx.stack_size = 0;
     ctx.vm = vm;
 
     size_t locals_size = func.nlocals;
 
-    vm->rootStacks.push_back({locals.data(), &locals_size});
-    vm->rootStacks.push_back({stack.get(), &ctx.stack_size});
+    vm->rootStacks.push_back({locals, &locals_size});
+    vm->rootStacks.push_back({ctx.stack, &ctx.stack_size});
 
+    if (vm->profiler) vm->profiler->enter(func_id, true);
+    if (vm->perfCounters) vm->perfCounters->enter(func_id);
     int64_t result = jitFunc(&ctx);
+    if (vm->perfCounters) vm->perfCounters->leave();
+    if (vm->profiler) vm->profiler->leave();
 
     vm->rootStacks.pop_back();
     vm->rootStacks.pop_back();
@@ -139,42 +367,362 @@ int64_t runtime_call_function(VM* vm, uint32_t func_id, int64_t* args, uint32_t
     return result;
 }
 
-int64_t runtime_time_ms() {
-    using clock = std::chrono::steady_clock;
-
-    static const auto t0 = clock::now();
-    auto now = clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - t0).count();
+int64_t runtime_time_ms(VM* vm) {
+    auto now = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - vm->startTime).count();
 
     return static_cast<int64_t>(ms);
 }
 
-int64_t runtime_rand() {
-    static std::random_device rd;
-    static std::mt19937_64 gen(rd());
-    return static_cast<int64_t>(gen() & 0x7FFFFFFFFFFFFFFFLL);
+int64_t runtime_rand(VM* vm) {
+    return static_cast<int64_t>(vm->rng() & 0x7FFFFFFFFFFFFFFFLL);
 }
 
 void runtime_print_big(VM* vm, int64_t handle, int64_t len) {
-    if (handle >= 0) throw std::runtime_error("PRINT_BIG: invalid array handle");
-    size_t id = static_cast<size_t>(-handle - 1);
-    if (id >= vm->arrays.size()) throw std::runtime_error("PRINT_BIG: invalid array id");
+    if (!Tagged::isArray(handle)) fail(vm, RETURN_ADDRESS(), "PRINT_BIG: invalid array handle");
+    size_t id = VM::handleToId(handle);
+    if (id >= vm->arrays.size()) fail(vm, RETURN_ADDRESS(), "PRINT_BIG: invalid array id");
 
-    auto& a = vm->arrays[id].data;
-    if (len < 0) throw std::runtime_error("PRINT_BIG: negative len");
-    if (static_cast<size_t>(len) > a.size()) throw std::runtime_error("PRINT_BIG: len out of bounds");
+    const int64_t* a = vm->arrays[id].data;
+    if (len < 0) fail(vm, RETURN_ADDRESS(), "PRINT_BIG: negative len");
+    if (static_cast<size_t>(len) > vm->arrays[id].size) fail(vm, RETURN_ADDRESS(), "PRINT_BIG: len out of bounds");
 
-    const int64_t baseDigits = 9;
+    const size_t baseDigits = 9;
     int64_t i = len - 1;
     while (i > 0 && a[static_cast<size_t>(i)] == 0) --i;
 
-    std::cout << a[static_cast<size_t>(i)];
+    auto& out = vm->output;
+    out.writeInt(a[static_cast<size_t>(i)]);
     for (i = i - 1; i >= 0; --i) {
-        std::cout << std::setw(baseDigits) << std::setfill('0') << a[static_cast<size_t>(i)];
-        if (i == 0) break;
+        std::string limb = std::to_string(a[static_cast<size_t>(i)]);
+        if (limb.size() < baseDigits) out.write(std::string(baseDigits - limb.size(), '0'));
+        out.write(limb);
     }
-    std::cout << std::endl;
+    out.put('\n');
 }
+
+// A bigint is an array of [signed limb count, limb 0, limb 1, ...]; the sign of
+// the count is the sign of the number.
+static BigInt::Mag bigOperand(VM* vm, const void* site, int64_t handle, Op op, bool& neg) {
+    if (!VM::isArrayHandle(handle, vm->arrays.size()) || !vm->arrays[VM::handleToId(handle)].bigint) {
+        fail(vm, site, (std::string(opName(op)) + ": not a bigint").c_str());
+    }
+
+    const auto& arr = vm->arrays[VM::handleToId(handle)];
+    int64_t n = arr.size ? arr.data[0] : 0;
+    neg = n < 0;
+    uint64_t count = neg ? 0 - static_cast<uint64_t>(n) : static_cast<uint64_t>(n);
+    if (!arr.size || count > arr.size - 1) fail(vm, site, (std::string(opName(op)) + ": corrupt bigint").c_str());
+
+    const auto* limbs = reinterpret_cast<const BigInt::Limb*>(arr.data + 1);
+    return BigInt::Mag(limbs, limbs + count);
+}
+
+// Operands must still be reachable from the caller's stack: this allocates.
+static int64_t bigResult(VM* vm, const BigInt::Mag& mag, bool neg) {
+    int64_t n = static_cast<int64_t>(mag.size());
+    int64_t out = runtime_array_new(vm, n + 1);
+
+    auto& arr = vm->arrays[VM::handleToId(out)];
+    arr.bigint = true;
+    arr.data[0] = neg && n ? -n : n;
+    if (n) std::memcpy(arr.data + 1, mag.data(), mag.size() * sizeof(BigInt::Limb));
+    return out;
+}
+
+int64_t runtime_bigint(VM* vm, int64_t v) {
+    uint64_t mag = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+    return bigResult(vm, BigInt::fromU64(mag), v < 0);
+}
+
+int64_t runtime_big_binary(VM* vm, int64_t a, int64_t b, Op op) {
+    const void* site = RETURN_ADDRESS();
+    bool an, bn;
+    BigInt::Mag x = bigOperand(vm, site, a, op, an);
+    BigInt::Mag y = bigOperand(vm, site, b, op, bn);
+
+    switch (op) {
+        case Op::BIG_ADD:
+        case Op::BIG_SUB: {
+            if (op == Op::BIG_SUB) bn = !bn;
+            if (an == bn) return bigResult(vm, BigInt::add(x, y), an);
+            int c = BigInt::compare(x, y);
+            if (c >= 0) return bigResult(vm, BigInt::sub(x, y), an);
+            return bigResult(vm, BigInt::sub(y, x), bn);
+        }
+
+        case Op::BIG_MUL:
+            return bigResult(vm, BigInt::mul(x, y), an != bn);
+
+        case Op::BIG_DIV:
+        case Op::BIG_MOD: {
+            if (y.empty()) fail(vm, site, (std::string(opName(op)) + ": division by zero").c_str());
+            BigInt::Mag q, r;
+            BigInt::divmod(x, y, q, r);
+            return op == Op::BIG_DIV ? bigResult(vm, q, an != bn) : bigResult(vm, r, an);
+        }
+
+        case Op::BIG_CMP: {
+            if (x.empty() && y.empty()) return 0;
+            if (an != bn) return an ? -1 : 1;
+            int c = BigInt::compare(x, y);
+            return an ? -c : c;
+        }
+
+        default:
+            throw std::runtime_error("BIGINT: bad operator");
+    }
+}
+
+void runtime_print_bigint(VM* vm, int64_t handle) {
+    bool neg;
+    BigInt::Mag x = bigOperand(vm, RETURN_ADDRESS(), handle, Op::PRINT_BIGINT, neg);
+    if (neg) vm->output.put('-');
+    vm->output.write(BigInt::toString(x));
+    vm->output.put('\n');
+}
+
+static int64_t readInt(VM* vm, const void* site, const char* op) {
+    int64_t v = 0;
+    switch (vm->input.readInt(v)) {
+        case InputSource::Status::Ok:        return v;
+        case InputSource::Status::End:       fail(vm, site, (std::string(op) + ": end of input").c_str());
+        case InputSource::Status::Malformed: fail(vm, site, (std::string(op) + ": malformed integer").c_str());
+    }
+    return 0;
+}
+
+static int64_t readFloatBits(VM* vm, const void* site, const char* op) {
+    double v = 0.0;
+    switch (vm->input.readDouble(v)) {
+        case InputSource::Status::Ok:        break;
+        case InputSource::Status::End:       fail(vm, site, (std::string(op) + ": end of input").c_str());
+        case InputSource::Status::Malformed: fail(vm, site, (std::string(op) + ": malformed number").c_str());
+    }
+    int64_t bits = 0;
+    std::memcpy(&bits, &v, sizeof(double));
+    return bits;
+}
+
+int64_t runtime_read_int(VM* vm) {
+    return readInt(vm, RETURN_ADDRESS(), "READ_INT");
+}
+
+int64_t runtime_read_float_bits(VM* vm) {
+    return readFloatBits(vm, RETURN_ADDRESS(), "READ_FLOAT");
+}
+
+int64_t runtime_read_ints(VM* vm, int64_t n) {
+    const void* site = RETURN_ADDRESS();
+    if (n < 0) fail(vm, site, "READ_INTS: negative count");
+    int64_t out = runtime_array_new(vm, n);
+    int64_t* p = vm->arrays[VM::handleToId(out)].data;
+    for (int64_t i = 0; i < n; ++i) p[i] = readInt(vm, site, "READ_INTS");
+    return out;
+}
+
+int64_t runtime_read_floats(VM* vm, int64_t n) {
+    const void* site = RETURN_ADDRESS();
+    if (n < 0) fail(vm, site, "READ_FLOATS: negative count");
+    int64_t out = runtime_array_new(vm, n);
+    int64_t* p = vm->arrays[VM::handleToId(out)].data;
+    for (int64_t i = 0; i < n; ++i) p[i] = readFloatBits(vm, site, "READ_FLOATS");
+    return out;
+}
+
+int64_t runtime_eof(VM* vm) {
+    return vm->input.atEnd() ? 1 : 0;
+}
+
+static const std::string& pathArg(VM* vm, const void* site, int64_t index, const char* op) {
+    if (index < 0 || static_cast<size_t>(index) >= vm->prog->strings.size()) {
+        fail(vm, site, (std::string(op) + ": invalid path").c_str());
+    }
+    return vm->prog->strings[static_cast<size_t>(index)];
+}
+
+int64_t runtime_map_array(VM* vm, int64_t path, int64_t n) {
+    const void* site = RETURN_ADDRESS();
+    const std::string& file = pathArg(vm, site, path, "MAP_ARRAY");
+    if (n < 0) fail(vm, site, "MAP_ARRAY: negative size");
+    if (vm->allocError) fail(vm, site, vm->allocError);
+
+    int64_t* data = nullptr;
+    try {
+        data = mapArrayFile(file, static_cast<size_t>(n));
+    } catch (const std::runtime_error& e) {
+        fail(vm, site, (std::string("MAP_ARRAY: ") + e.what()).c_str());
+    }
+    if (!data) return runtime_array_new(vm, 0);
+
+    // The slot is taken after mapping, so a GC run here cannot see a half-made array.
+    size_t arr_id = newArraySlot(vm);
+    auto& arr = vm->arrays[arr_id];
+    arr.data = data;
+    arr.size = static_cast<size_t>(n);
+    arr.marked = false;
+    arr.bigint = false;
+    arr.mapped = true;
+
+    return VM::idToHandle(arr_id);
+}
+
+void runtime_save_array(VM* vm, int64_t path, int64_t handle) {
+    const void* site = RETURN_ADDRESS();
+    const std::string& file = pathArg(vm, site, path, "SAVE_ARRAY");
+    if (!VM::isArrayHandle(handle, vm->arrays.size())) fail(vm, site, "SAVE_ARRAY: invalid array handle");
+
+    const auto& arr = vm->arrays[VM::handleToId(handle)];
+    try {
+        saveArrayFile(file, arr.data, arr.size);
+    } catch (const std::runtime_error& e) {
+        fail(vm, site, (std::string("SAVE_ARRAY: ") + e.what()).c_str());
+    }
+}
+
+// Chunk boundaries depend only on the range, so fn sees the same calls and the
+// chunk results and output are merged in the same order on any machine.
+static constexpr size_t kParallelChunks = 256;
+
+static const char* const kParallelAllocError = "parallel_for: fn may not allocate arrays";
+
+int64_t runtime_parallel_for(VM* vm, const int64_t* args) {
+    const void* site = RETURN_ADDRESS();
+    int64_t lo = args[0];
+    int64_t hi = args[1];
+    int64_t ctx = args[3];
+    if (args[2] < 0 || static_cast<uint64_t>(args[2]) >= vm->prog->funcs.size()) {
+        fail(vm, site, "PARALLEL_FOR: invalid function");
+    }
+    auto fid = static_cast<uint32_t>(args[2]);
+    if (hi <= lo) return 0;
+
+    uint64_t n = static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo);
+    size_t chunks = static_cast<size_t>(std::min<uint64_t>(n, kParallelChunks));
+    uint64_t step = n / chunks;
+    uint64_t extra = n % chunks;
+    auto bound = [&](size_t k) {
+        return static_cast<int64_t>(static_cast<uint64_t>(lo) + k * step + std::min<uint64_t>(k, extra));
+    };
+
+    std::vector<int64_t> results(chunks, 0);
+    std::vector<std::string> outputs(chunks);
+    std::vector<std::unique_ptr<VM>> workers(std::min(chunks, WorkPool::width()));
+
+    // Worker output is kept per chunk and appended in chunk order; their input is empty.
+    auto body = [&](size_t k, size_t slot) {
+        auto& w = workers[slot];
+        if (!w) {
+            w = std::make_unique<VM>(vm->prog, vm->jit);
+            w->arrays = vm->arrays;
+            w->allocError = kParallelAllocError;
+            w->startTime = vm->startTime;
+            w->output.toMemory();
+            w->input.fromMemory("");
+        }
+
+        int64_t chunkArgs[3] = {bound(k), bound(k + 1), ctx};
+        results[k] = w->call(fid, chunkArgs, 3);
+        outputs[k] = w->output.memory();
+        w->output.clearMemory();
+    };
+
+    std::string error;
+    try {
+        WorkPool::run(chunks, workers.size(), body);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+
+    // The tables are the parent's: nothing of them is freed or unmapped with the workers.
+    for (auto& w : workers) {
+        if (w) w->arrays.clear();
+    }
+    for (auto& out : outputs) vm->output.write(out);
+    if (!error.empty()) fail(vm, site, error.c_str());
+
+    uint64_t sum = 0;
+    for (int64_t r : results) sum += static_cast<uint64_t>(r);
+    return static_cast<int64_t>(sum);
+}
+
+// Queued when the pool has room; otherwise run here and now, which is the
+// sequential cutoff. Either way the task's output appears at its join. Run
+// inline, a task still costs about as much as two calls: its output is captured
+// and its outcome goes through the task table. A fib that spawns one of its two
+// recursive calls runs about twice as long on one core as plain recursion, so
+// spawns belong above a cutoff of the program's own.
+int64_t runtime_spawn(VM* vm, uint32_t func_id, const int64_t* args, uint32_t argc) {
+    if (func_id >= vm->prog->funcs.size()) fail(vm, RETURN_ADDRESS(), "SPAWN: invalid function");
+
+    std::shared_ptr<VM::Task> task;
+    if (vm->spareTasks.empty()) {
+        task = std::make_shared<VM::Task>();
+    } else {
+        task = std::move(vm->spareTasks.back());
+        vm->spareTasks.pop_back();
+    }
+    task->funcId = func_id;
+    task->args.assign(args, args + argc);
+
+    if (WorkPool::hasRoom()) {
+        if (!vm->arraySnapshot) vm->arraySnapshot = std::make_shared<const std::vector<VM::Array>>(vm->arrays);
+        bool firstIds = !vm->arrayIds;
+        if (firstIds) vm->arrayIds = std::make_shared<std::atomic<size_t>>(vm->arrays.size());
+        task->prog = vm->prog;
+        task->jit = vm->jit;
+        task->arrays = vm->arraySnapshot;
+        task->arrayIds = vm->arrayIds;
+        task->startTime = vm->startTime;
+        task->level = vm->taskLevel + 1;
+        task->queued = WorkPool::submit(task);
+        if (task->queued) {
+            vm->queuedTasks++;
+            vm->pinnedBelow = vm->allocations;
+        } else if (firstIds) {
+            vm->arrayIds.reset();
+        }
+    }
+    if (!task->queued) vm->runInline(*task);
+
+    size_t slot;
+    if (!vm->freeTasks.empty() && vm->freeTasks.back() >= vm->taskBase) {
+        slot = vm->freeTasks.back();
+        vm->freeTasks.pop_back();
+        vm->tasks[slot] = std::move(task);
+    } else {
+        slot = vm->tasks.size();
+        vm->tasks.emplace_back(std::move(task));
+    }
+    return static_cast<int64_t>(slot);
+}
+
+int64_t runtime_join(VM* vm, int64_t handle) {
+    const void* site = RETURN_ADDRESS();
+    if (handle < 0 || static_cast<uint64_t>(handle) < vm->taskBase || static_cast<uint64_t>(handle) >= vm->tasks.size() ||
+        !vm->tasks[static_cast<size_t>(handle)]) {
+        fail(vm, site, "JOIN: invalid task handle");
+    }
+
+    auto task = std::move(vm->tasks[static_cast<size_t>(handle)]);
+    vm->freeTasks.emplace_back(static_cast<size_t>(handle));
+
+    if (task->queued) {
+        WorkPool::wait(*task);
+        if (!task->returned.empty()) vm->adoptReturned(*task);
+        vm->queuedTaskDone();
+    }
+    vm->output.write(task->output);
+    if (!task->error.empty()) fail(vm, site, task->error.c_str());
+
+    int64_t result = task->result;
+    if (!task->queued) {
+        task->output.clear();
+        vm->spareTasks.emplace_back(std::move(task));
+    }
+    return result;
+}
+
 int64_t runtime_sqrt_bits(int64_t x_bits) {
     double x = 0.0;
     std::memcpy(&x, &x_bits, sizeof(double));
@@ -183,3 +731,12 @@ int64_t runtime_sqrt_bits(int64_t x_bits) {
     std::memcpy(&y_bits, &y, sizeof(double));
     return y_bits;
 }
+
+int64_t runtime_floor_bits(int64_t x_bits) {
+    double x = 0.0;
+    std::memcpy(&x, &x_bits, sizeof(double));
+    double y = std::floor(x);
+    int64_t y_bits = 0;
+    std::memcpy(&y_bits, &y, sizeof(double));
+    return y_bits;
+}
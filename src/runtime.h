@@ -3,18 +3,52 @@
 
 #include "VM.h"
 
-void runtime_print(int64_t v);
-void runtime_print_f_bits(int64_t bits);
+void runtime_print(VM* vm, int64_t v);
+void runtime_print_f_bits(VM* vm, int64_t bits);
+void runtime_print_array(VM* vm, int64_t arr_id);
+void runtime_flush(VM* vm);
+
+int64_t runtime_read_int(VM* vm);
+int64_t runtime_read_float_bits(VM* vm);
+int64_t runtime_read_ints(VM* vm, int64_t n);
+int64_t runtime_read_floats(VM* vm, int64_t n);
+int64_t runtime_eof(VM* vm);
+
+int64_t runtime_map_array(VM* vm, int64_t path, int64_t n);
+void runtime_save_array(VM* vm, int64_t path, int64_t arr_id);
+
+// args: lo, hi, function id, ctx.
+int64_t runtime_parallel_for(VM* vm, const int64_t* args);
+
+// spawn f(args) and join(handle).
+int64_t runtime_spawn(VM* vm, uint32_t func_id, const int64_t* args, uint32_t argc);
+int64_t runtime_join(VM* vm, int64_t handle);
 
 int64_t runtime_array_new(VM* vm, int64_t size);
 int64_t runtime_array_get(VM* vm, int64_t arr_id, int64_t idx);
 void runtime_array_set(VM* vm, int64_t arr_id, int64_t idx, int64_t val);
 int64_t runtime_array_len(VM* vm, int64_t arr_id);
 
+void runtime_array_fill(VM* vm, int64_t arr_id, int64_t from, int64_t to, int64_t val);
+void runtime_array_copy(VM* vm, int64_t dst_id, int64_t dpos, int64_t src_id, int64_t spos, int64_t n);
+int64_t runtime_array_slice(VM* vm, int64_t arr_id, int64_t from, int64_t to);
+int64_t runtime_array_equal(VM* vm, int64_t a_id, int64_t b_id);
+
+int64_t* runtime_array_span(VM* vm, int64_t arr_id, int64_t from, int64_t to);
+int64_t* runtime_array_span_mut(VM* vm, int64_t arr_id, int64_t from, int64_t to);
+int64_t runtime_array_sum(VM* vm, int64_t arr_id, int64_t from, int64_t to);
+int64_t runtime_array_count(VM* vm, int64_t arr_id, int64_t from, int64_t to, int64_t k, Op cmp);
+void runtime_array_map(VM* vm, int64_t arr_id, int64_t from, int64_t to, int64_t v, Op op);
+
 int64_t runtime_call_function(VM* vm, uint32_t func_id, int64_t* args, uint32_t argc);
 
-int64_t runtime_time_ms();
-int64_t runtime_rand();
+int64_t runtime_time_ms(VM* vm);
+int64_t runtime_rand(VM* vm);
 
 int64_t runtime_sqrt_bits(int64_t x_bits);
+int64_t runtime_floor_bits(int64_t x_bits);
 void runtime_print_big(VM* vm, int64_t handle, int64_t len);
+
+int64_t runtime_bigint(VM* vm, int64_t v);
+int64_t runtime_big_binary(VM* vm, int64_t a, int64_t b, Op op);
+void runtime_print_bigint(VM* vm, int64_t handle);
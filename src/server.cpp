@@ -0,0 +1,348 @@
+#include "server.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+
+void serve(const std::string&, unsigned, bool, size_t) {
+    throw std::runtime_error("--serve is not supported on Windows");
+}
+
+void runRemote(const std::string&, const std::string&, const std::string&) {
+    throw std::runtime_error("--connect is not supported on Windows");
+}
+
+#else
+
+#include "ast.h"
+#include "lexer.h"
+#include "parser.h"
+#include "vm.h"
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+// Request: u32 path length and the absolute script path. The client's input and
+// output descriptors ride along with the first byte as SCM_RIGHTS.
+// Reply: i32 status (0 ok, 1 failed), u32 message length and the error message.
+static constexpr uint32_t kMaxPath = 4096;
+static constexpr size_t kMaxScripts = 256;
+
+namespace {
+
+    struct CachedScript {
+        std::string path;
+        std::string source;
+        Program prog;
+        std::shared_ptr<JITCompiler> jit;
+    };
+
+    class ScriptCache {
+    public:
+        explicit ScriptCache(bool enableJit) : enableJit(enableJit) {}
+
+        // The script at path as it is on disk now. Compiled outside the lock, so a
+        // slow compile holds up no other request.
+        std::shared_ptr<const CachedScript> get(const std::string& path) {
+            std::ifstream f(path, std::ios::binary);
+            if (!f) throw std::runtime_error("cannot open: " + path);
+            std::ostringstream ss;
+            ss << f.rdbuf();
+            std::string source = ss.str();
+
+            uint64_t key = hash(path, source);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                auto it = scripts.find(key);
+                if (it != scripts.end() && it->second->path == path && it->second->source == source) return it->second;
+            }
+
+            auto s = std::make_shared<CachedScript>();
+            s->path = path;
+            s->source = source;
+            Lexer lx(std::move(source));
+            Parser ps(lx.lex());
+            auto mod = ps.parseModule();
+            s->prog.sourceName = path;
+            mod->gen(s->prog);
+            if (enableJit) s->jit = std::make_shared<JITCompiler>();
+
+            // Scripts still running keep their entry alive after it is dropped here.
+            std::lock_guard<std::mutex> lock(m);
+            if (scripts.size() >= kMaxScripts && !scripts.count(key)) scripts.erase(scripts.begin());
+            scripts[key] = s;
+            return s;
+        }
+
+    private:
+        // FNV-1a over the path, a separator and the source.
+        static uint64_t hash(const std::string& path, const std::string& source) {
+            uint64_t h = 0xcbf29ce484222325ull;
+            auto mix = [&h](const std::string& s) {
+                for (unsigned char c : s) h = (h ^ c) * 0x100000001b3ull;
+            };
+            mix(path);
+            mix(std::string(1, '\0'));
+            mix(source);
+            return h;
+        }
+
+        bool enableJit;
+        std::mutex m;
+        std::unordered_map<uint64_t, std::shared_ptr<const CachedScript>> scripts;
+    };
+}
+
+static std::string lastError() {
+    return std::strerror(errno);
+}
+
+static bool readAll(int fd, void* p, size_t n) {
+    auto* b = static_cast<char*>(p);
+    while (n > 0) {
+        ssize_t r = read(fd, b, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        b += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* p, size_t n) {
+    auto* b = static_cast<const char*>(p);
+    while (n > 0) {
+        ssize_t w = write(fd, b, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        b += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+static sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+static bool receiveRequest(int conn, std::string& path, int (&fds)[2]) {
+    uint32_t len = 0;
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control{};
+
+    iovec iov{&len, sizeof(len)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (i < 2) {
+                fds[i] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    size_t got = static_cast<size_t>(n);
+    if (got < sizeof(len) && !readAll(conn, reinterpret_cast<char*>(&len) + got, sizeof(len) - got)) return false;
+    if (fds[0] < 0 || fds[1] < 0 || len == 0 || len > kMaxPath) return false;
+    path.resize(len);
+    return readAll(conn, &path[0], len);
+}
+
+static void handle(int conn, ScriptCache& cache, size_t gcThreshold) {
+    int fds[2] = {-1, -1};
+    std::string path;
+    int32_t status = 1;
+    std::string error;
+
+    if (!receiveRequest(conn, path, fds)) {
+        error = "bad request";
+    } else {
+        try {
+            auto script = cache.get(path);
+            VM vm(&script->prog, script->jit);
+            vm.gcThreshold = gcThreshold;
+            vm.input.fromFd(fds[0]);
+            vm.output.toFd(fds[1]);
+            vm.run("main");
+            status = 0;
+        } catch (const std::exception& ex) {
+            error = ex.what();
+        }
+    }
+
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+
+    auto len = static_cast<uint32_t>(error.size());
+    if (writeAll(conn, &status, sizeof(status)) && writeAll(conn, &len, sizeof(len))) {
+        writeAll(conn, error.data(), error.size());
+    }
+    close(conn);
+}
+
+void serve(const std::string& socketPath, unsigned threads, bool enableJit, size_t gcThreshold) {
+    sockaddr_un addr = socketAddress(socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("socket: " + lastError());
+
+    // A socket left behind by an earlier server is replaced; any other file is not.
+    struct stat st {};
+    if (lstat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socketPath.c_str());
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        std::string err = lastError();
+        close(fd);
+        throw std::runtime_error("cannot listen on " + socketPath + ": " + err);
+    }
+
+    // A client that goes away mid-run makes writes to its stdout fail instead.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Shared with the workers, which are never joined.
+    struct Queue {
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<int> pending;
+    };
+    auto queue = std::make_shared<Queue>();
+    auto cache = std::make_shared<ScriptCache>(enableJit);
+
+    for (unsigned t = 0; t < threads; ++t) {
+        std::thread([queue, cache, gcThreshold] {
+            for (;;) {
+                int conn;
+                {
+                    std::unique_lock<std::mutex> lock(queue->m);
+                    queue->cv.wait(lock, [&] { return !queue->pending.empty(); });
+                    conn = queue->pending.front();
+                    queue->pending.pop_front();
+                }
+                handle(conn, *cache, gcThreshold);
+            }
+        }).detach();
+    }
+
+    for (;;) {
+        int conn = accept(fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // Out of descriptors, most likely: wait for running jobs to release some.
+            std::cerr << "accept: " << lastError() << "\n";
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue->m);
+            queue->pending.emplace_back(conn);
+        }
+        queue->cv.notify_one();
+    }
+}
+
+void runRemote(const std::string& socketPath, const std::string& script, const std::string& inputPath) {
+    // The server resolves paths from its own working directory.
+    char resolved[PATH_MAX];
+    if (!realpath(script.c_str(), resolved)) throw std::runtime_error("cannot open: " + script);
+    std::string path = resolved;
+    if (path.size() > kMaxPath) throw std::runtime_error("path too long: " + path);
+
+    int in = 0;
+    if (!inputPath.empty()) {
+        in = open(inputPath.c_str(), O_RDONLY);
+        if (in < 0) throw std::runtime_error("cannot open: " + inputPath);
+    }
+
+    sockaddr_un addr = socketAddress(socketPath);
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0 || connect(conn, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::string err = lastError();
+        if (conn >= 0) close(conn);
+        if (in != 0) close(in);
+        throw std::runtime_error("cannot connect to " + socketPath + ": " + err);
+    }
+
+    std::string request(sizeof(uint32_t), '\0');
+    auto len = static_cast<uint32_t>(path.size());
+    std::memcpy(&request[0], &len, sizeof(len));
+    request += path;
+
+    int fds[2] = {in, 1};
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control{};
+
+    iovec iov{&request[0], request.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    ssize_t n;
+    do {
+        n = sendmsg(conn, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    bool sent = n > 0 && writeAll(conn, request.data() + n, request.size() - static_cast<size_t>(n));
+    if (in != 0) close(in);
+
+    int32_t status = 1;
+    uint32_t errLen = 0;
+    std::string error;
+    bool replied = sent && readAll(conn, &status, sizeof(status)) && readAll(conn, &errLen, sizeof(errLen));
+    if (replied) {
+        error.resize(errLen);
+        replied = readAll(conn, &error[0], errLen);
+    }
+    close(conn);
+
+    if (!replied) throw std::runtime_error("no reply from " + socketPath);
+    if (status != 0) throw std::runtime_error(error);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Resident mode. serve() listens on a UNIX socket and runs scripts for clients
+// on a pool of worker threads, keeping each script's Program and compiled code
+// cached by a hash of its path and source, so a repeated run skips parsing and
+// JIT compilation. A client hands over its stdin and stdout with the request:
+// the script reads and prints through them directly and only the outcome comes
+// back over the socket. Neither is available on Windows, which cannot pass
+// descriptors between processes.
+
+// Runs until the process is killed.
+void serve(const std::string& socketPath, unsigned threads, bool enableJit, size_t gcThreshold);
+
+// Runs script on the server at socketPath with this process's stdout, reading
+// inputPath or, when it is empty, stdin. Throws the error of a failed run.
+void runRemote(const std::string& socketPath, const std::string& script, const std::string& inputPath);
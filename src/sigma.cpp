@@ -0,0 +1,156 @@
+#include "sigma.h"
+#include "ast.h"
+#include "lexer.h"
+#include "parser.h"
+#include "runtime.h"
+#include "vm.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace sigma {
+
+    Script::Script() : prog(std::make_unique<Program>()) {}
+
+    Script::~Script() = default;
+
+    std::shared_ptr<const Script> Script::fromSource(const std::string& source, const std::string& name, bool jit) {
+        std::shared_ptr<Script> s(new Script());
+
+        Lexer lx{std::string(source)};
+        Parser ps(lx.lex());
+        auto mod = ps.parseModule();
+        s->prog->sourceName = name;
+        mod->gen(*s->prog);
+
+        // Compiled up front, so instances only ever read the code.
+        if (jit) {
+            s->jit = std::make_shared<JITCompiler>();
+            s->jit->compileAll(*s->prog, {});
+        }
+        return s;
+    }
+
+    std::shared_ptr<const Script> Script::fromFile(const std::string& path, bool jit) {
+        std::ifstream f(path, std::ios::binary);
+        if (!f) throw std::runtime_error("cannot open: " + path);
+        std::ostringstream ss;
+        ss << f.rdbuf();
+        return fromSource(ss.str(), path, jit);
+    }
+
+    uint32_t Script::functionId(const std::string& function) const {
+        auto it = prog->name2id.find(function);
+        if (it == prog->name2id.end()) throw std::runtime_error("function '" + function + "' not found");
+        return it->second;
+    }
+
+    bool Script::has(const std::string& function) const {
+        return prog->name2id.count(function) != 0;
+    }
+
+    uint32_t Script::arity(const std::string& function) const {
+        return prog->funcs[functionId(function)].arity;
+    }
+
+    Instance::Instance(std::shared_ptr<const Script> s)
+            : script(std::move(s)), vm(std::make_unique<VM>(script->prog.get(), script->jit)) {
+        vm->output.toMemory();
+        vm->input.fromMemory("");
+    }
+
+    Instance::~Instance() = default;
+
+    Value Instance::call(const std::string& function, std::initializer_list<Value> args) {
+        return callWith(function, args.begin(), args.size());
+    }
+
+    Value Instance::call(const std::string& function, const std::vector<Value>& args) {
+        return callWith(function, args.data(), args.size());
+    }
+
+    Value Instance::callWith(const std::string& function, const Value* args, size_t argc) {
+        uint32_t id = script->functionId(function);
+
+        int64_t small[8];
+        std::vector<int64_t> large;
+        int64_t* raw = small;
+        if (argc > 8) {
+            large.resize(argc);
+            raw = large.data();
+        }
+        for (size_t i = 0; i < argc; ++i) raw[i] = args[i].raw;
+
+        return Value::fromRaw(vm->call(id, raw, argc));
+    }
+
+    Value Instance::makeArray(const int64_t* values, size_t n) {
+        int64_t h = runtime_array_new(vm.get(), static_cast<int64_t>(n));
+        if (n) std::copy(values, values + n, vm->arrays[VM::handleToId(h)].data);
+        vm->hostRoots.emplace_back(h);
+        return Value::fromRaw(h);
+    }
+
+    Value Instance::newArray(const std::vector<int64_t>& values) {
+        return makeArray(values.data(), values.size());
+    }
+
+    Value Instance::newArray(const std::vector<double>& values) {
+        std::vector<int64_t> bits(values.size());
+        for (size_t i = 0; i < values.size(); ++i) bits[i] = Value(values[i]).raw;
+        return makeArray(bits.data(), bits.size());
+    }
+
+    const int64_t* Instance::arrayData(Value array, size_t& n) const {
+        if (!VM::isArrayHandle(array.raw, vm->arrays.size()) || !vm->arrays[VM::handleToId(array.raw)].data) {
+            throw std::runtime_error("not an array handle");
+        }
+        const auto& arr = vm->arrays[VM::handleToId(array.raw)];
+        n = arr.size;
+        return arr.data;
+    }
+
+    std::vector<int64_t> Instance::ints(Value array) const {
+        size_t n;
+        const int64_t* p = arrayData(array, n);
+        return std::vector<int64_t>(p, p + n);
+    }
+
+    std::vector<double> Instance::floats(Value array) const {
+        size_t n;
+        const int64_t* p = arrayData(array, n);
+        std::vector<double> out(n);
+        for (size_t i = 0; i < n; ++i) out[i] = Value::fromRaw(p[i]).asFloat();
+        return out;
+    }
+
+    void Instance::keep(Value array) {
+        size_t n;
+        arrayData(array, n);
+        vm->hostRoots.emplace_back(array.raw);
+    }
+
+    void Instance::release(Value array) {
+        auto& roots = vm->hostRoots;
+        auto it = std::find(roots.begin(), roots.end(), array.raw);
+        if (it == roots.end()) return;
+        *it = roots.back();
+        roots.pop_back();
+    }
+
+    std::string Instance::takeOutput() {
+        vm->output.flush();
+        std::string out = vm->output.memory();
+        vm->output.clearMemory();
+        return out;
+    }
+
+    void Instance::setInput(std::string text) {
+        vm->input.fromMemory(std::move(text));
+    }
+
+    void Instance::setGcThreshold(size_t n) {
+        vm->gcThreshold = n;
+    }
+}
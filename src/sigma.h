@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Program;
+struct VM;
+class JITCompiler;
+
+// Embedding API: compile a script once, then call its functions in-process from
+// any number of instances. Errors are thrown as std::runtime_error.
+namespace sigma {
+
+    // A script value: an integer, the bits of a float, or an array handle of the
+    // Instance that made it. Script functions are untyped, so the caller says how
+    // to read a result.
+    struct Value {
+        int64_t raw = 0;
+
+        Value() = default;
+        Value(int v) : raw(v) {}
+        Value(int64_t v) : raw(v) {}
+        Value(double d) { std::memcpy(&raw, &d, sizeof(double)); }
+
+        static Value fromRaw(int64_t raw) {
+            Value v;
+            v.raw = raw;
+            return v;
+        }
+
+        int64_t asInt() const { return raw; }
+        double asFloat() const {
+            double d;
+            std::memcpy(&d, &raw, sizeof(double));
+            return d;
+        }
+    };
+
+    // A parsed and compiled script. It is immutable once built and may be shared
+    // between threads; every Instance of it runs the same JIT code.
+    class Script {
+    public:
+        static std::shared_ptr<const Script> fromSource(const std::string& source, const std::string& name = "",
+                                                        bool jit = true);
+        static std::shared_ptr<const Script> fromFile(const std::string& path, bool jit = true);
+
+        ~Script();
+
+        bool has(const std::string& function) const;
+        uint32_t arity(const std::string& function) const;
+
+    private:
+        Script();
+
+        uint32_t functionId(const std::string& function) const;
+
+        std::unique_ptr<Program> prog;
+        std::shared_ptr<JITCompiler> jit;
+
+        friend class Instance;
+    };
+
+    // One VM running a Script, with its own heap, output and input.
+    // An Instance is used by one thread at a time. Output goes to memory rather
+    // than stdout, and input is empty until setInput.
+    class Instance {
+    public:
+        explicit Instance(std::shared_ptr<const Script> script);
+        ~Instance();
+
+        Instance(const Instance&) = delete;
+        Instance& operator=(const Instance&) = delete;
+
+        // Calls a function by name. An array in the result stays valid until the
+        // next call unless kept.
+        Value call(const std::string& function, std::initializer_list<Value> args = {});
+        Value call(const std::string& function, const std::vector<Value>& args);
+
+        // New arrays are kept until released.
+        Value newArray(const std::vector<int64_t>& values);
+        Value newArray(const std::vector<double>& values);
+        std::vector<int64_t> ints(Value array) const;
+        std::vector<double> floats(Value array) const;
+
+        // Keeps an array, and everything it refers to, alive across calls. Each
+        // keep is undone by one release.
+        void keep(Value array);
+        void release(Value array);
+
+        // Everything printed since the last take.
+        std::string takeOutput();
+        void setInput(std::string text);
+
+        // Upper bound on allocations between collections (the CLI's --gc=).
+        void setGcThreshold(size_t n);
+
+    private:
+        Value callWith(const std::string& function, const Value* args, size_t argc);
+        Value makeArray(const int64_t* values, size_t n);
+        const int64_t* arrayData(Value array, size_t& n) const;
+
+        std::shared_ptr<const Script> script;
+        std::unique_ptr<VM> vm;
+    };
+}
@@ -0,0 +1,136 @@
+#include "unwind.h"
+#include <cstring>
+
+#ifndef _WIN32
+extern "C" void __register_frame(void* begin);
+extern "C" void __deregister_frame(void* begin);
+
+namespace {
+    struct EhFrame {
+        std::vector<uint8_t> buf;
+        size_t fde = 0;
+
+        void u8(uint8_t v) { buf.emplace_back(v); }
+        void u32(uint32_t v) { raw(&v, 4); }
+        void u64(uint64_t v) { raw(&v, 8); }
+        void raw(const void* p, size_t n) {
+            auto* b = static_cast<const uint8_t*>(p);
+            buf.insert(buf.end(), b, b + n);
+        }
+        void uleb(uint64_t v) {
+            do {
+                uint8_t b = v & 0x7F;
+                v >>= 7;
+                u8(v ? (b | 0x80) : b);
+            } while (v);
+        }
+        void patch32(size_t at, uint32_t v) { std::memcpy(&buf[at], &v, 4); }
+
+        // Pads a CIE or FDE with DW_CFA_nop and fills in its length.
+        void close(size_t start) {
+            while ((buf.size() - start) % 8) u8(0);
+            patch32(start, static_cast<uint32_t>(buf.size() - start - 4));
+        }
+
+        void advance(uint32_t& at, uint32_t to) {
+            uint32_t delta = to - at;
+            at = to;
+            if (delta == 0) return;
+            if (delta < 0x40) {
+                u8(static_cast<uint8_t>(0x40 | delta));     // DW_CFA_advance_loc
+            } else if (delta <= 0xFF) {
+                u8(0x02);                                   // DW_CFA_advance_loc1
+                u8(static_cast<uint8_t>(delta));
+            } else {
+                u8(0x04);                                   // DW_CFA_advance_loc4
+                u32(delta);
+            }
+        }
+    };
+
+    // x86 register encoding to DWARF register number.
+    constexpr uint8_t kDwarfReg[16] = {0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15};
+    constexpr uint8_t kDwarfRbp = 6;
+    constexpr uint8_t kDwarfRsp = 7;
+    constexpr uint8_t kDwarfRip = 16;
+
+    EhFrame build(uintptr_t start, size_t size, const FrameLayout& layout) {
+        EhFrame e;
+
+        size_t cie = e.buf.size();
+        e.u32(0);
+        e.u32(0);           // CIE id
+        e.u8(1);            // version
+        e.raw("zR", 3);
+        e.uleb(1);          // code alignment
+        e.u8(0x78);         // data alignment -8 (sleb)
+        e.uleb(kDwarfRip);
+        e.uleb(1);
+        e.u8(0x00);         // DW_EH_PE_absptr
+        e.u8(0x0C);         // DW_CFA_def_cfa rsp+8
+        e.uleb(kDwarfRsp);
+        e.uleb(8);
+        e.u8(0x80 | kDwarfRip);     // return address at cfa-8
+        e.uleb(1);
+        e.close(cie);
+
+        e.fde = e.buf.size();
+        e.u32(0);
+        e.u32(static_cast<uint32_t>(e.buf.size() - cie));
+        e.u64(start);
+        e.u64(size);
+        e.uleb(0);
+
+        uint32_t at = 0;
+        e.advance(at, layout.afterPushRbp);
+        e.u8(0x0E);         // DW_CFA_def_cfa_offset 16
+        e.uleb(16);
+        e.u8(0x80 | kDwarfRbp);
+        e.uleb(2);
+        e.advance(at, layout.afterSetFrame);
+        e.u8(0x0D);         // DW_CFA_def_cfa_register rbp
+        e.uleb(kDwarfRbp);
+
+        uint64_t slot = 3;
+        for (auto& [offset, reg] : layout.saves) {
+            e.advance(at, offset);
+            e.u8(static_cast<uint8_t>(0x80 | kDwarfReg[reg & 15]));
+            e.uleb(slot++);
+        }
+        e.close(e.fde);
+
+        e.u32(0);
+        return e;
+    }
+}
+
+void* registerUnwindInfo(uintptr_t start, size_t size, const FrameLayout& layout) {
+    auto* frame = new EhFrame(build(start, size, layout));
+#ifdef __APPLE__
+    // libunwind takes a single FDE rather than a whole section.
+    __register_frame(frame->buf.data() + frame->fde);
+#else
+    __register_frame(frame->buf.data());
+#endif
+    return frame;
+}
+
+void unregisterUnwindInfo(void* handle) {
+    auto* frame = static_cast<EhFrame*>(handle);
+#ifdef __APPLE__
+    __deregister_frame(frame->buf.data() + frame->fde);
+#else
+    __deregister_frame(frame->buf.data());
+#endif
+    delete frame;
+}
+
+#else
+
+void* registerUnwindInfo(uintptr_t, size_t, const FrameLayout&) {
+    return nullptr;
+}
+
+void unregisterUnwindInfo(void*) {}
+
+#endif
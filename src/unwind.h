@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Prologue of a compiled function: `push rbp; mov rbp, rsp` followed by pushes
+// of the callee-saved registers it uses. Offsets are from the function start,
+// registers are x86 encodings (rax = 0 .. r15 = 15).
+struct FrameLayout {
+    uint32_t afterPushRbp = 0;
+    uint32_t afterSetFrame = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> saves;
+};
+
+// Registers .eh_frame unwind info for [start, start + size) so C++ exceptions
+// thrown by runtime helpers can unwind through compiled frames. Returns nullptr
+// where this is not supported (Windows needs RtlAddFunctionTable instead).
+void* registerUnwindInfo(uintptr_t start, size_t size, const FrameLayout& layout);
+
+void unregisterUnwindInfo(void* handle);
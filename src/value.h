@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A value is 64 bits: an integer, the bits of a double or an array reference.
+// Integers and doubles between them use every pattern, so references take a
+// corner neither reaches in practice: quiet NaNs with bit 50 set, which no float
+// operation produces from ordinary operands, with the array id in the low 48
+// bits. Telling a reference from anything else is one mask and compare.
+namespace Tagged {
+    constexpr uint64_t kTagMask = 0xFFFF000000000000ull;
+    constexpr uint64_t kArrayTag = 0x7FFC000000000000ull;
+    constexpr uint64_t kPayloadMask = ~kTagMask;
+
+    inline bool isArray(int64_t v) {
+        return (static_cast<uint64_t>(v) & kTagMask) == kArrayTag;
+    }
+
+    inline size_t arrayId(int64_t v) {
+        return static_cast<size_t>(static_cast<uint64_t>(v) & kPayloadMask);
+    }
+
+    inline int64_t array(size_t id) {
+        return static_cast<int64_t>(kArrayTag | static_cast<uint64_t>(id));
+    }
+}
@@ -1,6 +1,10 @@
 #include "vm.h"
 #include "runtime.h"
 #include "gc.h"
+#include "mapfile.h"
+#include "opstats.h"
+#include "profiler.h"
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
 
@@ -28,6 +32,24 @@ static inline int64_t doubleToBits(double d) {
     return bits;
 }
 
+static inline bool compareHolds(Op cmp, int64_t a, int64_t b) {
+    switch (cmp) {
+        case Op::CMPLT: return a < b;
+        case Op::CMPLE: return a <= b;
+        case Op::CMPGT: return a > b;
+        case Op::CMPGE: return a >= b;
+        case Op::CMPEQ: return a == b;
+        case Op::CMPNE: return a != b;
+        case Op::FCMPLT: return bitsToDouble(a) < bitsToDouble(b);
+        case Op::FCMPLE: return bitsToDouble(a) <= bitsToDouble(b);
+        case Op::FCMPGT: return bitsToDouble(a) > bitsToDouble(b);
+        case Op::FCMPGE: return bitsToDouble(a) >= bitsToDouble(b);
+        case Op::FCMPEQ: return bitsToDouble(a) == bitsToDouble(b);
+        case Op::FCMPNE: return bitsToDouble(a) != bitsToDouble(b);
+        default: return false;
+    }
+}
+
 int64_t VM::readI64(size_t& ip) const {
     auto v = loadI64(&prog->code.buf[ip]);
     ip += 8;
@@ -54,6 +76,7 @@ void VM::pushFrame(uint32_t fid, size_t ret_ip) {
     }
 
     callstack.emplace_back(Frame{fid, ret_ip, base, f.nlocals});
+    if (profiler) profiler->enter(fid, false);
 }
 
 void VM::popFrame() {
@@ -61,6 +84,7 @@ void VM::popFrame() {
 
     auto fr = callstack.back();
     callstack.pop_back();
+    if (profiler) profiler->leave();
 
     if (estack.empty()) throw std::runtime_error("RET: empty stack");
 
@@ -71,31 +95,360 @@ void VM::popFrame() {
     estack.emplace_back(ret);
 }
 
+VM::VM(const Program* p) : VM(p, std::make_shared<JITCompiler>()) {}
+
+VM::VM(const Program* p, std::shared_ptr<JITCompiler> code)
+        : prog(p), jit(std::move(code)), rng(std::random_device{}()), startTime(std::chrono::steady_clock::now()) {
+    input.flushFirst = &output;
+}
+
+VM::~VM() {
+    dropTasks();
+    for (auto& arr : arrays) {
+        if (arr.mapped) unmapArrayFile(arr.data, arr.size);
+    }
+}
+
 int64_t VM::run(const std::string& entryName) {
     auto it = prog->name2id.find(entryName);
     if (it == prog->name2id.end()) {
         throw std::runtime_error("entry function '" + entryName + "' not found");
     }
 
-    int entryId = static_cast<int>(it->second);
+    if (jit) jit->compileAll(*prog, compileOnly);
+
+    return enter(it->second, nullptr, 0, false);
+}
+
+int64_t VM::call(uint32_t funcId, const int64_t* args, size_t argc) {
+    if (funcId >= prog->funcs.size()) throw std::runtime_error("call: invalid function id");
 
-    if (jit) {
-        for (uint32_t i = 0; i < prog->funcs.size(); ++i) {
-            jit->compileFunction(*prog, i);
+    const Function& f = prog->funcs[funcId];
+    if (argc != f.arity) {
+        throw std::runtime_error("call: " + f.name + " takes " + std::to_string(f.arity) + " arguments, got " +
+                                 std::to_string(argc));
+    }
+    return enter(funcId, args, argc, jit && jit->isCompiled(funcId));
+}
+
+// Whether v names an array allocated at taskLevel or deeper, which belongs to the
+// task running now.
+static bool isOwnArray(const VM& vm, int64_t v) {
+    return VM::isArrayHandle(v, vm.arrays.size()) && vm.arrays[VM::handleToId(v)].level >= vm.taskLevel;
+}
+
+// Passes the arrays of the task running inline that its result reaches to the
+// level below, the one it returns to.
+static void lowerReturned(VM& vm, int64_t result) {
+    if (!isOwnArray(vm, result)) return;
+    std::vector<int64_t> work{result};
+    while (!work.empty()) {
+        int64_t v = work.back();
+        work.pop_back();
+        if (!isOwnArray(vm, v)) continue;
+
+        auto& arr = vm.arrays[VM::handleToId(v)];
+        arr.level = vm.taskLevel - 1;
+        if (!arr.bigint && !arr.mapped) work.insert(work.end(), arr.data, arr.data + arr.size);
+    }
+}
+
+// The same for a queued task, whose arrays go with its worker's table: they are
+// copied out for the join. A mapping is handed over rather than copied.
+static void collectReturned(VM& v, VM::Task& task) {
+    if (!isOwnArray(v, task.result)) return;
+    std::vector<int64_t> work{task.result};
+    while (!work.empty()) {
+        int64_t h = work.back();
+        work.pop_back();
+        if (!isOwnArray(v, h)) continue;
+
+        auto& arr = v.arrays[VM::handleToId(h)];
+        arr.level = v.taskLevel - 1;
+        task.returned.emplace_back(VM::handleToId(h), arr);
+        if (arr.mapped) {
+            arr.data = nullptr;
+            arr.size = 0;
+            arr.mapped = false;
+            continue;
         }
+        task.returnedData.insert(task.returnedData.end(), arr.data, arr.data + arr.size);
+        if (!arr.bigint) work.insert(work.end(), arr.data, arr.data + arr.size);
     }
+}
+
+namespace {
+    // A VM for queued tasks, kept by the thread that ran its last one. It holds on
+    // to its copy of the spawner's table and copies again only once that changed.
+    struct Worker {
+        std::unique_ptr<VM> vm;
+        std::shared_ptr<const std::vector<VM::Array>> table;
+
+        // The copied entries are the spawner's: nothing of them is freed or unmapped with vm.
+        ~Worker() {
+            vm->arrays.clear();
+        }
+    };
 
-    size_t ip = 0;
+    // A thread waiting on a join runs queued tasks itself, so it may need several.
+    thread_local std::vector<std::unique_ptr<Worker>> idleWorkers;
+
+    std::unique_ptr<Worker> takeWorker(const Program* prog, const std::shared_ptr<JITCompiler>& jit) {
+        for (size_t i = idleWorkers.size(); i-- > 0;) {
+            if (idleWorkers[i]->vm->prog == prog && idleWorkers[i]->vm->jit == jit) {
+                auto w = std::move(idleWorkers[i]);
+                idleWorkers.erase(idleWorkers.begin() + static_cast<std::ptrdiff_t>(i));
+                return w;
+            }
+        }
+        // Workers for another program are of no further use to this thread.
+        idleWorkers.clear();
+
+        auto w = std::make_unique<Worker>();
+        w->vm = std::make_unique<VM>(prog, jit);
+        w->vm->output.toMemory();
+        w->vm->input.fromMemory("");
+        return w;
+    }
+
+    // Frees what the last task allocated, leaving the spawner's part of the table.
+    void releaseOwnArrays(VM& v) {
+        for (size_t i = v.sharedArrays; i < v.arrays.size(); ++i) {
+            auto& arr = v.arrays[i];
+            if (!arr.data) continue;
+            if (arr.mapped) {
+                unmapArrayFile(arr.data, arr.size);
+            } else {
+                v.heap.release(arr.data, arr.size);
+            }
+        }
+        v.arrays.resize(v.sharedArrays);
+        v.freeList.clear();
+        v.allocCount = 0;
+        v.arraySnapshot.reset();
+        v.arrayIds.reset();
+        v.reservedFrom = SIZE_MAX;
+    }
+}
+
+VM::Task::~Task() {
+    for (auto& [id, arr] : returned) {
+        if (arr.mapped) unmapArrayFile(arr.data, arr.size);
+    }
+}
+
+void VM::Task::run() {
+    auto w = takeWorker(prog, jit);
+    VM& v = *w->vm;
+    if (w->table != arrays) {
+        v.arrays = *arrays;
+        w->table = arrays;
+    }
+    v.sharedArrays = arrays->size();
+    v.arrayIds = arrayIds;
+    v.runLevel = level;
+    v.startTime = startTime;
+
+    try {
+        result = v.call(funcId, args.data(), args.size());
+        collectReturned(v, *this);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    output = v.output.memory();
+    v.output.clearMemory();
+
+    releaseOwnArrays(v);
+    idleWorkers.push_back(std::move(w));
+}
+
+void VM::runInline(Task& task) {
+    size_t depth = callstack.size();
+    size_t height = estack.size();
+    size_t roots = rootStacks.size();
+    size_t ip = opIp;
+    uint32_t profiled = profiler ? profiler->level() : 0;
+    size_t outerBase = taskBase;
+    taskBase = tasks.size();
+    ++taskLevel;
+
+    faultSite = nullptr;
+    output.beginCapture();
+    try {
+        if (jit && jit->isCompiled(task.funcId)) {
+            task.result = runtime_call_function(this, task.funcId, task.args.data(),
+                                                static_cast<uint32_t>(task.args.size()));
+        } else {
+            estack.insert(estack.end(), task.args.begin(), task.args.end());
+            pushFrame(task.funcId, SIZE_MAX);
+            task.result = interpret(prog->funcs[task.funcId].entry);
+        }
+    } catch (const std::exception& e) {
+        // Located the way a VM of its own would locate it. Anything else, such as
+        // bad_alloc, fails the task as it would a queued one, so that the state
+        // below is always put back.
+        bool inCall = faultSite || callstack.size() > depth;
+        task.error = std::string(e.what()) + (inCall ? describeLocation() : "");
+    }
+    if (task.error.empty()) {
+        try {
+            joinTasks();
+            lowerReturned(*this, task.result);
+        } catch (const std::exception& e) {
+            task.error = e.what();
+        }
+    }
+    dropTasks();
+    task.output = output.endCapture();
+
+    callstack.resize(depth);
+    estack.resize(height);
+    rootStacks.resize(roots);
+    if (profiler) profiler->unwindTo(profiled);
+    opIp = ip;
+    faultSite = nullptr;
+    taskBase = outerBase;
+    --taskLevel;
+}
+
+int64_t VM::enter(uint32_t funcId, const int64_t* args, size_t argc, bool direct) {
+    // A previous run that threw may have left frames, compiled-code roots, tasks
+    // and the level and output capture of a task it was running inline behind.
     estack.clear();
     callstack.clear();
+    rootStacks.clear();
+    faultSite = nullptr;
+    taskBase = 0;
+    dropTasks();
+    taskLevel = runLevel;
+    output.dropCaptures();
+
+    try {
+        // Arguments sit on estack so the GC sees any arrays among them.
+        estack.assign(args, args + argc);
+
+        int64_t result;
+        if (direct) {
+            result = runtime_call_function(this, funcId, estack.data(), static_cast<uint32_t>(argc));
+            estack.clear();
+            estack.emplace_back(result);
+        } else {
+            pushFrame(funcId, SIZE_MAX);
+            result = interpret(prog->funcs[funcId].entry);
+        }
+        joinTasks();
+        output.flush();
+        return result;
+    } catch (const std::runtime_error& e) {
+        dropTasks();
+        output.flush();
+        throw std::runtime_error(std::string(e.what()) + describeLocation());
+    } catch (...) {
+        dropTasks();
+        output.flush();
+        throw;
+    }
+}
+
+void VM::joinTasks() {
+    for (size_t h = taskBase; h < tasks.size(); ++h) {
+        if (tasks[h]) runtime_join(this, static_cast<int64_t>(h));
+    }
+    dropTasks();
+}
+
+void VM::dropTasks() {
+    for (size_t h = taskBase; h < tasks.size(); ++h) {
+        auto& t = tasks[h];
+        if (!t || !t->queued) continue;
+        if (!WorkPool::cancel(*t)) WorkPool::wait(*t);
+        queuedTaskDone();
+    }
+    tasks.resize(taskBase);
+    while (!freeTasks.empty() && freeTasks.back() >= taskBase) freeTasks.pop_back();
+}
+
+void VM::queuedTaskDone() {
+    if (--queuedTasks > 0) return;
+    pinnedBelow = 0;
+    remembered.clear();
+
+    // Outside any task this is the VM that started arrayIds, and with its tasks
+    // joined nothing else draws on it: every id it skipped has been filled or is free.
+    if (taskLevel > 0 || !arrayIds) return;
+    arrayIds.reset();
+    for (size_t i = reservedFrom; i < arrays.size(); ++i) arrays[i].reserved = false;
+    reservedFrom = SIZE_MAX;
+}
+
+// Ids the table grows past were taken from arrayIds by other VMs.
+void VM::growTable(size_t id) {
+    if (id < arrays.size()) return;
+    size_t from = arrays.size();
+    arrays.resize(id + 1);
+    for (size_t i = from; i < id; ++i) arrays[i].reserved = true;
+    if (id > from) reservedFrom = std::min(reservedFrom, from);
+}
 
-    pushFrame(static_cast<uint32_t>(entryId), SIZE_MAX);
-    ip = prog->funcs[entryId].entry;
+size_t VM::newArrayId() {
+    size_t id = arrayIds ? arrayIds->fetch_add(1, std::memory_order_relaxed) : arrays.size();
+    growTable(id);
+    arrays[id].reserved = false;
+    return id;
+}
+
+void VM::adoptReturned(Task& task) {
+    const int64_t* from = task.returnedData.data();
+    for (auto& [id, arr] : task.returned) {
+        growTable(id);
+        auto& slot = arrays[id];
+        slot = arr;
+        if (!arr.mapped) {
+            slot.data = heap.allocate(arr.size);
+            std::copy(from, from + arr.size, slot.data);
+            from += arr.size;
+        }
+        slot.marked = false;
+        slot.reserved = false;
+        slot.level = taskLevel;
+        slot.born = allocations++;
+    }
+    allocCount += task.returned.size();
+    arraySnapshot.reset();
+    task.returned.clear();
+    task.returnedData.clear();
+}
+
+// Compiled code reports the call that failed through faultSite; otherwise the
+// error came from the instruction the interpreter was executing.
+std::string VM::describeLocation() const {
+    uint32_t fid = 0;
+    size_t at = 0;
+    bool compiled = faultSite && jit && jit->locate(faultSite, fid, at);
+    if (!compiled) {
+        if (callstack.empty()) return "";
+        fid = callstack.back().func_id;
+        at = opIp;
+    }
+
+    const Function& f = prog->funcs[fid];
+    int line = f.lineAt(at);
+    if (!line) return " in " + f.name;
+    return " at " + (prog->sourceName.empty() ? "line " : prog->sourceName + ":") + std::to_string(line) + " in " + f.name;
+}
 
+int64_t VM::interpret(size_t ip) {
     auto& code = prog->code.buf;
+    const bool instrumented = opStats || profiler;
 
     for (;;) {
+        opIp = ip;
         Op op = static_cast<Op>(code[ip++]);
+        if (instrumented) {
+            if (opStats) opStats->record(op, callstack.back().func_id, callstack.size());
+            if (profiler) profiler->at(ip - 1);
+        }
+
         switch (op) {
             case Op::NOP:
                 break;
@@ -133,6 +486,15 @@ int64_t VM::run(const std::string& entryName) {
                 break;
             }
 
+            case Op::INC_LOCAL: {
+                uint32_t slot = readU32(ip);
+                int64_t k = readI64(ip);
+                size_t idx = callstack.back().bp + slot;
+                if (idx >= estack.size()) throw std::runtime_error("INC_LOCAL: slot OOB");
+                estack[idx] = static_cast<int64_t>(static_cast<uint64_t>(estack[idx]) + static_cast<uint64_t>(k));
+                break;
+            }
+
             case Op::IADD: {
                 if (estack.size() < 2) throw std::runtime_error("IADD: stack underflow");
                 auto b = estack.back(); estack.pop_back();
@@ -238,6 +600,103 @@ int64_t VM::run(const std::string& entryName) {
                 break;
             }
 
+            case Op::IMIN: {
+                if (estack.size() < 2) throw std::runtime_error("IMIN: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a < b ? a : b);
+                break;
+            }
+
+            case Op::IMAX: {
+                if (estack.size() < 2) throw std::runtime_error("IMAX: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a > b ? a : b);
+                break;
+            }
+
+            case Op::IABS: {
+                if (estack.empty()) throw std::runtime_error("IABS: stack underflow");
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a < 0 ? static_cast<int64_t>(0 - static_cast<uint64_t>(a)) : a);
+                break;
+            }
+
+            case Op::FMIN: {
+                if (estack.size() < 2) throw std::runtime_error("FMIN: stack underflow");
+                int64_t bBits = estack.back(); estack.pop_back();
+                int64_t aBits = estack.back(); estack.pop_back();
+                double a = bitsToDouble(aBits);
+                double b = bitsToDouble(bBits);
+                estack.emplace_back(a < b ? aBits : bBits);
+                break;
+            }
+
+            case Op::FMAX: {
+                if (estack.size() < 2) throw std::runtime_error("FMAX: stack underflow");
+                int64_t bBits = estack.back(); estack.pop_back();
+                int64_t aBits = estack.back(); estack.pop_back();
+                double a = bitsToDouble(aBits);
+                double b = bitsToDouble(bBits);
+                estack.emplace_back(a > b ? aBits : bBits);
+                break;
+            }
+
+            case Op::FABS: {
+                if (estack.empty()) throw std::runtime_error("FABS: stack underflow");
+                int64_t xBits = estack.back(); estack.pop_back();
+                estack.emplace_back(xBits & INT64_MAX);
+                break;
+            }
+
+            case Op::FFLOOR: {
+                if (estack.empty()) throw std::runtime_error("FFLOOR: stack underflow");
+                int64_t xBits = estack.back(); estack.pop_back();
+                estack.emplace_back(runtime_floor_bits(xBits));
+                break;
+            }
+
+            case Op::IAND: {
+                if (estack.size() < 2) throw std::runtime_error("IAND: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a & b);
+                break;
+            }
+
+            case Op::IOR: {
+                if (estack.size() < 2) throw std::runtime_error("IOR: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a | b);
+                break;
+            }
+
+            case Op::IXOR: {
+                if (estack.size() < 2) throw std::runtime_error("IXOR: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a ^ b);
+                break;
+            }
+
+            case Op::ISHL: {
+                if (estack.size() < 2) throw std::runtime_error("ISHL: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(static_cast<int64_t>(static_cast<uint64_t>(a) << (b & 63)));
+                break;
+            }
+
+            case Op::ISHR: {
+                if (estack.size() < 2) throw std::runtime_error("ISHR: stack underflow");
+                auto b = estack.back(); estack.pop_back();
+                auto a = estack.back(); estack.pop_back();
+                estack.emplace_back(a >> (b & 63));
+                break;
+            }
+
             case Op::CMPLE: {
                 if (estack.size() < 2) throw std::runtime_error("CMPLE: stack underflow");
                 auto b = estack.back(); estack.pop_back();
@@ -361,6 +820,62 @@ int64_t VM::run(const std::string& entryName) {
                 break;
             }
 
+            case Op::JNE_ZERO: {
+                uint32_t addr = readU32(ip);
+                if (estack.empty()) throw std::runtime_error("JNE_ZERO: empty stack");
+                auto v = estack.back();
+                estack.pop_back();
+                if (v != 0) ip = addr;
+                break;
+            }
+
+            case Op::JLT_LOCALS:
+            case Op::JLE_LOCALS:
+            case Op::JGT_LOCALS:
+            case Op::JGE_LOCALS:
+            case Op::JEQ_LOCALS:
+            case Op::JNE_LOCALS:
+            case Op::FJNLT_LOCALS:
+            case Op::FJNLE_LOCALS:
+            case Op::FJNGT_LOCALS:
+            case Op::FJNGE_LOCALS:
+            case Op::FJNEQ_LOCALS:
+            case Op::FJNNE_LOCALS:
+            {
+                uint32_t addr = readU32(ip);
+                size_t bp = callstack.back().bp;
+                size_t ia = bp + readU32(ip);
+                size_t ib = bp + readU32(ip);
+                if (ia >= estack.size() || ib >= estack.size()) throw std::runtime_error("compare-and-branch: slot OOB");
+                bool holds = compareHolds(branchCompare(op), estack[ia], estack[ib]);
+                bool isFloat = op >= Op::FJNLT_LOCALS;
+                if (holds != isFloat) ip = addr;
+                break;
+            }
+
+            case Op::JLT_LOCAL_CONST:
+            case Op::JLE_LOCAL_CONST:
+            case Op::JGT_LOCAL_CONST:
+            case Op::JGE_LOCAL_CONST:
+            case Op::JEQ_LOCAL_CONST:
+            case Op::JNE_LOCAL_CONST:
+            case Op::FJNLT_LOCAL_CONST:
+            case Op::FJNLE_LOCAL_CONST:
+            case Op::FJNGT_LOCAL_CONST:
+            case Op::FJNGE_LOCAL_CONST:
+            case Op::FJNEQ_LOCAL_CONST:
+            case Op::FJNNE_LOCAL_CONST:
+            {
+                uint32_t addr = readU32(ip);
+                size_t ia = callstack.back().bp + readU32(ip);
+                int64_t k = readI64(ip);
+                if (ia >= estack.size()) throw std::runtime_error("compare-and-branch: slot OOB");
+                bool holds = compareHolds(branchCompare(op), estack[ia], k);
+                bool isFloat = op >= Op::FJNLT_LOCALS;
+                if (holds != isFloat) ip = addr;
+                break;
+            }
+
             case Op::CALL: {
                 uint32_t fid = readU32(ip);
                 uint32_t argc = readU32(ip);
@@ -380,6 +895,39 @@ int64_t VM::run(const std::string& entryName) {
                 break;
             }
 
+            case Op::TAILCALL: {
+                uint32_t fid = readU32(ip);
+                uint32_t argc = readU32(ip);
+                if (callstack.empty()) throw std::runtime_error("TAILCALL: no frame");
+                if (estack.size() < argc) throw std::runtime_error("TAILCALL: not enough args");
+
+                size_t ret_to = callstack.back().ip;
+
+                if (jit && jit->isCompiled(fid)) {
+                    int64_t* argsPtr = estack.data() + (estack.size() - argc);
+                    int64_t res = runtime_call_function(this, fid, argsPtr, argc);
+                    estack.resize(estack.size() - argc);
+                    estack.emplace_back(res);
+                    popFrame();
+                } else {
+                    // Slide the arguments down over the current frame and take its place.
+                    size_t bp = callstack.back().bp;
+                    std::copy(estack.end() - argc, estack.end(), estack.begin() + static_cast<std::ptrdiff_t>(bp));
+                    estack.resize(bp + argc);
+                    callstack.pop_back();
+                    if (profiler) profiler->leave();
+                    pushFrame(fid, ret_to);
+                    ip = prog->funcs[fid].entry;
+                    break;
+                }
+
+                if (ret_to == SIZE_MAX) {
+                    return estack.empty() ? 0 : estack.back();
+                }
+                ip = ret_to;
+                break;
+            }
+
             case Op::RET: {
                 if (callstack.empty()) throw std::runtime_error("RET: no frame");
                 size_t ret_to = callstack.back().ip;
@@ -401,7 +949,7 @@ int64_t VM::run(const std::string& entryName) {
                 if (estack.empty()) throw std::runtime_error("PRINT: empty stack");
                 auto v = estack.back();
                 estack.pop_back();
-                runtime_print(v);
+                runtime_print(this, v);
                 break;
             }
 
@@ -409,7 +957,80 @@ int64_t VM::run(const std::string& entryName) {
                 if (estack.empty()) throw std::runtime_error("PRINT_F: empty stack");
                 auto bits = estack.back();
                 estack.pop_back();
-                runtime_print_f_bits(bits);
+                runtime_print_f_bits(this, bits);
+                break;
+            }
+
+            case Op::PRINT_ARRAY: {
+                if (estack.empty()) throw std::runtime_error("PRINT_ARRAY: empty stack");
+                auto handle = estack.back();
+                estack.pop_back();
+                runtime_print_array(this, handle);
+                break;
+            }
+
+            case Op::FLUSH:
+                runtime_flush(this);
+                break;
+
+            case Op::READ_INT:
+                estack.emplace_back(runtime_read_int(this));
+                break;
+
+            case Op::READ_FLOAT:
+                estack.emplace_back(runtime_read_float_bits(this));
+                break;
+
+            case Op::READ_INTS:
+            case Op::READ_FLOATS: {
+                if (estack.empty()) throw std::runtime_error(std::string(opName(op)) + ": empty stack");
+                int64_t n = estack.back();
+                int64_t out = op == Op::READ_INTS ? runtime_read_ints(this, n) : runtime_read_floats(this, n);
+                estack.back() = out;
+                break;
+            }
+
+            case Op::READ_EOF:
+                estack.emplace_back(runtime_eof(this));
+                break;
+
+            case Op::MAP_ARRAY: {
+                if (estack.size() < 2) throw std::runtime_error("MAP_ARRAY: stack underflow");
+                int64_t n = estack.back(); estack.pop_back();
+                int64_t path = estack.back(); estack.pop_back();
+                estack.emplace_back(runtime_map_array(this, path, n));
+                break;
+            }
+
+            case Op::SAVE_ARRAY: {
+                if (estack.size() < 2) throw std::runtime_error("SAVE_ARRAY: stack underflow");
+                int64_t handle = estack.back(); estack.pop_back();
+                int64_t path = estack.back(); estack.pop_back();
+                runtime_save_array(this, path, handle);
+                break;
+            }
+
+            case Op::PARALLEL_FOR: {
+                if (estack.size() < 4) throw std::runtime_error("PARALLEL_FOR: stack underflow");
+                int64_t result = runtime_parallel_for(this, estack.data() + estack.size() - 4);
+                estack.resize(estack.size() - 4);
+                estack.emplace_back(result);
+                break;
+            }
+
+            case Op::SPAWN: {
+                uint32_t fid = readU32(ip);
+                uint32_t argc = readU32(ip);
+                if (estack.size() < argc) throw std::runtime_error("SPAWN: not enough args");
+                int64_t handle = runtime_spawn(this, fid, estack.data() + estack.size() - argc, argc);
+                estack.resize(estack.size() - argc);
+                estack.emplace_back(handle);
+                break;
+            }
+
+            case Op::JOIN: {
+                if (estack.empty()) throw std::runtime_error("JOIN: empty stack");
+                estack.back() = runtime_join(this, estack.back());
                 break;
             }
 
@@ -452,8 +1073,105 @@ int64_t VM::run(const std::string& entryName) {
                 break;
             }
 
+            case Op::ARRAY_FILL: {
+                if (estack.size() < 4) throw std::runtime_error("ARRAY_FILL: stack underflow");
+                int64_t val = estack.back(); estack.pop_back();
+                int64_t to = estack.back(); estack.pop_back();
+                int64_t from = estack.back(); estack.pop_back();
+                int64_t handle = estack.back(); estack.pop_back();
+                runtime_array_fill(this, handle, from, to, val);
+                break;
+            }
+
+            case Op::ARRAY_COPY: {
+                if (estack.size() < 5) throw std::runtime_error("ARRAY_COPY: stack underflow");
+                int64_t n = estack.back(); estack.pop_back();
+                int64_t spos = estack.back(); estack.pop_back();
+                int64_t src = estack.back(); estack.pop_back();
+                int64_t dpos = estack.back(); estack.pop_back();
+                int64_t dst = estack.back(); estack.pop_back();
+                runtime_array_copy(this, dst, dpos, src, spos, n);
+                break;
+            }
+
+            case Op::ARRAY_SLICE: {
+                if (estack.size() < 3) throw std::runtime_error("ARRAY_SLICE: stack underflow");
+                size_t top = estack.size();
+                int64_t out = runtime_array_slice(this, estack[top - 3], estack[top - 2], estack[top - 1]);
+                estack.resize(top - 3);
+                estack.emplace_back(out);
+                break;
+            }
+
+            case Op::ARRAY_EQUAL: {
+                if (estack.size() < 2) throw std::runtime_error("ARRAY_EQUAL: stack underflow");
+                int64_t b = estack.back(); estack.pop_back();
+                int64_t a = estack.back(); estack.pop_back();
+                estack.emplace_back(runtime_array_equal(this, a, b));
+                break;
+            }
+
+            case Op::ARRAY_SUM: {
+                if (estack.size() < 3) throw std::runtime_error("ARRAY_SUM: stack underflow");
+                int64_t to = estack.back(); estack.pop_back();
+                int64_t from = estack.back(); estack.pop_back();
+                int64_t handle = estack.back(); estack.pop_back();
+                estack.emplace_back(runtime_array_sum(this, handle, from, to));
+                break;
+            }
+
+            case Op::ARRAY_COUNT: {
+                auto cmp = static_cast<Op>(code[ip++]);
+                if (estack.size() < 4) throw std::runtime_error("ARRAY_COUNT: stack underflow");
+                int64_t k = estack.back(); estack.pop_back();
+                int64_t to = estack.back(); estack.pop_back();
+                int64_t from = estack.back(); estack.pop_back();
+                int64_t handle = estack.back(); estack.pop_back();
+                estack.emplace_back(runtime_array_count(this, handle, from, to, k, cmp));
+                break;
+            }
+
+            case Op::ARRAY_MAP: {
+                auto fn = static_cast<Op>(code[ip++]);
+                if (estack.size() < 4) throw std::runtime_error("ARRAY_MAP: stack underflow");
+                int64_t v = estack.back(); estack.pop_back();
+                int64_t to = estack.back(); estack.pop_back();
+                int64_t from = estack.back(); estack.pop_back();
+                int64_t handle = estack.back(); estack.pop_back();
+                runtime_array_map(this, handle, from, to, v, fn);
+                break;
+            }
+
+            case Op::BIGINT: {
+                if (estack.empty()) throw std::runtime_error("BIGINT: stack underflow");
+                int64_t out = runtime_bigint(this, estack.back());
+                estack.back() = out;
+                break;
+            }
+
+            case Op::BIG_ADD:
+            case Op::BIG_SUB:
+            case Op::BIG_MUL:
+            case Op::BIG_DIV:
+            case Op::BIG_MOD:
+            case Op::BIG_CMP: {
+                if (estack.size() < 2) throw std::runtime_error(std::string(opName(op)) + ": stack underflow");
+                size_t top = estack.size();
+                int64_t out = runtime_big_binary(this, estack[top - 2], estack[top - 1], op);
+                estack.resize(top - 2);
+                estack.emplace_back(out);
+                break;
+            }
+
+            case Op::PRINT_BIGINT: {
+                if (estack.empty()) throw std::runtime_error("PRINT_BIGINT: stack underflow");
+                int64_t handle = estack.back(); estack.pop_back();
+                runtime_print_bigint(this, handle);
+                break;
+            }
+
             case Op::TIME_MS:
-                estack.emplace_back(runtime_time_ms());
+                estack.emplace_back(runtime_time_ms(this));
                 break;
 
             case Op::PRINT_BIG: {
@@ -465,7 +1183,7 @@ int64_t VM::run(const std::string& entryName) {
             }
 
             case Op::RAND:
-                estack.emplace_back(runtime_rand());
+                estack.emplace_back(runtime_rand(this));
                 break;
 
             default:
@@ -475,5 +1193,6 @@ int64_t VM::run(const std::string& entryName) {
 }
 
 void VM::runGC() {
+    arraySnapshot.reset();
     GC::runGC(this);
 }
@@ -1,13 +1,25 @@
 #pragma once
 
 #include "bytecode.h"
+#include "heap.h"
+#include "input.h"
 #include "jit.h"
+#include "output.h"
+#include "parallel.h"
+#include "value.h"
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <memory>
+#include <random>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+struct OpStats;
+struct PerfCounters;
+struct Profiler;
+
 struct VM {
     const Program* prog = nullptr;
 
@@ -23,15 +35,33 @@ struct VM {
     std::vector<Frame> callstack;
 
     struct Array {
-        std::vector<int64_t> data;
+        int64_t* data = nullptr;
+        size_t size = 0;
         bool marked = false;
+        bool bigint = false;    // limbs, not values: the GC does not scan it
+        bool mapped = false;    // file mapping from map_array: not scanned, unmapped instead of freed
+        bool reserved = false;  // empty, but the id is another VM's to fill (see arrayIds)
+        uint32_t level = 0;     // taskLevel it was allocated at
+        uint64_t born = 0;      // allocations before it
     };
 
+    ArrayHeap heap;
     std::vector<Array> arrays;
     std::vector<size_t> freeList;
 
     size_t allocCount = 0;
     size_t gcThreshold = 100;
+    uint64_t allocations = 0;
+
+    // Where new ids come from while queued tasks may be allocating: one counter
+    // for the VM that spawned them and the worker VMs running them, so that no two
+    // hand out the same id and a task's arrays keep theirs in the spawner's table.
+    // Entries for ids taken elsewhere are reserved from reservedFrom up.
+    std::shared_ptr<std::atomic<size_t>> arrayIds;
+    size_t reservedFrom = SIZE_MAX;
+
+    // Id for a new array, with its entry in the table.
+    size_t newArrayId();
 
     struct RootStack {
         int64_t* base;
@@ -40,31 +70,160 @@ struct VM {
 
     std::vector<RootStack> rootStacks;
 
-    std::unique_ptr<JITCompiler> jit;
+    // Array handles held by an embedder between calls; marked like any other root.
+    std::vector<int64_t> hostRoots;
+
+    std::shared_ptr<JITCompiler> jit;
+
+    // Where print and friends write. Flushed when run() returns or throws.
+    OutputSink output;
+
+    // Where read_int and friends read from; stdin unless redirected.
+    InputSource input;
+
+    // When non-empty, only functions with their flag set are compiled and the rest
+    // are interpreted. Compiled code cannot call back into interpreted functions.
+    std::vector<bool> compileOnly;
+
+    // When set, every interpreted instruction is counted. Compiled code is not seen.
+    OpStats* opStats = nullptr;
+
+    // When set, frames are mirrored onto the profiler's shadow stack.
+    Profiler* profiler = nullptr;
+
+    // When set, every compiled call is charged to its function's hardware counters.
+    PerfCounters* perfCounters = nullptr;
+
+    // Set while this VM may not allocate arrays, to the error raised if it tries.
+    // The VMs running parallel_for chunks work on a copy of the array table of the
+    // VM that started them, so they share its arrays but must not grow the table.
+    const char* allocError = nullptr;
+
+    // How many spawned tasks deep this VM is running. The arrays a task allocates
+    // are its own until it returns, so a handle to one may not be stored in an
+    // array allocated at a lower level. Those its result reaches pass to the level
+    // below when it returns; the rest are garbage.
+    uint32_t taskLevel = 0;
+
+    // The taskLevel a run starts at: a worker VM runs its task's, others 0.
+    uint32_t runLevel = 0;
+
+    // Ids below this are the spawner's, in the copy of its table a queued task
+    // runs against; the GC neither traces nor frees them.
+    size_t sharedArrays = 0;
+
+    // A call started by spawn. A queued task runs on a pooled worker VM against a
+    // copy of the spawner's table as it was at the spawn, keeping the arrays it
+    // allocates apart, and hands those its result reaches over at the join; one
+    // the pool declined has run inline already, on this VM's stacks and table,
+    // with the same outcome. Either way its output is kept until the join.
+    struct Task : WorkPool::Task {
+        const Program* prog = nullptr;
+        std::shared_ptr<JITCompiler> jit;
+        std::shared_ptr<const std::vector<Array>> arrays;
+        std::shared_ptr<std::atomic<size_t>> arrayIds;
+        std::chrono::steady_clock::time_point startTime;
+        uint32_t level = 0;
+        uint32_t funcId = 0;
+        std::vector<int64_t> args;
+        bool queued = false;
+
+        int64_t result = 0;
+        std::string output;
+        std::string error;
+
+        // The arrays a queued task's result reaches, by id, with their contents
+        // back to back in returnedData. A mapped one keeps its mapping.
+        std::vector<std::pair<size_t, Array>> returned;
+        std::vector<int64_t> returnedData;
+
+        ~Task() override;
+        void run() override;
+    };
+
+    // Moves the arrays a joined queued task returned into this VM's table.
+    void adoptReturned(Task& task);
+
+    // Spawned tasks not joined yet; a task handle is an index here. Their
+    // arguments, and the results of those run inline, are GC roots. Handles below
+    // taskBase belong to the calls runInline is nested in.
+    std::vector<std::shared_ptr<Task>> tasks;
+    std::vector<size_t> freeTasks;
+    size_t taskBase = 0;
+
+    // Joined tasks that ran inline, for reuse by the next spawns.
+    std::vector<std::shared_ptr<Task>> spareTasks;
+
+    // Queued tasks can see every array born before the last of them was queued,
+    // and may be writing to them, so until they are joined the GC treats those as
+    // live without looking inside. Newer arrays stored in one are remembered as
+    // roots instead.
+    size_t queuedTasks = 0;
+    uint64_t pinnedBelow = 0;
+    std::vector<int64_t> remembered;
+
+    // Called for each queued task joined or dropped.
+    void queuedTaskDone();
 
-    explicit VM(const Program* p) : prog(p), jit(new JITCompiler()) {}
+    // The array table as queued tasks see it, shared until the table changes.
+    std::shared_ptr<const std::vector<Array>> arraySnapshot;
+
+    // State behind rand() and time_ms().
+    std::mt19937_64 rng;
+    std::chrono::steady_clock::time_point startTime;
+
+    // Return address into compiled code of the runtime helper that raised the current error.
+    const void* faultSite = nullptr;
+
+    // A VM is single-threaded; any number of them may run the same Program on
+    // different threads. Those sharing a JITCompiler reuse its compiled code.
+    explicit VM(const Program* p);
+    VM(const Program* p, std::shared_ptr<JITCompiler> code);
+    ~VM();
 
     int64_t run(const std::string& entryName);
 
+    // Calls a function with argc arguments. Unlike run(), a compiled function is
+    // entered directly; a function that is not compiled yet is interpreted. The
+    // result stays on estack, so an array it names survives until the next call.
+    int64_t call(uint32_t funcId, const int64_t* args, size_t argc);
+
+    // Runs a task the pool declined on top of the current call, the way a queued
+    // one runs on a VM of its own: a level deeper, with its output and error kept
+    // for the join and whatever it spawned and left joined when it returns.
+    void runInline(Task& task);
+
     void runGC();
     void pushFrame(uint32_t fid, size_t ret_ip);
     void popFrame();
 
     static bool isArrayHandle(int64_t v, size_t arraysSize) {
-        if (v >= 0) return false;
-        uint64_t id = static_cast<uint64_t>(-(v + 1));
-        return id < arraysSize;
+        return Tagged::isArray(v) && Tagged::arrayId(v) < arraysSize;
     }
 
     static size_t handleToId(int64_t v) {
-        return static_cast<size_t>(-(v + 1));
+        return Tagged::arrayId(v);
     }
 
     static int64_t idToHandle(size_t id) {
-        return -static_cast<int64_t>(id + 1);
+        return Tagged::array(id);
     }
 
 private:
+    int64_t enter(uint32_t funcId, const int64_t* args, size_t argc, bool direct);
+
+    // At the end of a call, tasks it spawned and nobody joined are joined in
+    // handle order, or, when the call failed, cancelled or waited for.
+    void joinTasks();
+    void dropTasks();
+    int64_t interpret(size_t ip);
+    std::string describeLocation() const;
+
+    // ip of the instruction being interpreted, for error locations.
+    size_t opIp = 0;
+
+    void growTable(size_t id);
+
     int64_t readI64(size_t& ip) const;
     uint32_t readU32(size_t& ip) const;
 };